@@ -0,0 +1,209 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Micro benchmark for MBitmapOps, compared to the straightforward
+// pixel loops they replace
+
+#include "MBitmapOps.hpp"
+#include "MDevice.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+// --------------------------------------------------------------------
+
+void Run(const std::string &inName, uint32_t inIterations, std::function<void()> &&inFunc)
+{
+	using namespace std::chrono;
+
+	auto start = steady_clock::now();
+
+	for (uint32_t i = 0; i < inIterations; ++i)
+		inFunc();
+
+	duration<double, std::micro> elapsed = steady_clock::now() - start;
+
+	std::cout << std::left << std::setw(40) << inName
+			  << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+			  << elapsed.count() / inIterations << " us/op\n";
+}
+
+uint32_t *Row(MBitmap &inBitmap, uint32_t inY)
+{
+	return reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(inBitmap.Data()) + inY * inBitmap.Stride());
+}
+
+const uint32_t *Row(const MBitmap &inBitmap, uint32_t inY)
+{
+	return reinterpret_cast<const uint32_t *>(reinterpret_cast<const uint8_t *>(inBitmap.Data()) + inY * inBitmap.Stride());
+}
+
+// --------------------------------------------------------------------
+// The loops as they were written before MBitmapOps existed
+
+void CopyLoop(MBitmap &ioDst, const MBitmap &inSrc, MRect inRect)
+{
+	for (int32_t y = 0; y < inRect.height; ++y)
+	{
+		const uint32_t *src = Row(inSrc, y + inRect.y);
+		uint32_t *dst = Row(ioDst, y);
+		for (int32_t x = 0; x < inRect.width; ++x)
+			dst[x] = src[x + inRect.x];
+	}
+}
+
+void FillLoop(MBitmap &ioDst, uint32_t inPixel)
+{
+	for (uint32_t y = 0; y < ioDst.Height(); ++y)
+	{
+		uint32_t *dst = Row(ioDst, y);
+		for (uint32_t x = 0; x < ioDst.Width(); ++x)
+			dst[x] = inPixel;
+	}
+}
+
+void PremultiplyLoop(MBitmap &ioBitmap)
+{
+	for (uint32_t y = 0; y < ioBitmap.Height(); ++y)
+	{
+		uint8_t *p = reinterpret_cast<uint8_t *>(Row(ioBitmap, y));
+		for (uint32_t x = 0; x < ioBitmap.Width(); ++x, p += 4)
+		{
+			p[0] = p[0] * p[3] / 255;
+			p[1] = p[1] * p[3] / 255;
+			p[2] = p[2] * p[3] / 255;
+		}
+	}
+}
+
+void UnpremultiplyLoop(MBitmap &ioBitmap)
+{
+	for (uint32_t y = 0; y < ioBitmap.Height(); ++y)
+	{
+		uint8_t *p = reinterpret_cast<uint8_t *>(Row(ioBitmap, y));
+		for (uint32_t x = 0; x < ioBitmap.Width(); ++x, p += 4)
+		{
+			if (p[3] != 0)
+			{
+				p[0] = p[0] * 255 / p[3];
+				p[1] = p[1] * 255 / p[3];
+				p[2] = p[2] * 255 / p[3];
+			}
+		}
+	}
+}
+
+void SwizzleLoop(MBitmap &ioDst, const MBitmap &inSrc)
+{
+	for (uint32_t y = 0; y < inSrc.Height(); ++y)
+	{
+		const uint8_t *s = reinterpret_cast<const uint8_t *>(Row(inSrc, y));
+		uint8_t *d = reinterpret_cast<uint8_t *>(Row(ioDst, y));
+		for (uint32_t x = 0; x < inSrc.Width(); ++x, s += 4, d += 4)
+		{
+			d[0] = s[2];
+			d[1] = s[1];
+			d[2] = s[0];
+			d[3] = s[3];
+		}
+	}
+}
+
+void OverLoop(MBitmap &ioDst, const MBitmap &inSrc)
+{
+	for (uint32_t y = 0; y < inSrc.Height(); ++y)
+	{
+		const uint8_t *s = reinterpret_cast<const uint8_t *>(Row(inSrc, y));
+		uint8_t *d = reinterpret_cast<uint8_t *>(Row(ioDst, y));
+		for (uint32_t x = 0; x < inSrc.Width(); ++x, s += 4, d += 4)
+		{
+			uint32_t ia = 255 - s[3];
+			for (int c = 0; c < 4; ++c)
+				d[c] = s[c] + d[c] * ia / 255;
+		}
+	}
+}
+
+// --------------------------------------------------------------------
+
+int main(int argc, char *const argv[])
+{
+	std::mt19937 rng(42);
+
+	for (uint32_t size : { 64, 512, 2048 })
+	{
+		std::cout << "--- " << size << " x " << size << " pixels\n";
+
+		MBitmap src(size, size, true), dst(size, size, true);
+
+		for (uint32_t y = 0; y < size; ++y)
+		{
+			uint32_t *row = Row(src, y);
+			for (uint32_t x = 0; x < size; ++x)
+				row[x] = rng();
+		}
+
+		MBitmapOps::Premultiply(src.Data(), src.Stride(), size, size);
+
+		const uint32_t kIterations = size > 512 ? 20 : 200;
+		MRect all(0, 0, size, size);
+
+		Run("copy, loop", kIterations, [&]()
+			{ CopyLoop(dst, src, all); });
+		Run("copy, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::Copy(dst, 0, 0, src, all); });
+
+		Run("fill, loop", kIterations, [&]()
+			{ FillLoop(dst, 0xff336699); });
+		Run("fill, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::Fill(dst, all, 0xff336699); });
+
+		Run("premultiply, loop", kIterations, [&]()
+			{ MBitmapOps::Copy(dst, 0, 0, src, all); PremultiplyLoop(dst); });
+		Run("premultiply, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::Copy(dst, 0, 0, src, all); MBitmapOps::Premultiply(dst.Data(), dst.Stride(), size, size); });
+
+		Run("unpremultiply, loop", kIterations, [&]()
+			{ MBitmapOps::Copy(dst, 0, 0, src, all); UnpremultiplyLoop(dst); });
+		Run("unpremultiply, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::Copy(dst, 0, 0, src, all); MBitmapOps::Unpremultiply(dst.Data(), dst.Stride(), size, size); });
+
+		Run("swizzle, loop", kIterations, [&]()
+			{ SwizzleLoop(dst, src); });
+		Run("swizzle, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::SwizzleARGBToRGBA(dst.Data(), dst.Stride(), src.Data(), src.Stride(), size, size); });
+
+		Run("source over, loop", kIterations, [&]()
+			{ OverLoop(dst, src); });
+		Run("source over, MBitmapOps", kIterations, [&]()
+			{ MBitmapOps::CompositeOver(dst, 0, 0, src, all); });
+	}
+
+	return 0;
+}
@@ -0,0 +1,436 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Rendering benchmarks for libmgui. Everything is drawn with a device
+// on an MBitmap, no display is needed. The results are written as JSON,
+// one object per benchmark with the number of operations per second and
+// the percentiles of the time a single operation took.
+//
+// usage: mgui-bench [--output file] [--time ms] [filter...]
+
+#include "MColor.hpp"
+#include "MColorPicker.hpp"
+#include "MDevice.hpp"
+#include "MLineLayoutCache.hpp"
+#include "MTextWrapper.hpp"
+#include "MUnicode.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------
+
+struct MBenchmark
+{
+	std::string mName;
+	std::function<void()> mFunc;
+};
+
+struct MResult
+{
+	std::string mName;
+	uint32_t mIterations;
+	double mOpsPerSecond;
+	double mMin, mMedian, mP90, mP99, mMax; // microseconds
+};
+
+MResult Run(const MBenchmark &inBenchmark, std::chrono::milliseconds inTime)
+{
+	using namespace std::chrono;
+
+	// warm up the caches, fonts and such
+	for (int i = 0; i < 3; ++i)
+		inBenchmark.mFunc();
+
+	std::vector<double> samples;
+	auto start = steady_clock::now(), end = start + inTime;
+	auto now = start;
+
+	while (now < end or samples.size() < 10)
+	{
+		inBenchmark.mFunc();
+
+		auto next = steady_clock::now();
+		samples.push_back(duration<double, std::micro>(next - now).count());
+		now = next;
+	}
+
+	double total = duration<double>(now - start).count();
+
+	std::sort(samples.begin(), samples.end());
+
+	auto percentile = [&samples](double inP)
+	{
+		size_t ix = static_cast<size_t>(std::ceil(inP * samples.size())) - 1;
+		return samples[std::min(ix, samples.size() - 1)];
+	};
+
+	return {
+		inBenchmark.mName,
+		static_cast<uint32_t>(samples.size()),
+		samples.size() / total,
+		samples.front(), percentile(0.5), percentile(0.9), percentile(0.99), samples.back()
+	};
+}
+
+void WriteJSON(std::ostream &os, const std::vector<MResult> &inResults)
+{
+	os << "{\n  \"benchmarks\": [\n";
+
+	for (size_t i = 0; i < inResults.size(); ++i)
+	{
+		auto &r = inResults[i];
+
+		os << std::fixed << std::setprecision(3)
+		   << "    {\n"
+		   << "      \"name\": \"" << r.mName << "\",\n"
+		   << "      \"iterations\": " << r.mIterations << ",\n"
+		   << "      \"ops_per_second\": " << r.mOpsPerSecond << ",\n"
+		   << "      \"us_min\": " << r.mMin << ",\n"
+		   << "      \"us_p50\": " << r.mMedian << ",\n"
+		   << "      \"us_p90\": " << r.mP90 << ",\n"
+		   << "      \"us_p99\": " << r.mP99 << ",\n"
+		   << "      \"us_max\": " << r.mMax << "\n"
+		   << "    }" << (i + 1 < inResults.size() ? "," : "") << '\n';
+	}
+
+	os << "  ]\n}\n";
+}
+
+// --------------------------------------------------------------------
+
+const char kLoremIpsum[] =
+	"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+	"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud "
+	"exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure "
+	"dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. "
+	"Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt "
+	"mollit anim id est laborum. ";
+
+const uint32_t kCanvasWidth = 1024, kCanvasHeight = 768;
+
+std::vector<MBenchmark> CreateBenchmarks(MDevice &inDevice)
+{
+	std::vector<MBenchmark> result;
+
+	// static, the MStringItems below refer to these
+	static std::vector<std::string> words;
+	if (words.empty())
+	{
+		std::istringstream s(kLoremIpsum);
+		for (std::string w; s >> w;)
+			words.push_back(w);
+	}
+
+	std::mt19937 rng(42);
+	auto coord = [&rng](uint32_t inMax)
+	{ return static_cast<int32_t>(rng() % inMax); };
+
+	// --------------------------------------------------------------------
+	// text
+
+	result.push_back({ "DrawString/100 words", [&inDevice]()
+		{
+			for (uint32_t i = 0; i < 100; ++i)
+				inDevice.DrawString(words[i % words.size()], (i % 10) * 100, (i / 10) * 20);
+		} });
+
+	result.push_back({ "DrawString/100 truncated", [&inDevice]()
+		{
+			for (uint32_t i = 0; i < 100; ++i)
+				inDevice.DrawString(kLoremIpsum, 0, (i % 38) * 20, 300, eAlignNone);
+		} });
+
+	std::vector<MStringItem> items;
+	for (uint32_t i = 0; i < 100; ++i)
+		items.push_back({ words[i % words.size()], static_cast<float>((i % 10) * 100), static_cast<float>((i / 10) * 20) });
+
+	result.push_back({ "DrawStrings/100 words", [&inDevice, items]()
+		{ inDevice.DrawStrings(items); } });
+
+	// more distinct labels than the text layout cache holds per font
+	static std::vector<std::string> labels;
+	if (labels.empty())
+	{
+		for (uint32_t i = 0; i < 2000; ++i)
+			labels.push_back(std::to_string(100000 + i * 7));
+	}
+
+	std::vector<MStringItem> labelItems;
+	for (uint32_t i = 0; i < labels.size(); ++i)
+		labelItems.push_back({ labels[i], static_cast<float>((i % 20) * 50), static_cast<float>((i / 20 % 38) * 20) });
+
+	result.push_back({ "DrawStrings/2000 labels", [&inDevice, labelItems]()
+		{ inDevice.DrawStrings(labelItems); } });
+
+	// a paragraph with a style and colour run for each word
+	std::string paragraph = std::string(kLoremIpsum) + kLoremIpsum;
+	std::vector<uint32_t> offsets, styles, colorIndices;
+	MColor colors[] = { kBlack, MColor("#c00000"), MColor("#0000c0"), MColor("#008000") };
+
+	for (size_t o = 0, i = 0; o < paragraph.length(); ++i)
+	{
+		offsets.push_back(o);
+		styles.push_back(i % 3 == 0 ? MDevice::eTextStyleBold : i % 3 == 1 ? MDevice::eTextStyleItalic : MDevice::eTextStyleNormal);
+		colorIndices.push_back(i % 4);
+
+		o = paragraph.find(' ', o);
+		if (o == std::string::npos)
+			break;
+		++o;
+	}
+
+	result.push_back({ "RenderText/style and colour runs", [&inDevice, paragraph, offsets, styles, colorIndices, colors]() mutable
+		{
+			inDevice.SetText(paragraph);
+			inDevice.SetTextStyles(styles.size(), styles.data(), offsets.data());
+			inDevice.SetTextColors(colorIndices.size(), colorIndices.data(), offsets.data(), colors);
+			inDevice.RenderText(0, 0);
+		} });
+
+	std::vector<MTextRun> runs;
+	for (size_t i = 0; i < offsets.size(); ++i)
+		runs.push_back({ offsets[i], colors[colorIndices[i]], styles[i] });
+
+	result.push_back({ "RenderText/SetTextRuns", [&inDevice, paragraph, runs]()
+		{
+			inDevice.SetText(paragraph);
+			inDevice.SetTextRuns(runs);
+			inDevice.RenderText(0, 0);
+		} });
+
+	// a page of 50 lines in an editor, one line changes per paint
+
+	std::vector<std::string> page;
+	for (uint32_t i = 0; i < 50; ++i)
+		page.emplace_back(kLoremIpsum + (i * 7) % 200, 60);
+
+	result.push_back({ "RenderText/page of 50 lines", [&inDevice, page, edit = 0U]() mutable
+		{
+			char &ch = page[edit++ % page.size()].back();
+			ch = ch == 'x' ? 'y' : 'x';
+			for (uint32_t line = 0; line < page.size(); ++line)
+			{
+				inDevice.SetText(page[line]);
+				inDevice.RenderText(0, line * 20);
+			}
+		} });
+
+	auto lineCache = std::make_shared<MLineLayoutCache>();
+
+	result.push_back({ "RenderText/page of 50 lines, cached", [&inDevice, page, lineCache, edit = 0U]() mutable
+		{
+			uint32_t changed = edit++ % page.size();
+			char &ch = page[changed].back();
+			ch = ch == 'x' ? 'y' : 'x';
+			lineCache->Invalidate(changed);
+
+			for (uint32_t line = 0; line < page.size(); ++line)
+			{
+				lineCache->SetText(inDevice, line, page[line]);
+				inDevice.RenderText(0, line * 20);
+			}
+		} });
+
+	std::string longText;
+	for (int i = 0; i < 20; ++i)
+		longText += kLoremIpsum;
+
+	result.push_back({ "BreakLines/400 px", [&inDevice, longText]()
+		{
+			std::vector<uint32_t> breaks;
+			inDevice.SetText(longText);
+			inDevice.BreakLines(400, breaks);
+		} });
+
+	// hit testing in a log line of 10k columns, as when drag selecting
+
+	std::string logLine;
+	while (logLine.length() < 10000)
+		logLine += kLoremIpsum;
+	logLine.resize(10000);
+
+	result.push_back({ "PositionToIndex/10k column line", [&inDevice, logLine, x = 0]() mutable
+		{
+			inDevice.SetText(logLine);
+			for (int i = 0; i < 100; ++i)
+			{
+				uint32_t index;
+				inDevice.PositionToIndex(x, index);
+
+				int32_t position;
+				inDevice.IndexToPosition(index, false, position);
+
+				x = (x + 997) % 60000;
+			}
+		} });
+
+	// a document of about 1 MB in paragraphs of a few lines
+
+	std::string document;
+	while (document.length() < 1024 * 1024)
+	{
+		document += std::string_view(kLoremIpsum).substr(0, 100 + document.length() % 300);
+		document += '\n';
+	}
+
+	auto measure = MTextWrapper::MeasureWithFont("Sans 10");
+
+	result.push_back({ "MTextWrapper/1 MB, 1 thread", [document, measure]()
+		{ MTextWrapper(measure, 400).Wrap(document, 1); } });
+
+	result.push_back({ "MTextWrapper/1 MB, all threads", [document, measure]()
+		{ MTextWrapper(measure, 400).Wrap(document); } });
+
+	auto wrapper = std::make_shared<MTextWrapper>(measure, 400);
+	wrapper->Wrap(document);
+
+	result.push_back({ "MTextWrapper/rewrap after typing", [document, wrapper, offset = document.length() / 2]() mutable
+		{
+			document.insert(offset, 1, 'x');
+			wrapper->Rewrap(document, offset, 0, 1);
+			document.erase(offset, 1);
+			wrapper->Rewrap(document, offset, 1, 0);
+		} });
+
+	result.push_back({ "MGraphemeIterator/count 1 MB", [document]()
+		{ MGraphemeIterator::Count(document); } });
+
+	result.push_back({ "MWordIterator/count 1 MB", [document]()
+		{ MWordIterator::CountWords(document); } });
+
+	// --------------------------------------------------------------------
+	// shapes
+
+	std::vector<MRect> rects;
+	for (uint32_t i = 0; i < 1000; ++i)
+		rects.emplace_back(coord(kCanvasWidth), coord(kCanvasHeight), 1 + coord(64), 1 + coord(64));
+
+	result.push_back({ "FillRect/1000 rects", [&inDevice, rects]()
+		{
+			for (auto &r : rects)
+				inDevice.FillRect(r);
+		} });
+
+	result.push_back({ "StrokeLine/1000 lines", [&inDevice, rects]()
+		{
+			for (auto &r : rects)
+				inDevice.StrokeLine(r.x, r.y, r.x + r.width, r.y + r.height);
+		} });
+
+	// --------------------------------------------------------------------
+	// bitmaps
+
+	auto bitmap = std::make_shared<MBitmap>(256, 256, true);
+	RenderPickerGradient(*bitmap, ePickHSV, 1.0f);
+
+	result.push_back({ "DrawBitmap/256x256", [&inDevice, bitmap]()
+		{ inDevice.DrawBitmap(*bitmap, 100, 100); } });
+
+	// the colour picker gradients, in the mode picked by default and in
+	// one using the RGB rows
+	result.push_back({ "RenderPickerGradient/256x256 SVH", [bitmap]()
+		{ RenderPickerGradient(*bitmap, ePickSVH, 0.5f); } });
+
+	result.push_back({ "RenderPickerGradient/256x256 RGB", [bitmap]()
+		{ RenderPickerGradient(*bitmap, ePickRGB, 0.5f); } });
+
+	auto large = std::make_shared<MBitmap>(1024, 1024);
+	result.push_back({ "RenderPickerGradient/1024x1024 SVH", [large]()
+		{ RenderPickerGradient(*large, ePickSVH, 0.5f); } });
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+int main(int argc, char *const argv[])
+{
+	std::string output;
+	std::chrono::milliseconds time(500);
+	std::vector<std::string> filters;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--output" and i + 1 < argc)
+			output = argv[++i];
+		else if (arg == "--time" and i + 1 < argc)
+			time = std::chrono::milliseconds(std::stoul(argv[++i]));
+		else if (arg == "--help" or arg == "-h")
+		{
+			std::cout << "usage: mgui-bench [--output file] [--time ms] [filter...]\n";
+			return 0;
+		}
+		else
+			filters.push_back(arg);
+	}
+
+	MBitmap canvas(kCanvasWidth, kCanvasHeight);
+	MDevice dev(canvas);
+
+	dev.SetFont("Sans 10");
+	dev.EraseRect({ 0, 0, kCanvasWidth, kCanvasHeight });
+
+	std::vector<MResult> results;
+
+	for (auto &b : CreateBenchmarks(dev))
+	{
+		if (not filters.empty() and std::none_of(filters.begin(), filters.end(),
+										[&b](const std::string &f)
+										{ return b.mName.find(f) != std::string::npos; }))
+			continue;
+
+		std::cerr << b.mName << "..." << std::endl;
+		results.push_back(Run(b, time));
+	}
+
+	if (output.empty())
+		WriteJSON(std::cout, results);
+	else
+	{
+		std::ofstream file(output);
+		if (not file.is_open())
+		{
+			std::cerr << "Could not open " << output << '\n';
+			return 1;
+		}
+		WriteJSON(file, results);
+	}
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Micro benchmark for the MRegion set operations
+
+#include "MTypes.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+// --------------------------------------------------------------------
+
+std::vector<MRect> RandomRects(std::mt19937 &inRNG, uint32_t inCount, int32_t inSize, int32_t inMaxRectSize)
+{
+	std::uniform_int_distribution<int32_t> pos(0, inSize - inMaxRectSize);
+	std::uniform_int_distribution<int32_t> size(1, inMaxRectSize);
+
+	std::vector<MRect> result;
+	result.reserve(inCount);
+
+	for (uint32_t i = 0; i < inCount; ++i)
+		result.emplace_back(pos(inRNG), pos(inRNG), size(inRNG), size(inRNG));
+
+	return result;
+}
+
+void Run(const std::string &inName, uint32_t inIterations, std::function<void()> &&inFunc)
+{
+	using namespace std::chrono;
+
+	auto start = steady_clock::now();
+
+	for (uint32_t i = 0; i < inIterations; ++i)
+		inFunc();
+
+	duration<double, std::micro> elapsed = steady_clock::now() - start;
+
+	std::cout << std::left << std::setw(40) << inName
+			  << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+			  << elapsed.count() / inIterations << " us/op\n";
+}
+
+int main(int argc, char *const argv[])
+{
+	std::mt19937 rng(42);
+
+	// a 4K canvas
+	const int32_t kSize = 4096;
+
+	for (uint32_t count : { 100, 1000, 5000 })
+	{
+		std::cout << "--- " << count << " rectangles\n";
+
+		auto rects1 = RandomRects(rng, count, kSize, 64);
+		auto rects2 = RandomRects(rng, count, kSize, 64);
+
+		MRegion r1, r2;
+		for (auto &r : rects1)
+			r1 |= r;
+		for (auto &r : rects2)
+			r2 |= r;
+
+		std::cout << "region has " << r1.GetRectCount() << " rectangles\n";
+
+		const uint32_t kIterations = count > 1000 ? 20 : 200;
+
+		Run("accumulate damage", kIterations, [&]()
+			{
+			MRegion r;
+			for (auto &rect : rects1)
+				r |= rect; });
+
+		Run("construct from rectangles", kIterations, [&]()
+			{ MRegion r(rects1); });
+
+		// rows of text being invalidated top to bottom
+		Run("accumulate damage, sorted", kIterations, [&]()
+			{
+			MRegion r;
+			for (uint32_t i = 0; i < count; ++i)
+				r |= MRect(0, i * 16, 1 + i % 800, 16); });
+
+		Run("union", kIterations, [&]()
+			{ MRegion r = r1 | r2; });
+
+		Run("intersection", kIterations, [&]()
+			{ MRegion r = r1 & r2; });
+
+		Run("subtraction", kIterations, [&]()
+			{ MRegion r = r1 - r2; });
+
+		Run("intersection with rect", kIterations, [&]()
+			{ MRegion r = r1 & MRect(1000, 1000, 1000, 1000); });
+
+		Run("offset", kIterations, [&]()
+			{ r1.OffsetBy(1, 1); r1.OffsetBy(-1, -1); });
+
+		uint32_t hits = 0;
+		Run("1000 x contains point", kIterations, [&]()
+			{
+			for (uint32_t i = 0; i < 1000; ++i)
+				hits += r1.ContainsPoint((i * 7919) % kSize, (i * 104729) % kSize); });
+	}
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Pixel operations on 32 bit pixel buffers, as used by MBitmap.
+//
+// Pixels are native endian 0xAARRGGBB values, the same layout as
+// cairo's ARGB32 format. Strides are in bytes. The routines use
+// SSE2, AVX2 or NEON when available and fall back to plain C++
+// otherwise, results are the same in all cases. Copy uses memmove,
+// which the C library already vectorises, and on NEON Unpremultiply
+// uses the plain C++ version.
+
+#include "MTypes.hpp"
+
+#include <cstdint>
+
+class MBitmap;
+
+namespace MBitmapOps
+{
+
+// Rows of an MBitmap start at a 64 byte boundary
+const uint32_t kRowAlignment = 64;
+
+// The stride for a row of inWidth pixels, rounded up to kRowAlignment
+uint32_t AlignedStride(uint32_t inWidth);
+
+// Allocate and free pixel data aligned to kRowAlignment
+uint32_t *AllocatePixels(uint32_t inStride, uint32_t inHeight);
+void FreePixels(uint32_t *inPixels);
+
+// Copy a block of inWidth by inHeight pixels
+void Copy(uint32_t *outDst, uint32_t inDstStride,
+	const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight);
+
+// Fill a block of pixels with inPixel
+void Fill(uint32_t *outDst, uint32_t inDstStride,
+	uint32_t inWidth, uint32_t inHeight, uint32_t inPixel);
+
+// Convert straight alpha to premultiplied alpha and back, in place
+void Premultiply(uint32_t *ioData, uint32_t inStride, uint32_t inWidth, uint32_t inHeight);
+void Unpremultiply(uint32_t *ioData, uint32_t inStride, uint32_t inWidth, uint32_t inHeight);
+
+// Convert between 0xAARRGGBB pixels and pixels stored as the bytes
+// R, G, B, A in memory, as used by e.g. PNG and OpenGL. The conversion
+// is its own inverse, outDst may be the same as inSrc.
+void SwizzleARGBToRGBA(uint32_t *outDst, uint32_t inDstStride,
+	const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight);
+
+inline void SwizzleRGBAToARGB(uint32_t *outDst, uint32_t inDstStride,
+	const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight)
+{
+	SwizzleARGBToRGBA(outDst, inDstStride, inSrc, inSrcStride, inWidth, inHeight);
+}
+
+// Porter-Duff source over destination, both premultiplied
+void CompositeOver(uint32_t *ioDst, uint32_t inDstStride,
+	const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight);
+
+// Convenience versions for MBitmap, inSrcRect is clipped to the source
+// and the destination. These mark the destination as dirty.
+
+void Copy(MBitmap &ioDst, int32_t inX, int32_t inY, const MBitmap &inSrc, MRect inSrcRect);
+void Fill(MBitmap &ioDst, MRect inRect, uint32_t inPixel);
+void CompositeOver(MBitmap &ioDst, int32_t inX, int32_t inY, const MBitmap &inSrc, MRect inSrcRect);
+
+} // namespace MBitmapOps
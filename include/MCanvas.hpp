@@ -66,6 +66,15 @@ class MCanvasImpl : public MControlImpl<MCanvas>
 	virtual ~MCanvasImpl() = default;
 
 	virtual void Invalidate();
+	virtual void Invalidate(MRect inRect);
+	virtual void InvalidateLayers() {}
+
+	virtual void ScrollBits(MRect inRect, int32_t inDeltaX, int32_t inDeltaY) { Invalidate(inRect); }
+
+	virtual void SetTiled(bool inTiled, uint32_t inTileSize) {}
+	virtual bool IsTiled() const { return false; }
+
+	virtual int32_t GetScaleFactor() const { return 1; }
 
 	static MCanvasImpl *Create(MCanvas *inCanvas, uint32_t inWidth, uint32_t inHeight,
 		MCanvasDropTypes inDropTypes);
@@ -82,4 +91,53 @@ class MCanvas : public MControl<MCanvasImpl>
 	~MCanvas();
 
 	void Invalidate() override;
+	void Invalidate(MRect inRect) override;
+
+	/// \brief Discard the contents of the offscreen layers and redraw.
+	///
+	/// Offscreen layers are created with MDevice(this, rect, true).
+	void InvalidateLayers();
+
+	/// \brief Move the contents of the canvas by \a inDeltaX, \a inDeltaY pixels.
+	///
+	/// Use this instead of Invalidate after changing the scroll position.
+	/// The pixels that were drawn already are moved and only the area
+	/// that is exposed is drawn again with a call to Draw(inUpdate).
+	/// A positive \a inDeltaY moves the contents down.
+	void ScrollBits(int32_t inDeltaX, int32_t inDeltaY);
+
+	/// \brief As ScrollBits above, but only for the area \a inRect
+	/// in bounds coordinates, e.g. the part below a fixed header.
+	void ScrollBits(MRect inRect, int32_t inDeltaX, int32_t inDeltaY);
+
+	using MControl<MCanvasImpl>::Draw;
+
+	/// \brief Draw the area \a inUpdate, in bounds coordinates.
+	///
+	/// Drawing outside \a inUpdate is clipped away. The default
+	/// implementation simply calls Draw().
+	virtual void Draw(MRect inUpdate);
+
+	/// \brief Render the canvas in tiles of \a inTileSize pixels.
+	///
+	/// In tiled mode Draw is no longer called. Instead the visible tiles
+	/// are rendered by calling DrawTile on worker threads, the results
+	/// are cached and only tiles touched by Invalidate are rendered again.
+	/// Meant for canvases much larger than the window.
+	void SetTiled(bool inTiled, uint32_t inTileSize = 256);
+	bool IsTiled() const;
+
+	/// \brief The number of device pixels per unit, e.g. 2 on HiDPI screens.
+	///
+	/// Bitmaps drawn in Draw should have this many pixels per unit, see
+	/// MBitmap::SetScale, to look sharp. Valid while drawing.
+	int32_t GetScaleFactor() const;
+
+	/// \brief Draw the tile \a inTile, in bounds coordinates.
+	///
+	/// Called on a worker thread with a device drawing in an offscreen
+	/// bitmap, several tiles may be drawn at the same time. This must
+	/// therefore only read data that is not modified while tiles are
+	/// being drawn and it should not access other views.
+	virtual void DrawTile(MDevice &inDevice, MRect inTile) {}
 };
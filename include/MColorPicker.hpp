@@ -29,6 +29,8 @@
 #include "MCanvas.hpp"
 #include "MDialog.hpp"
 
+class MBitmap;
+
 // --------------------------------------------------------------------
 
 class MColorSwatch : public MCanvas
@@ -76,6 +78,11 @@ enum MPickerMode
 	ePickRGB
 };
 
+// Fill ioBitmap with the gradient the colour picker shows for inMode,
+// inChannel is the value of the channel selected with the slider.
+// This is what the picker redraws when the colour changes.
+void RenderPickerGradient(MBitmap &ioBitmap, MPickerMode inMode, float inChannel);
+
 class MColorPicker : public MDialog
 {
   public:
@@ -29,6 +29,10 @@
 #include "MColor.hpp"
 #include "MTypes.hpp"
 
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <string_view>
 #include <vector>
 
 #undef DrawText
@@ -36,6 +40,8 @@
 class MView;
 class MTextLayout;
 class MDevice;
+class MDisplayList;
+struct MFontImpl;
 
 enum MAlignment
 {
@@ -67,9 +73,14 @@ enum MGeometryBegin
 	eGeometryBeginHollow
 };
 
+// MGeometry records a path once, it can then be stroked or filled
+// as often as needed. A geometry created without a device can be kept
+// around and be reused in any device, e.g. in each call to Draw.
+
 class MGeometry
 {
   public:
+	explicit MGeometry(MGeometryFillMode inMode = eGeometryFillModeAlternate);
 	MGeometry(MDevice &inDevice, MGeometryFillMode inMode = eGeometryFillModeAlternate);
 	~MGeometry();
 
@@ -96,19 +107,113 @@ class MBitmap
 	MBitmap(const MBitmap &inSource, MRect inCopyRect);
 	virtual ~MBitmap();
 
-	uint32_t *Data() const { return mData; }
+	// Writing pixels through Data() marks the bitmap as dirty, a device
+	// will then reload the pixels the next time the bitmap is drawn.
+	// The flag is atomic since GetImpl may clear it on another thread.
+	uint32_t *Data()
+	{
+		mDirty = true;
+		return mData;
+	}
+	const uint32_t *Data() const { return mData; }
+	void MarkDirty() { mDirty = true; }
+
 	uint32_t Stride() const { return mStride; }
 	bool UseAlpha() const { return mUseAlpha; }
 
 	uint32_t Width() const { return mWidth; }
 	uint32_t Height() const { return mHeight; }
 
+	// The number of pixels per unit, DrawBitmap draws a bitmap with a
+	// scale of two at half its size in pixels. Used for bitmaps made
+	// for HiDPI screens, the default is one.
+	uint32_t GetScale() const { return mScale; }
+	void SetScale(uint32_t inScale);
+
+	// The platform specific image for this bitmap, e.g. a cairo surface.
+	// It is created on first use and lives as long as the bitmap. This
+	// may be called from several threads at once for a shared bitmap.
+	struct MBitmapImpl *GetImpl() const;
+
   private:
 	MBitmap(const MBitmap &);
 	MBitmap &operator=(const MBitmap &);
 	uint32_t *mData;
 	uint32_t mWidth, mHeight, mStride;
+	uint32_t mScale = 1;
 	bool mUseAlpha;
+	mutable std::mutex mImplMutex;
+	mutable std::atomic<bool> mDirty = true;
+	mutable struct MBitmapImpl *mImpl = nullptr;
+};
+
+// MFont is a handle to a font. The font description is parsed only
+// once, fonts are interned and two MFont objects created for the same
+// description share the same data. Copying and comparing is cheap.
+
+class MFont
+{
+  public:
+	MFont() = default;
+	explicit MFont(const std::string &inFont);
+	explicit MFont(const MFontImpl *inImpl)
+		: mImpl(inImpl)
+	{
+	}
+
+	std::string GetDescription() const;
+
+	bool operator==(const MFont &inFont) const = default;
+	explicit operator bool() const { return mImpl != nullptr; }
+
+	const MFontImpl *GetImpl() const { return mImpl; }
+
+  private:
+	const MFontImpl *mImpl = nullptr;
+};
+
+// A string for DrawStrings, the text is not copied. The position
+// is the top left of the string, as for DrawString.
+
+struct MStringItem
+{
+	std::string_view mText;
+	float mX, mY;
+};
+
+// Shaped text, glyph indices in a font with their position on
+// the baseline.
+
+struct MGlyph
+{
+	uint32_t mIndex;
+	float mX, mY;
+};
+
+struct MGlyphRun
+{
+	MFont mFont;
+	MColor mColor;
+	std::vector<MGlyph> mGlyphs;
+};
+
+// The colour and style of a run of text, for SetTextRuns. A run
+// starts at byte offset mOffset and lasts until the next run, mStyle
+// contains MDevice::MTextStyle flags.
+
+struct MTextRun
+{
+	uint32_t mOffset;
+	MColor mColor;
+	uint32_t mStyle;
+};
+
+struct MTextLayoutCacheStatistics
+{
+	uint64_t mHits = 0;
+	uint64_t mMisses = 0;
+	uint64_t mEvictions = 0;
+	uint32_t mEntries = 0;
 };
 
 class MDevice
@@ -117,10 +222,20 @@ class MDevice
 	// create a dummy device, used for measuring text widths
 	MDevice();
 	// a regular device, used for drawing in a view
-	// if inCreateOffscreen is true, drawing is done
-	// in a GdkPixmap instead.
-	// MDevice(MView* inView, MRect inRect, bool inCreateOffscreen = false);
 	MDevice(MView *inView);
+	// a device for drawing in inRect of a view. If inCreateOffscreen
+	// is true, drawing is done in a retained layer owned by the view
+	// instead. The layer is copied into the view when the device is
+	// destroyed and it keeps its contents until the view calls
+	// InvalidateLayers.
+	MDevice(MView *inView, MRect inRect, bool inCreateOffscreen = false);
+	// a device drawing in inBitmap, this one does not need a display
+	// and can be used on any thread. The pixels of inBitmap are up to
+	// date once the device is destroyed.
+	MDevice(MBitmap &inBitmap);
+	// a device recording all drawing in ioList, see MDisplayList.
+	// inBounds is what GetBounds returns for this device.
+	MDevice(MDisplayList &ioList, MRect inBounds);
 
 	~MDevice();
 	void Save();
@@ -131,16 +246,21 @@ class MDevice
 	int32_t GetPageNr() const;
 	MRect GetBounds() const;
 
+	// returns true for an offscreen device whose layer still contains
+	// what was drawn in it before, drawing can be skipped in that case.
+	bool IsOffscreenValid() const;
+
 	static void ListFonts(bool inFixedWidthOnly, std::vector<std::string> &outFonts);
 	void SetFont(const std::string &inFont);
+	void SetFont(MFont inFont);
 	void SetForeColor(MColor inColor);
 	MColor GetForeColor() const;
 	void SetBackColor(MColor inColor);
 	MColor GetBackColor() const;
 
 	void ClipRect(MRect inRect);
+	void ClipRegion(const MRegion &inRegion);
 
-	// void		ClipRegion(MRegion inRegion);
 	void EraseRect(MRect inRect);
 	void FillRect(MRect inRect);
 	void StrokeRect(MRect inRect, uint32_t inLineWidth = 1);
@@ -159,8 +279,26 @@ class MDevice
 	float GetLeading() const;
 	int32_t GetLineHeight() const;
 	float GetXWidth() const;
+	uint32_t GetStringWidth(const std::string &inText) const;
+
+	// The width of inText in fractional pixels. Unlike GetStringWidth
+	// this is not rounded, the widths of pieces of a text add up to the
+	// width of the whole.
+	float GetStringAdvance(std::string_view inText) const;
 	void DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth = 0, MAlignment inAlign = eAlignNone);
 	void DrawString(const std::string &inText, MRect inBounds, MAlignment inAlign = eAlignNone);
+
+	// Draw many short strings at once in the current font and colour.
+	// This is a lot faster than calling DrawString for each of them.
+	void DrawStrings(std::span<const MStringItem> inStrings);
+
+	// Shape inStrings in the current font and colour and append the
+	// result to outRuns, one run per font used. The runs can be kept
+	// and drawn any number of times with DrawGlyphRuns. Strings with
+	// characters none of the fonts has a glyph for are left out, draw
+	// those with DrawString. DrawStrings does that by itself.
+	void GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns) const;
+	void DrawGlyphRuns(std::span<const MGlyphRun> inRuns);
 	// Text Layout options
 	void SetText(const std::string &inText);
 
@@ -179,6 +317,12 @@ class MDevice
 
 	void SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t inOffsets[]);
 
+	// Set the colours and styles of the text in one go, this replaces
+	// SetTextColors and SetTextStyles. The runs must be sorted on
+	// offset. Call this right after SetText, before any selection or
+	// background is set.
+	void SetTextRuns(std::span<const MTextRun> inRuns);
+
 	void RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor);
 	void SetTextSelection(uint32_t inStart, uint32_t inLength, MColor inSelectionColor);
 
@@ -203,6 +347,9 @@ class MDevice
 
 	static void GetSysSelectionColor(MColor &outColor);
 
+	// DrawString and GetStringWidth share a cache of shaped strings
+	static MTextLayoutCacheStatistics GetTextLayoutCacheStatistics();
+
 	// Theme support
 
 	void DrawListItemBackground(MRect inBounds, MListItemState inState);
@@ -43,10 +43,62 @@ struct MGeometryImpl
 	virtual void CurveTo(float inX1, float inY1, float inX2, float inY2, float inX3, float inY3) = 0;
 	virtual void End(bool inClose) = 0;
 
+	// A copy of the geometry, used by MDisplayList. Returns nullptr
+	// if the geometry cannot be copied.
+	virtual MGeometryImpl *Clone() const { return nullptr; }
+
+	static MGeometryImpl *
+	Create(MGeometryFillMode inMode);
+
 	static MGeometryImpl *
 	Create(MDevice &inDevice, MGeometryFillMode inMode);
 };
 
+// --------------------------------------------------------------------
+// base class for the platform specific image of an MBitmap
+
+struct MBitmapImpl
+{
+	MBitmapImpl() {}
+	virtual ~MBitmapImpl() {}
+
+	// the pixels of the bitmap were changed
+	virtual void MarkDirty() {}
+
+	// the bitmap has inScale pixels per unit
+	virtual void SetScale(uint32_t inScale) {}
+
+	static MBitmapImpl *Create(const MBitmap &inBitmap);
+};
+
+// --------------------------------------------------------------------
+// base class for interned fonts, see MFont
+
+struct MFontImpl
+{
+	MFontImpl(const std::string &inName)
+		: mName(inName)
+	{
+	}
+
+	virtual ~MFontImpl() {}
+
+	std::string mName;
+
+	static const MFontImpl *Intern(const std::string &inFont);
+};
+
+// --------------------------------------------------------------------
+// base class for a shaped line of text kept by MLineLayoutCache
+
+struct MTextLayoutImpl
+{
+	MTextLayoutImpl() {}
+	virtual ~MTextLayoutImpl() {}
+
+	float mWidth = 0, mHeight = 0;
+};
+
 // --------------------------------------------------------------------
 // base class for MDeviceImpl
 
@@ -61,9 +113,11 @@ class MDeviceImpl
 
 	virtual bool IsPrinting(int32_t &outPage) const { return false; }
 	virtual MRect GetBounds() const { return { 0, 0, 100, 100 }; }
+	virtual bool IsOffscreenValid() const { return false; }
 	virtual void SetOrigin(int32_t inX, int32_t inY) {}
 
 	virtual void SetFont(const std::string &inFont) {}
+	virtual void SetFont(const MFontImpl *inFont) { SetFont(inFont->mName); }
 
 	virtual void SetForeColor(MColor inColor) {}
 	virtual MColor GetForeColor() const { return kBlack; }
@@ -71,7 +125,7 @@ class MDeviceImpl
 	virtual MColor GetBackColor() const { return kWhite; }
 
 	virtual void ClipRect(MRect inRect) {}
-	// virtual void			ClipRegion(// MRegion inRegion)				{}
+	virtual void ClipRegion(const MRegion &inRegion) {}
 
 	virtual void EraseRect(MRect inRect) {}
 	virtual void FillRect(MRect inRect) {}
@@ -97,12 +151,39 @@ class MDeviceImpl
 	virtual void DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth = 0, MAlignment inAlign = eAlignNone) {}
 	virtual void DrawString(const std::string &inText, MRect inBounds, MAlignment inAlign = eAlignNone) {}
 	virtual uint32_t GetStringWidth(const std::string &inText) { return 0; }
+	virtual float GetStringAdvance(std::string_view inText) { return GetStringWidth(std::string{ inText }); }
+
+	virtual void DrawStrings(std::span<const MStringItem> inStrings)
+	{
+		for (auto &s : inStrings)
+			DrawString(std::string{ s.mText }, s.mX, s.mY);
+	}
+
+	virtual void GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns) {}
+	virtual void DrawGlyphRuns(std::span<const MGlyphRun> inRuns) {}
 
 	// Text Layout options
 	virtual void SetText(const std::string &inText) {}
 	virtual void SetTabStops(float inTabWidth) {}
 	virtual void SetTextColors(uint32_t inColorCount, uint32_t inColorIndices[], uint32_t inOffsets[], MColor inColors[]) {}
 	virtual void SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t inOffsets[]) {}
+
+	virtual void SetTextRuns(std::span<const MTextRun> inRuns)
+	{
+		std::vector<uint32_t> offsets, indices, styles;
+		std::vector<MColor> colors;
+
+		for (auto &run : inRuns)
+		{
+			offsets.push_back(run.mOffset);
+			indices.push_back(colors.size());
+			colors.push_back(run.mColor);
+			styles.push_back(run.mStyle);
+		}
+
+		SetTextColors(inRuns.size(), indices.data(), offsets.data(), colors.data());
+		SetTextStyles(inRuns.size(), styles.data(), offsets.data());
+	}
 	virtual void RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor) {}
 	virtual void SetTextSelection(uint32_t inStart, uint32_t inLength, MColor inSelectionColor) {}
 	virtual void SetDrawWhiteSpace(bool inDrawWhiteSpace, MColor inWhiteSpaceColor) {}
@@ -114,6 +195,14 @@ class MDeviceImpl
 	virtual void DrawCaret(float inX, float inY, uint32_t inOffset) {}
 	virtual void BreakLines(uint32_t inWidth, std::vector<uint32_t> &outBreaks) {}
 
+	// Support for MLineLayoutCache. SaveTextLayout returns the shaped
+	// layout for the text set last, the device keeps using it. With
+	// UseTextLayout a saved layout becomes the current text again, this
+	// fails if the font or tab stops differ. Devices that can not share
+	// layouts return nullptr and false.
+	virtual MTextLayoutImpl *SaveTextLayout() { return nullptr; }
+	virtual bool UseTextLayout(MTextLayoutImpl *inLayout) { return false; }
+
 	virtual void SetScale(float inScaleX, float inScaleY, float inCenterX, float inCenterY) {}
 	virtual void MakeTransparent(float inOpacity) {}
 	// virtual GdkPixmap*		GetPixmap() const							{ return nullptr; }
@@ -122,4 +211,6 @@ class MDeviceImpl
 
 	static MDeviceImpl *Create();
 	static MDeviceImpl *Create(MView *inView);
+	static MDeviceImpl *Create(MView *inView, MRect inRect, bool inCreateOffscreen);
+	static MDeviceImpl *Create(MBitmap &inBitmap);
 };
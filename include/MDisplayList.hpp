@@ -0,0 +1,94 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "MDevice.hpp"
+
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MDisplayList is a recording of drawing commands. Record with an
+// MDevice constructed for the list, then replay on any other device
+// as often as needed. A view whose contents rarely change can record
+// once and replay on each draw.
+//
+// Commands are stored in a compact form in large chunks of memory.
+// Each drawing command knows its bounds in the coordinates of the
+// recording, so a replay can skip everything outside a clip rect.
+// Bitmaps and geometries are copied, fonts are interned already.
+
+class MDisplayList
+{
+  public:
+	MDisplayList();
+	~MDisplayList();
+
+	MDisplayList(MDisplayList &&inList);
+	MDisplayList &operator=(MDisplayList &&inList);
+
+	MDisplayList(const MDisplayList &) = delete;
+	MDisplayList &operator=(const MDisplayList &) = delete;
+
+	void Clear();
+
+	bool IsEmpty() const { return mCommandCount == 0; }
+	uint32_t GetCommandCount() const { return mCommandCount; }
+
+	// The number of bytes used by the commands
+	size_t GetByteSize() const;
+
+	// The union of the bounds of all drawing commands, commands whose
+	// bounds are not known, e.g. RenderText, are not included
+	MRect GetBounds() const { return mBounds; }
+
+	void Replay(MDevice &inDevice) const;
+
+	// Replay only the drawing commands that intersect inClip, all
+	// other commands like colour and font changes are replayed as well.
+	void Replay(MDevice &inDevice, MRect inClip) const;
+
+  private:
+	friend class MRecordingDeviceImpl;
+
+	static constexpr size_t kChunkSize = 64 * 1024;
+
+	void *Allocate(size_t inSize);
+	void Replay(MDevice &inDevice, const MRect *inClip) const;
+
+	struct MChunk
+	{
+		std::unique_ptr<std::byte[]> mData;
+		size_t mSize, mCapacity;
+	};
+
+	std::vector<MChunk> mChunks;
+	std::vector<std::unique_ptr<MBitmap>> mBitmaps;
+	std::vector<std::unique_ptr<struct MGeometryImpl>> mGeometries;
+	uint32_t mCommandCount = 0;
+	MRect mBounds;
+};
@@ -0,0 +1,105 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MFrameStats records how long drawing a canvas takes, one histogram per
+// view ID. Recording is lock free, a canvas looks up its histogram once
+// and then only updates atomic counters.
+//
+// Recording is off by default. Setting the environment variable
+// MGUI_FRAME_STATS turns it on and dumps the statistics when the
+// application exits, to stderr or to the file named by the variable.
+
+class MFrameHistogram
+{
+  public:
+	void Record(std::chrono::nanoseconds inTime);
+	void Reset();
+
+	uint64_t GetCount() const;
+
+	// in microseconds, the percentile is accurate to within 1/16th
+	double GetPercentile(double inPercentile) const;
+	double GetMax() const;
+
+  private:
+	static constexpr uint32_t kSubBuckets = 16, kBucketCount = 32 * kSubBuckets;
+
+	static uint32_t BucketIndex(uint64_t inMicroseconds);
+	static double BucketValue(uint32_t inIndex);
+
+	std::atomic<uint64_t> mBuckets[kBucketCount] = {};
+	std::atomic<uint64_t> mCount = 0, mMax = 0;
+};
+
+class MFrameStats
+{
+  public:
+	struct MSummary
+	{
+		std::string mID;
+		uint64_t mCount;
+		double mP50, mP95, mP99, mMax; // in milliseconds
+	};
+
+	static MFrameStats &Instance();
+
+	bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+	void SetEnabled(bool inEnabled) { mEnabled = inEnabled; }
+
+	// The histogram for view inID, it lives as long as the application
+	MFrameHistogram &GetHistogram(const std::string &inID);
+
+	std::vector<MSummary> GetSummaries() const;
+	void Reset();
+
+	void Dump(std::ostream &os) const;
+
+  private:
+	MFrameStats();
+	~MFrameStats();
+
+	MFrameStats(const MFrameStats &) = delete;
+	MFrameStats &operator=(const MFrameStats &) = delete;
+
+	std::atomic<bool> mEnabled = false;
+	std::string mDumpFile;
+	bool mDump = false;
+
+	mutable std::mutex mMutex;
+	std::map<std::string, std::unique_ptr<MFrameHistogram>> mHistograms;
+};
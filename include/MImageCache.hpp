@@ -0,0 +1,113 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "MDevice.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MImageCache holds decoded PNG images from the resources. Images are
+// keyed by resource name and scale, for a scale other than one the
+// resource name@<scale>x.png is used if it exists, e.g. Icons/open@2x.png.
+// Such an image has its scale set, DrawBitmap draws it at the size of
+// the plain one.
+//
+// Decoded images are immutable and shared by all users. The cache
+// keeps at most GetBudget() bytes of pixel data, the least recently
+// used images are evicted first. Images still in use stay alive.
+
+class MImageCache
+{
+  public:
+	static MImageCache &Instance();
+
+	// Return the image, decoding it on the calling thread if needed.
+	// Returns nullptr if the resource does not exist or cannot be decoded.
+	std::shared_ptr<const MBitmap> Get(const std::string &inName, uint32_t inScale = 1);
+
+	// Return the image if it was decoded already. Otherwise decoding is
+	// started on a background thread and nullptr is returned, inReady
+	// is then called on the main thread once the image is available.
+	std::shared_ptr<const MBitmap> Request(const std::string &inName, uint32_t inScale = 1,
+		std::function<void()> inReady = {});
+
+	void SetBudget(size_t inBytes);
+	size_t GetBudget() const;
+	size_t GetBytesUsed() const;
+
+	void Clear();
+
+  private:
+	MImageCache();
+	~MImageCache();
+
+	MImageCache(const MImageCache &) = delete;
+	MImageCache &operator=(const MImageCache &) = delete;
+
+	typedef std::pair<std::string, uint32_t> MKey;
+
+	struct MEntry
+	{
+		MKey mKey;
+		std::shared_ptr<const MBitmap> mBitmap;
+		size_t mSize = 0;
+		bool mQueued = false;
+		bool mDecoding = false;
+		bool mDecoded = false;
+		std::vector<std::function<void()>> mReady;
+	};
+
+	typedef std::list<MEntry> MEntryList;
+
+	MEntryList::iterator Lookup(const MKey &inKey);
+	MEntryList::iterator Remove(MEntryList::iterator inEntry);
+	void Evict();
+
+	// store the decoded image, returns the callbacks to notify
+	std::vector<std::function<void()>> Store(MEntryList::iterator inEntry, std::shared_ptr<const MBitmap> inBitmap);
+	void Decoder();
+
+	static std::shared_ptr<const MBitmap> Decode(const MKey &inKey);
+
+	mutable std::mutex mMutex;
+	std::condition_variable mCV, mDecodedCV;
+	MEntryList mLRU;
+	std::map<MKey, MEntryList::iterator> mIndex;
+	std::list<MEntryList::iterator> mQueue;
+	size_t mBudget, mBytesUsed = 0;
+	bool mDone = false;
+	std::thread mThread;
+};
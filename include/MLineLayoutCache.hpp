@@ -0,0 +1,97 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "MDevice.hpp"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+struct MTextLayoutImpl;
+
+// --------------------------------------------------------------------
+// MLineLayoutCache keeps the shaped text of each line in an editor
+// style view. Instead of calling SetText and SetTextRuns on a device for
+// every visible line on every paint, call SetText on the cache. If the
+// text and runs of the line did not change, the layout shaped before is
+// used again and only the lines touched by an edit are shaped.
+//
+// Selection, background and tab stops can be set on the device as
+// usual after SetText. Changing the attributes of a cached layout makes
+// the device shape a private copy, the cached layout is not altered.
+
+class MLineLayoutCache
+{
+  public:
+	MLineLayoutCache(uint32_t inMaxLayouts = 4096);
+	~MLineLayoutCache();
+
+	MLineLayoutCache(const MLineLayoutCache &) = delete;
+	MLineLayoutCache &operator=(const MLineLayoutCache &) = delete;
+
+	// Set the text of line inLine on inDevice, the same as calling
+	// inDevice.SetText and inDevice.SetTextRuns.
+	void SetText(MDevice &inDevice, uint32_t inLine, const std::string &inText,
+		std::span<const MTextRun> inRuns = {});
+
+	// The size of line inLine when it was shaped last, returns false
+	// if the line is not in the cache.
+	bool GetLineSize(uint32_t inLine, float &outWidth, float &outHeight) const;
+
+	// Line inLine was edited
+	void Invalidate(uint32_t inLine);
+
+	// inCount lines were inserted before or deleted at inLine, the
+	// entries for the lines following move along.
+	void InsertLines(uint32_t inLine, uint32_t inCount);
+	void DeleteLines(uint32_t inLine, uint32_t inCount);
+
+	// Drop all lines, e.g. after the font changed
+	void Clear();
+
+	MTextLayoutCacheStatistics GetStatistics() const;
+
+  private:
+	struct MEntry
+	{
+		size_t mHash = 0;
+		std::string mText;
+		std::vector<MTextRun> mRuns;
+		std::unique_ptr<MTextLayoutImpl> mLayout;
+		uint64_t mLastUsed = 0;
+	};
+
+	void Purge();
+
+	std::vector<MEntry> mLines;
+	uint32_t mMaxLayouts;
+	uint32_t mLayoutCount = 0;
+	uint64_t mClock = 0;
+	MTextLayoutCacheStatistics mStatistics;
+};
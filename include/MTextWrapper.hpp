@@ -0,0 +1,83 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MTextWrapper soft wraps text at a fixed width, breaking lines at the
+// opportunities found by MLineBreakIterator. The text is kept as a list
+// of paragraphs, split at newline characters, so after an edit only the
+// paragraphs touched are wrapped again. Large texts are wrapped using
+// the shared MWorkers pool, each thread taking batches of paragraphs.
+
+class MTextWrapper
+{
+  public:
+	// Return the width of a piece of text. When wrapping in parallel
+	// this is called from several threads at the same time.
+	using MMeasureFunc = std::function<float(std::string_view)>;
+
+	MTextWrapper(MMeasureFunc inMeasure, float inWidth);
+
+	// A measure function that uses GetStringAdvance of a device for
+	// inFont, each thread has its own device.
+	static MMeasureFunc MeasureWithFont(const std::string &inFont);
+
+	// Wrap all of inText, inThreads is the maximum number of threads to
+	// use, zero means all threads of the worker pool.
+	void Wrap(std::string_view inText, uint32_t inThreads = 0);
+
+	// inText is the text after an edit that replaced inOldLength bytes at
+	// inOffset with inNewLength bytes, only the paragraphs touched by the
+	// edit are wrapped again.
+	void Rewrap(std::string_view inText, size_t inOffset, size_t inOldLength, size_t inNewLength);
+
+	size_t GetLineCount() const { return mLineCount; }
+
+	// the offset of the first byte of each line
+	std::vector<size_t> GetLineStarts() const;
+
+  private:
+	struct MParagraph
+	{
+		size_t mLength;               // including the newline
+		std::vector<uint32_t> mBreaks; // soft breaks, relative to the start of the paragraph
+	};
+
+	std::vector<MParagraph> WrapParagraphs(std::string_view inText, bool inAtEnd, uint32_t inThreads) const;
+	void WrapParagraph(std::string_view inText, MParagraph &ioParagraph) const;
+	size_t FitPrefix(std::string_view inText) const;
+
+	MMeasureFunc mMeasure;
+	float mWidth, mSpaceWidth, mTabWidth;
+	std::vector<MParagraph> mParagraphs;
+	size_t mLineCount = 0;
+};
@@ -28,6 +28,7 @@
 
 #include <iostream>
 #include <cstdint>
+#include <vector>
 
 typedef char32_t unicode;
 
@@ -97,14 +98,24 @@ struct MRect
 	}
 };
 
+/**
+ * MRegion is a set of pixels, stored as a list of non-overlapping
+ * rectangles in y-x banded order, as in X11 and pixman. The rectangles
+ * are sorted on y and then x, all rectangles in one band share the same
+ * top and bottom and vertically adjacent bands that are equal are merged.
+ */
+
 class MRegion
 {
   public:
 	MRegion();
 	MRegion(const MRect &inRect);
 	MRegion(const MRegion &inRegion);
+	MRegion(MRegion &&inRegion);
+	MRegion(const std::vector<MRect> &inRects);
 	~MRegion();
 	MRegion &operator=(const MRegion &inRegion);
+	MRegion &operator=(MRegion &&inRegion);
 	// Intersection
 	MRegion operator&(const MRegion &inRegion) const;
 	MRegion operator&(const MRect &inRect) const;
@@ -115,12 +126,27 @@ class MRegion
 	MRegion operator|(const MRect &inRect) const;
 	MRegion &operator|=(const MRegion &inRegion);
 	MRegion &operator|=(const MRect &inRect);
+	// Subtraction
+	MRegion operator-(const MRegion &inRegion) const;
+	MRegion operator-(const MRect &inRect) const;
+	MRegion &operator-=(const MRegion &inRegion);
+	MRegion &operator-=(const MRect &inRect);
+
+	bool operator==(const MRegion &inRegion) const;
+	bool operator!=(const MRegion &inRegion) const { return not operator==(inRegion); }
+
 	// test for empty region
-	operator bool() const;
+	bool empty() const;
+	explicit operator bool() const { return not empty(); }
+
 	void OffsetBy(int32_t inX, int32_t inY);
 	bool ContainsPoint(int32_t inX, int32_t inY) const;
 	MRect GetBounds() const;
 
+	// The rectangles making up this region, in banded order
+	uint32_t GetRectCount() const;
+	std::vector<MRect> GetRects() const;
+
   private:
 	struct MRegionImpl *mImpl;
 };
@@ -36,6 +36,7 @@
 #pragma once
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "MTypes.hpp"
@@ -165,6 +166,107 @@ inline std::vector<S> Split(std::string_view s, std::string_view p, bool compres
 	return result;
 }
 
+// --------------------------------------------------------------------
+/// \brief Line break opportunities in UTF-8 text, following UAX #14
+///
+/// Each call to Next moves to the next position where a line may be
+/// broken, the line then ends just before GetOffset. The end of the
+/// text is always reported as a mandatory break.
+
+class MLineBreakIterator
+{
+  public:
+	MLineBreakIterator(std::string_view inText);
+
+	bool Next();
+
+	size_t GetOffset() const { return mOffset; }
+	bool IsMandatory() const { return mMandatory; }
+
+  private:
+	uint32_t ReadClass(size_t inOffset, uint32_t &outLength) const;
+
+	std::string_view mText;
+	size_t mOffset = 0, mNext = 0;
+	uint32_t mClass = 0;     // class of the text before mNext
+	bool mAfterSpace = false;
+	bool mMandatory = false;
+	bool mDone = false;
+};
+
+// --------------------------------------------------------------------
+/// \brief Grapheme cluster boundaries in UTF-8 text, following UAX #29
+///
+/// Next moves to the end of the next cluster and Prev to the start of
+/// the previous one, both return false when there is nothing left. Use
+/// this to move the caret by one user perceived character. The tables
+/// have no emoji properties, a zero width joiner simply joins the
+/// characters around it.
+
+class MGraphemeIterator
+{
+  public:
+	MGraphemeIterator(std::string_view inText, size_t inOffset = 0)
+		: mText(inText)
+		, mOffset(inOffset)
+	{
+	}
+
+	bool Next();
+	bool Prev();
+
+	size_t GetOffset() const { return mOffset; }
+
+	static bool IsBoundary(std::string_view inText, size_t inOffset);
+
+	// the number of grapheme clusters in inText
+	static size_t Count(std::string_view inText);
+
+  private:
+	std::string_view mText;
+	size_t mOffset;
+};
+
+// --------------------------------------------------------------------
+/// \brief Word boundaries in UTF-8 text, following UAX #29
+///
+/// Next and Prev move to the next or previous word boundary. IsWord
+/// tells whether the text between the last two boundaries visited is a
+/// word, as opposed to white space or punctuation. Letters and digits
+/// form words, including apostrophes and periods between them. Runs of
+/// Han and Katakana are words as well, Han followed by Hiragana is one
+/// word.
+
+class MWordIterator
+{
+  public:
+	MWordIterator(std::string_view inText, size_t inOffset = 0)
+		: mText(inText)
+		, mOffset(inOffset)
+		, mOther(inOffset)
+	{
+	}
+
+	bool Next();
+	bool Prev();
+
+	size_t GetOffset() const { return mOffset; }
+	bool IsWord() const;
+
+	static bool IsBoundary(std::string_view inText, size_t inOffset);
+
+	// the word, or run of white space or punctuation, at inOffset, e.g.
+	// for selecting text with a double click
+	static std::pair<size_t, size_t> FindWord(std::string_view inText, size_t inOffset);
+
+	// the number of words in inText
+	static size_t CountWords(std::string_view inText);
+
+  private:
+	std::string_view mText;
+	size_t mOffset, mOther; // mOther is the boundary visited before mOffset
+};
+
 // --------------------------------------------------------------------
 // one byte character set utilities
 
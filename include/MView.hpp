@@ -173,6 +173,9 @@ class MView
 
 	virtual void Invalidate();
 
+	/// \brief Invalidate only the area \a inRect, in bounds coordinates
+	virtual void Invalidate(MRect inRect);
+
 	virtual void UpdateNow();
 	virtual void AdjustCursor(int32_t inX, int32_t inY, uint32_t inModifiers);
 	virtual void SetCursor(MCursor inCursor);
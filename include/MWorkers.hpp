@@ -0,0 +1,75 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MWorkers is the one pool of worker threads shared by all parallel
+// work in the library, e.g. the tiled canvas rendering, the colour
+// picker gradients and the text wrapper. It has one thread less than
+// there are cores, the thread asking for the work is the last one.
+
+class MWorkers
+{
+  public:
+	static MWorkers &Instance();
+
+	// The number of threads working on a ParallelFor, including the
+	// calling thread.
+	uint32_t GetConcurrency() const { return static_cast<uint32_t>(mThreads.size()) + 1; }
+
+	// Run inJob on one of the worker threads. Jobs are run last in,
+	// first out, the most recent request is the most likely to matter.
+	void Enqueue(std::function<void()> &&inJob);
+
+	// Call inFunc for each index in [0, inCount) and return when all
+	// calls are done. The calling thread takes part, so this is safe
+	// to call from a worker thread as well.
+	void ParallelFor(uint32_t inCount, const std::function<void(uint32_t)> &inFunc);
+
+  private:
+	MWorkers();
+	~MWorkers();
+
+	MWorkers(const MWorkers &) = delete;
+	MWorkers &operator=(const MWorkers &) = delete;
+
+	void Run();
+
+	std::mutex mMutex;
+	std::condition_variable mCV;
+	std::deque<std::function<void()>> mJobs;
+	std::vector<std::thread> mThreads;
+	bool mDone = false;
+};
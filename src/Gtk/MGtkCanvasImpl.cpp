@@ -29,20 +29,144 @@
     Created 28-09-07 11:18:30
 */
 
+#include "MApplication.hpp"
+#include "MBitmapOps.hpp"
 #include "MControls.hpp"
 #include "MControls.inl"
+#include "MDeviceImpl.hpp"
+#include "MFrameStats.hpp"
 #include "MUnicode.hpp"
 #include "MUtils.hpp"
 #include "MWindow.hpp"
+#include "MWorkers.hpp"
 
 #include "MGtkCanvasImpl.hpp"
 #include "MGtkControlsImpl.inl"
 #include "MGtkDeviceImpl.hpp"
 #include "MGtkWindowImpl.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <utility>
+
+// --------------------------------------------------------------------
+// Tiled rendering. The tiles of all canvases are drawn by the shared
+// MWorkers pool, each tile in a bitmap of its own. The finished tile
+// is handed to the main thread which stores it in the tile cache of
+// the canvas. The cache itself is only accessed on the main thread.
+
+struct MGtkCanvasImpl::MTileCache
+{
+	struct MTile
+	{
+		std::shared_ptr<MBitmap> mBitmap;
+		cairo_surface_t *mSurface = nullptr;
+		uint32_t mGeneration = 0; // incremented by Invalidate
+		uint32_t mRendered = 0;   // the generation in mBitmap
+		bool mPending = false;
+		uint64_t mLastUsed = 0;
+	};
+
+	MTileCache(MCanvas *inCanvas, uint32_t inTileSize)
+		: mCanvas(inCanvas)
+		, mTileSize(inTileSize)
+	{
+	}
+
+	~MTileCache()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		++mEpoch;
+
+		for (auto &[key, tile] : mTiles)
+		{
+			if (tile.mSurface != nullptr)
+				cairo_surface_destroy(tile.mSurface);
+		}
+
+		mTiles.clear();
+	}
+
+	// Called by a worker before drawing a tile, returns false if the
+	// canvas is gone or no longer tiled.
+	bool BeginDraw()
+	{
+		std::unique_lock lock(mMutex);
+		if (mCancelled)
+			return false;
+		++mDrawing;
+		return true;
+	}
+
+	void EndDraw()
+	{
+		std::unique_lock lock(mMutex);
+		if (--mDrawing == 0)
+			mCV.notify_all();
+	}
+
+	// Called on the main thread, waits for the tiles being drawn
+	void Cancel()
+	{
+		std::unique_lock lock(mMutex);
+		mCancelled = true;
+		mCV.wait(lock, [this]
+			{ return mDrawing == 0; });
+	}
+
+	// Store a finished tile, returns true if it is to be shown
+	bool Store(std::pair<int32_t, int32_t> inKey, uint32_t inEpoch, uint32_t inGeneration, int32_t inScale, std::shared_ptr<MBitmap> inBitmap)
+	{
+		// drawn before a Clear, e.g. for another size or scale factor
+		if (mCancelled or inEpoch != mEpoch)
+			return false;
+
+		auto i = mTiles.find(inKey);
+		if (i == mTiles.end())
+			return false;
+
+		auto &tile = i->second;
+		tile.mPending = false;
+
+		if (not inBitmap)
+			return false;
+
+		if (tile.mSurface != nullptr)
+			cairo_surface_destroy(tile.mSurface);
+
+		tile.mBitmap = std::move(inBitmap);
+		tile.mSurface = cairo_image_surface_create_for_data(
+			reinterpret_cast<uint8_t *>(const_cast<uint32_t *>(std::as_const(*tile.mBitmap).Data())),
+			CAIRO_FORMAT_ARGB32, tile.mBitmap->Width(), tile.mBitmap->Height(), tile.mBitmap->Stride());
+		cairo_surface_set_device_scale(tile.mSurface, inScale, inScale);
+		tile.mRendered = inGeneration;
+
+		return true;
+	}
+
+	MCanvas *mCanvas;
+	uint32_t mTileSize;
+	uint32_t mEpoch = 0;
+	uint64_t mFrame = 0;
+	std::map<std::pair<int32_t, int32_t>, MTile> mTiles;
+
+	std::mutex mMutex;
+	std::condition_variable mCV;
+	uint32_t mDrawing = 0;
+	bool mCancelled = false;
+};
+
+// --------------------------------------------------------------------
 
 MGtkCanvasImpl::MGtkCanvasImpl(MCanvas *inCanvas, uint32_t inWidth, uint32_t inHeight,
 	MCanvasDropTypes inDropTypes)
@@ -57,6 +181,14 @@ MGtkCanvasImpl::MGtkCanvasImpl(MCanvas *inCanvas, uint32_t inWidth, uint32_t inH
 
 MGtkCanvasImpl::~MGtkCanvasImpl()
 {
+	SetTiled(false, 0);
+	DisconnectAdjustments();
+
+	for (auto &layer : mLayers)
+		cairo_surface_destroy(layer.mSurface);
+
+	if (mBackingStore != nullptr)
+		cairo_surface_destroy(mBackingStore);
 }
 
 void MGtkCanvasImpl::CreateWidget()
@@ -166,12 +298,247 @@ void MGtkCanvasImpl::OnKeyModifiers(GdkModifierType inModifiers)
 
 void MGtkCanvasImpl::Invalidate()
 {
+	if (mTiles)
+	{
+		for (auto &[key, tile] : mTiles->mTiles)
+			++tile.mGeneration;
+	}
+
+	mDamageAll = true;
+
+	if (GTK_IS_WIDGET(GetWidget()))
+		gtk_widget_queue_draw(GetWidget());
+}
+
+void MGtkCanvasImpl::Invalidate(MRect inRect)
+{
+	MRect bounds = mControl->GetBounds();
+
+	inRect.x -= bounds.x;
+	inRect.y -= bounds.y;
+	inRect &= MRect(0, 0, bounds.width, bounds.height);
+
+	if (inRect.empty())
+		return;
+
+	if (mTiles)
+	{
+		const int32_t ts = mTiles->mTileSize;
+
+		for (auto &[key, tile] : mTiles->mTiles)
+		{
+			if (MRect(key.first * ts, key.second * ts, ts, ts).Intersects(inRect))
+				++tile.mGeneration;
+		}
+
+		if (GTK_IS_WIDGET(GetWidget()))
+			gtk_widget_queue_draw(GetWidget());
+		return;
+	}
+
+	if (mDamageAll)
+		return;
+
+	mDamage |= inRect;
+
+	if (GTK_IS_WIDGET(GetWidget()))
+		gtk_widget_queue_draw(GetWidget());
+}
+
+void MGtkCanvasImpl::ScrollBits(MRect inRect, int32_t inDeltaX, int32_t inDeltaY)
+{
+	MRect bounds = mControl->GetBounds();
+
+	MRect r = inRect;
+	r.x -= bounds.x;
+	r.y -= bounds.y;
+	r &= MRect(0, 0, bounds.width, bounds.height);
+
+	if (r.empty() or (inDeltaX == 0 and inDeltaY == 0))
+		return;
+
+	// nothing to move, or everything is going to be redrawn anyway
+	if (mTiles or mBackingStore == nullptr or mDamageAll)
+	{
+		Invalidate(inRect);
+		return;
+	}
+
+	// only the visible part of r has pixels in the backing store
+	MRect moved = r & mBackingRect;
+
+	if (not moved.empty())
+	{
+		moved.x -= mBackingRect.x;
+		moved.y -= mBackingRect.y;
+
+		moved = ShiftBackingStore(moved, inDeltaX, inDeltaY);
+
+		moved.x += mBackingRect.x;
+		moved.y += mBackingRect.y;
+	}
+
+	// damage that was not drawn yet moves along with the pixels
+	MRegion damage = mDamage & r;
+	mDamage -= r;
+	damage.OffsetBy(inDeltaX, inDeltaY);
+	mDamage |= damage & r;
+
+	// and the area that was uncovered needs drawing
+	mDamage |= MRegion(r) - moved;
+
 	if (GTK_IS_WIDGET(GetWidget()))
 		gtk_widget_queue_draw(GetWidget());
 }
 
+MRect MGtkCanvasImpl::ShiftBackingStore(MRect inRect, int32_t inDeltaX, int32_t inDeltaY)
+{
+	// the part of inRect that still has valid pixels after the move
+	MRect result(inRect.x + inDeltaX, inRect.y + inDeltaY, inRect.width, inRect.height);
+	result &= inRect;
+
+	if (result.empty())
+		return result;
+
+	double scaleX = 1, scaleY = 1;
+	cairo_surface_get_device_scale(mBackingStore, &scaleX, &scaleY);
+
+	const int32_t scale = static_cast<int32_t>(scaleX);
+	const uint32_t stride = cairo_image_surface_get_stride(mBackingStore);
+
+	cairo_surface_flush(mBackingStore);
+
+	uint8_t *data = cairo_image_surface_get_data(mBackingStore);
+	auto pixel = [data, stride, scale](int32_t inX, int32_t inY)
+	{
+		return reinterpret_cast<uint32_t *>(data + inY * scale * stride) + inX * scale;
+	};
+
+	MBitmapOps::Copy(pixel(result.x, result.y), stride,
+		pixel(result.x - inDeltaX, result.y - inDeltaY), stride,
+		result.width * scale, result.height * scale);
+
+	cairo_surface_mark_dirty(mBackingStore);
+
+	return result;
+}
+
+void MGtkCanvasImpl::UpdateVisibleRect(MRect inVisible)
+{
+	if (mBackingStore == nullptr or inVisible == mBackingRect)
+		return;
+
+	// a viewport that changed size needs a new backing store
+	if (inVisible.width != mBackingRect.width or inVisible.height != mBackingRect.height)
+	{
+		cairo_surface_destroy(mBackingStore);
+		mBackingStore = nullptr;
+		return;
+	}
+
+	if (not mDamageAll)
+	{
+		MRect moved = ShiftBackingStore(MRect(0, 0, inVisible.width, inVisible.height),
+			mBackingRect.x - inVisible.x, mBackingRect.y - inVisible.y);
+
+		if (moved.empty())
+			mDamageAll = true;
+		else
+		{
+			moved.x += inVisible.x;
+			moved.y += inVisible.y;
+
+			// only the strips that scrolled into view need drawing
+			mDamage |= MRegion(inVisible) - moved;
+		}
+	}
+
+	mBackingRect = inVisible;
+}
+
+void MGtkCanvasImpl::InvalidateLayers()
+{
+	for (auto &layer : mLayers)
+		layer.mValid = false;
+}
+
+cairo_surface_t *MGtkCanvasImpl::GetLayer(MRect inRect, bool &outValid)
+{
+	auto i = std::find_if(mLayers.begin(), mLayers.end(),
+		[inRect](const MLayer &layer)
+		{ return layer.mRect == inRect; });
+
+	if (i == mLayers.end())
+	{
+		mLayers.push_back({ inRect, CreateSurface(inRect.width, inRect.height), false, 0 });
+		i = std::prev(mLayers.end());
+	}
+
+	outValid = i->mValid;
+	i->mValid = true;
+	i->mLastUsed = mLayerFrame;
+
+	return i->mSurface;
+}
+
+void MGtkCanvasImpl::DropUnusedLayers()
+{
+	auto unused = std::remove_if(mLayers.begin(), mLayers.end(),
+		[frame = mLayerFrame](const MLayer &layer)
+		{ return layer.mLastUsed + kMaxLayerAge < frame; });
+
+	for (auto i = unused; i != mLayers.end(); ++i)
+		cairo_surface_destroy(i->mSurface);
+
+	mLayers.erase(unused, mLayers.end());
+}
+
+cairo_surface_t *MGtkCanvasImpl::CreateSurface(int32_t inWidth, int32_t inHeight)
+{
+	UpdateScale();
+
+	const int32_t scale = mScale;
+
+	cairo_surface_t *result = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, inWidth * scale, inHeight * scale);
+	cairo_surface_set_device_scale(result, scale, scale);
+
+	return result;
+}
+
+void MGtkCanvasImpl::UpdateScale()
+{
+	int32_t scale = GTK_IS_WIDGET(GetWidget()) ? gtk_widget_get_scale_factor(GetWidget()) : 1;
+
+	if (scale == mScale)
+		return;
+
+	mScale = scale;
+
+	for (auto &layer : mLayers)
+		cairo_surface_destroy(layer.mSurface);
+	mLayers.clear();
+
+	if (mBackingStore != nullptr)
+	{
+		cairo_surface_destroy(mBackingStore);
+		mBackingStore = nullptr;
+	}
+
+	if (mTiles)
+		mTiles->Clear();
+}
+
 void MGtkCanvasImpl::Resize(int width, int height)
 {
+	// layers are likely to be sized after the view
+	for (auto &layer : mLayers)
+		cairo_surface_destroy(layer.mSurface);
+	mLayers.clear();
+
+	// and the tiles at the edges now have a different size
+	if (mTiles)
+		mTiles->Clear();
+
 	MRect frame = mControl->GetFrame();
 	MRect bounds;
 	bounds.width = width;
@@ -196,18 +563,294 @@ void MGtkCanvasImpl::Resize(int width, int height)
 void MGtkCanvasImpl::DrawCB(GtkDrawingArea *area, cairo_t *cr, int width, int height, gpointer data)
 {
 	MGtkCanvasImpl *self = reinterpret_cast<MGtkCanvasImpl *>(data);
-	self->mCurrentCairo = cr;
 
-	try
+	self->UpdateScale();
+
+	if (self->mTiles)
+	{
+		self->DrawTiles(cr, width, height);
+		return;
+	}
+
+	self->ConnectAdjustments();
+
+	// The backing store only holds the visible part of the widget, a
+	// canvas inside a viewport can be much larger than cairo allows.
+	MRect visible = self->GetVisibleRect(width, height);
+	if (visible.empty())
+		return;
+
+	// normally done when the adjustments changed, but be sure
+	self->UpdateVisibleRect(visible);
+
+	if (self->mBackingStore == nullptr)
+	{
+		self->mBackingStore = self->CreateSurface(visible.width, visible.height);
+		self->mBackingRect = visible;
+		self->mDamageAll = true;
+	}
+
+	// damage outside the backing store is redrawn when it scrolls into view
+	MRegion damage = self->mDamageAll ? MRegion(visible) : self->mDamage & visible;
+
+	self->mDamage = {};
+	self->mDamageAll = false;
+
+	if (not damage.empty())
+	{
+		cairo_t *bcr = cairo_create(self->mBackingStore);
+		cairo_translate(bcr, -visible.x, -visible.y);
+
+		for (auto &r : damage.GetRects())
+			cairo_rectangle(bcr, r.x, r.y, r.width, r.height);
+		cairo_clip(bcr);
+
+		cairo_save(bcr);
+		cairo_set_operator(bcr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(bcr);
+		cairo_restore(bcr);
+
+		MRect bounds = self->mControl->GetBounds();
+		MRect update = damage.GetBounds();
+		update.x += bounds.x;
+		update.y += bounds.y;
+
+		self->mCurrentCairo = bcr;
+		++self->mLayerFrame;
+
+		auto &stats = MFrameStats::Instance();
+		bool timed = stats.IsEnabled();
+		if (timed and self->mFrameHistogram == nullptr)
+			self->mFrameHistogram = &stats.GetHistogram(self->mControl->GetID());
+
+		auto start = std::chrono::steady_clock::now();
+
+		try
+		{
+			self->mControl->Draw(update);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << ex.what() << '\n';
+		}
+
+		if (timed)
+			self->mFrameHistogram->Record(std::chrono::steady_clock::now() - start);
+
+		self->mCurrentCairo = nullptr;
+		self->DropUnusedLayers();
+
+		cairo_destroy(bcr);
+	}
+
+	cairo_set_source_surface(cr, self->mBackingStore, visible.x, visible.y);
+	cairo_rectangle(cr, visible.x, visible.y, visible.width, visible.height);
+	cairo_fill(cr);
+}
+
+void MGtkCanvasImpl::SetTiled(bool inTiled, uint32_t inTileSize)
+{
+	if (mTiles)
 	{
-		self->mControl->Draw();
+		mTiles->Cancel();
+		mTiles.reset();
 	}
-	catch (const std::exception &ex)
+
+	if (inTiled)
 	{
-		std::cerr << ex.what() << '\n';
+		mTiles = std::make_shared<MTileCache>(mControl, std::max(inTileSize, 16U));
+
+		if (mBackingStore != nullptr)
+		{
+			cairo_surface_destroy(mBackingStore);
+			mBackingStore = nullptr;
+		}
 	}
+}
+
+MRect MGtkCanvasImpl::GetVisibleRect(int32_t inWidth, int32_t inHeight)
+{
+	MRect result(0, 0, inWidth, inHeight);
+
+	GtkWidget *parent = gtk_widget_get_parent(GetWidget());
+
+	// The viewport moves its child only after the adjustments changed
+	if (mHAdjustment != nullptr and mVAdjustment != nullptr)
+	{
+		result &= MRect(
+			std::lround(gtk_adjustment_get_value(mHAdjustment)),
+			std::lround(gtk_adjustment_get_value(mVAdjustment)),
+			std::lround(gtk_adjustment_get_page_size(mHAdjustment)),
+			std::lround(gtk_adjustment_get_page_size(mVAdjustment)));
+	}
+	else if (GTK_IS_VIEWPORT(parent))
+	{
+		graphene_point_t pt{};
+
+		if (gtk_widget_compute_point(parent, GetWidget(), &pt, &pt))
+			result &= MRect(pt.x, pt.y, gtk_widget_get_width(parent), gtk_widget_get_height(parent));
+	}
+
+	return result;
+}
+
+// Scrolling a viewport does not redraw its child, but new tiles
+// may have become visible or the backing store needs to move along.
+void MGtkCanvasImpl::ConnectAdjustments()
+{
+	GtkWidget *parent = gtk_widget_get_parent(GetWidget());
+
+	if (mHAdjustment != nullptr or not GTK_IS_VIEWPORT(parent))
+		return;
+
+	mHAdjustment = gtk_scrollable_get_hadjustment(GTK_SCROLLABLE(parent));
+	mVAdjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(parent));
+
+	for (auto adj : { mHAdjustment, mVAdjustment })
+	{
+		if (adj != nullptr)
+		{
+			g_object_ref(adj);
+			g_signal_connect(adj, "value-changed", G_CALLBACK(&MGtkCanvasImpl::AdjustmentChangedCB), this);
+		}
+	}
+}
+
+void MGtkCanvasImpl::DisconnectAdjustments()
+{
+	for (auto adj : { mHAdjustment, mVAdjustment })
+	{
+		if (adj != nullptr)
+		{
+			g_signal_handlers_disconnect_by_data(adj, this);
+			g_object_unref(adj);
+		}
+	}
+
+	mHAdjustment = mVAdjustment = nullptr;
+}
+
+void MGtkCanvasImpl::AdjustmentChangedCB(GtkAdjustment *inAdjustment, gpointer inData)
+{
+	auto self = static_cast<MGtkCanvasImpl *>(inData);
+
+	if (not self->mTiles)
+		self->UpdateVisibleRect(self->GetVisibleRect(
+			gtk_widget_get_width(self->GetWidget()), gtk_widget_get_height(self->GetWidget())));
+
+	gtk_widget_queue_draw(self->GetWidget());
+}
+
+void MGtkCanvasImpl::DrawTiles(cairo_t *inContext, int32_t inWidth, int32_t inHeight)
+{
+	ConnectAdjustments();
+
+	auto &cache = *mTiles;
+	const int32_t ts = cache.mTileSize;
+
+	++cache.mFrame;
+
+	MRect visible = GetVisibleRect(inWidth, inHeight);
+	if (visible.empty())
+		return;
+
+	uint32_t visibleCount = 0;
+
+	for (int32_t row = visible.y / ts; row * ts < visible.y + visible.height; ++row)
+	{
+		for (int32_t column = visible.x / ts; column * ts < visible.x + visible.width; ++column)
+		{
+			auto &tile = cache.mTiles[{ column, row }];
+			tile.mLastUsed = cache.mFrame;
+			++visibleCount;
+
+			MRect r(column * ts, row * ts, ts, ts);
+			r &= MRect(0, 0, inWidth, inHeight);
+
+			// a stale tile is better than none while the new one is drawn
+			if (tile.mSurface != nullptr)
+			{
+				cairo_set_source_surface(inContext, tile.mSurface, r.x, r.y);
+				cairo_rectangle(inContext, r.x, r.y, r.width, r.height);
+				cairo_fill(inContext);
+			}
+
+			if ((tile.mSurface == nullptr or tile.mRendered != tile.mGeneration) and not tile.mPending)
+				RequestTile(column, row, r);
+		}
+	}
+
+	// Keep the tiles around the visible area, drop the rest
+	const size_t kMaxTiles = std::max<size_t>(64, 4 * visibleCount);
+
+	if (cache.mTiles.size() > kMaxTiles)
+	{
+		std::vector<std::pair<uint64_t, std::pair<int32_t, int32_t>>> candidates;
+		for (auto &[key, tile] : cache.mTiles)
+		{
+			if (tile.mLastUsed != cache.mFrame and not tile.mPending)
+				candidates.emplace_back(tile.mLastUsed, key);
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+
+		for (size_t i = 0; i < candidates.size() and cache.mTiles.size() > kMaxTiles; ++i)
+		{
+			auto t = cache.mTiles.find(candidates[i].second);
+			if (t->second.mSurface != nullptr)
+				cairo_surface_destroy(t->second.mSurface);
+			cache.mTiles.erase(t);
+		}
+	}
+}
+
+void MGtkCanvasImpl::RequestTile(int32_t inColumn, int32_t inRow, MRect inRect)
+{
+	auto &tile = mTiles->mTiles[{ inColumn, inRow }];
+	tile.mPending = true;
+
+	MRect bounds = mControl->GetBounds();
+	MRect update = inRect;
+	update.x += bounds.x;
+	update.y += bounds.y;
+
+	MWorkers::Instance().Enqueue(
+		[tiles = mTiles, key = std::make_pair(inColumn, inRow), epoch = mTiles->mEpoch, generation = tile.mGeneration, scale = mScale, update]()
+		{
+			std::shared_ptr<MBitmap> bitmap;
+
+			if (tiles->BeginDraw())
+			{
+				bitmap = std::make_shared<MBitmap>(update.width * scale, update.height * scale, true);
+
+				try
+				{
+					MDevice dev(*bitmap);
+
+					dev.SetScale(scale, scale, 0, 0);
+					dev.GetImpl()->SetOrigin(-update.x, -update.y);
+					dev.ClipRect(update);
+
+					tiles->mCanvas->DrawTile(dev, update);
+				}
+				catch (const std::exception &ex)
+				{
+					std::cerr << ex.what() << '\n';
+					bitmap.reset();
+				}
+
+				tiles->EndDraw();
+			}
+
+			auto store = [tiles, key, epoch, generation, scale, bitmap]()
+			{
+				if (tiles->Store(key, epoch, generation, scale, bitmap))
+					gtk_widget_queue_draw(static_cast<MGtkCanvasImpl *>(tiles->mCanvas->GetImpl())->GetWidget());
+			};
 
-	self->mCurrentCairo = nullptr;
+			if (gApp != nullptr)
+				gApp->ExecuteAsync(std::move(store));
+		});
 }
 
 void MGtkCanvasImpl::OnCommit(char *inText)
@@ -30,6 +30,7 @@
 #include "MGtkControlsImpl.hpp"
 
 #include <cassert>
+#include <memory>
 
 // --------------------------------------------------------------------
 
@@ -49,6 +50,24 @@ class MGtkCanvasImpl : public MGtkControlImpl<MCanvas>
 	void CreateWidget() override;
 
 	void Invalidate() override;
+	void Invalidate(MRect inRect) override;
+	void InvalidateLayers() override;
+
+	void ScrollBits(MRect inRect, int32_t inDeltaX, int32_t inDeltaY) override;
+
+	void SetTiled(bool inTiled, uint32_t inTileSize) override;
+	bool IsTiled() const override { return mTiles != nullptr; }
+
+	// Return the retained layer for inRect, outValid is set to true if
+	// it still contains what was drawn before. The layer is considered
+	// valid from now on.
+	cairo_surface_t *GetLayer(MRect inRect, bool &outValid);
+
+	// Create an image surface that matches the widget's scale factor
+	cairo_surface_t *CreateSurface(int32_t inWidth, int32_t inHeight);
+
+	// The scale factor of the widget at the last draw
+	int32_t GetScaleFactor() const override { return mScale; }
 
   protected:
 
@@ -82,9 +101,61 @@ class MGtkCanvasImpl : public MGtkControlImpl<MCanvas>
 
 	static void DrawCB(GtkDrawingArea *area, cairo_t *cr, int width, int height, gpointer data);
 
+	// tiled mode
+	void DrawTiles(cairo_t *inContext, int32_t inWidth, int32_t inHeight);
+	void RequestTile(int32_t inColumn, int32_t inRow, MRect inRect);
+	MRect GetVisibleRect(int32_t inWidth, int32_t inHeight);
+	void ConnectAdjustments();
+	void DisconnectAdjustments();
+	static void AdjustmentChangedCB(GtkAdjustment *inAdjustment, gpointer inData);
+
 	MSlot<void(int, int)> mResize;
 	void Resize(int width, int height);
 
+	// Drop all cached pixels if the scale factor changed, e.g. when
+	// the window moved to a monitor with a different resolution.
+	void UpdateScale();
+	int32_t mScale = 1;
+
 	cairo_t *mCurrentCairo = nullptr;
 	MCanvasDropTypes mDropTypes;
+
+	// GTK4 wants the complete contents of a drawing area on each
+	// snapshot, so we keep the pixels in a backing store and only
+	// redraw the damaged area, which is kept in widget coordinates.
+	// The backing store covers mBackingRect, the visible part of the
+	// widget, and scrolling a viewport moves its pixels along.
+	MRect ShiftBackingStore(MRect inRect, int32_t inDeltaX, int32_t inDeltaY);
+	void UpdateVisibleRect(MRect inVisible);
+
+	cairo_surface_t *mBackingStore = nullptr;
+	MRect mBackingRect;
+	MRegion mDamage;
+	bool mDamageAll = true;
+
+	// set on the first draw when MFrameStats is enabled
+	class MFrameHistogram *mFrameHistogram = nullptr;
+
+	struct MLayer
+	{
+		MRect mRect;
+		cairo_surface_t *mSurface;
+		bool mValid;
+		uint64_t mLastUsed;
+	};
+
+	// A view may skip a layer outside the damaged area for a while,
+	// layers are only dropped when they were not asked for in the
+	// last kMaxLayerAge frames, or on a resize or scale change.
+	void DropUnusedLayers();
+	static constexpr uint64_t kMaxLayerAge = 600;
+
+	std::vector<MLayer> mLayers;
+	uint64_t mLayerFrame = 0;
+
+	// In tiled mode the tiles are kept in mTiles, shared with the
+	// workers drawing them.
+	struct MTileCache;
+	std::shared_ptr<MTileCache> mTiles;
+	GtkAdjustment *mHAdjustment = nullptr, *mVAdjustment = nullptr;
 };
@@ -27,14 +27,21 @@
 #include "MGtkDeviceImpl.hpp"
 #include "MGtkCanvasImpl.hpp"
 
+#include "MBitmapOps.hpp"
 #include "MError.hpp"
 #include "MUnicode.hpp"
 #include "MView.hpp"
 #include "MWindow.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 
 struct MPangoContext
 {
@@ -45,9 +52,10 @@ struct MPangoContext
 
 	~MPangoContext() { g_object_unref(mPangoContext); }
 
+	// pango is not thread safe, each thread gets its own context
 	static MPangoContext &instance()
 	{
-		static MPangoContext sPangoContext;
+		static thread_local MPangoContext sPangoContext;
 		return sPangoContext;
 	}
 
@@ -70,6 +78,187 @@ struct MPangoLanguage
 	PangoLanguage *mPangoLanguage;
 };
 
+// --------------------------------------------------------------------
+// MPangoLayoutCache keeps shaped layouts for the simple strings drawn
+// with DrawString and measured with GetStringWidth. Each font has its
+// own LRU list, the cache is shared by all devices on a thread.
+
+class MPangoLayoutCache
+{
+  public:
+	static constexpr size_t kMaxEntriesPerFont = 1024;
+
+	struct MEntry
+	{
+		std::string mText;
+		uint32_t mWidth;
+		bool mEllipsize;
+		MAlignment mAlign;
+
+		PangoLayout *mLayout;
+		int32_t mTextWidth; // in pixels
+		float mAdvance;     // in pixels, not rounded
+		int32_t mXOffset;   // for the alignment
+	};
+
+	static MPangoLayoutCache &Instance()
+	{
+		static thread_local MPangoLayoutCache sInstance;
+		return sInstance;
+	}
+
+	~MPangoLayoutCache()
+	{
+		for (auto &fc : mFonts)
+		{
+			for (auto &e : fc.mLRU)
+				g_object_unref(e.mLayout);
+			if (fc.mFont != nullptr)
+				pango_font_description_free(fc.mFont);
+		}
+	}
+
+	// Return the layout for inText in font inFont. If inWidth is not zero it
+	// is the layout width, the text is ellipsized if inEllipsize is true.
+	const MEntry &Get(const PangoFontDescription *inFont, std::string_view inText,
+		uint32_t inWidth, bool inEllipsize, MAlignment inAlign)
+	{
+		MFontCache &fc = GetFontCache(inFont);
+
+		MKey key{ inText, inWidth, inEllipsize, inAlign };
+
+		auto i = fc.mIndex.find(key);
+		if (i != fc.mIndex.end())
+		{
+			++mStatistics.mHits;
+			fc.mLRU.splice(fc.mLRU.begin(), fc.mLRU, i->second);
+			return *i->second;
+		}
+
+		++mStatistics.mMisses;
+
+		if (fc.mLRU.size() >= kMaxEntriesPerFont)
+		{
+			++mStatistics.mEvictions;
+
+			auto &last = fc.mLRU.back();
+			fc.mIndex.erase(MKey{ last.mText, last.mWidth, last.mEllipsize, last.mAlign });
+			g_object_unref(last.mLayout);
+			fc.mLRU.pop_back();
+		}
+
+		PangoLayout *layout = pango_layout_new(MPangoContext::instance().mPangoContext);
+		if (inFont != nullptr)
+			pango_layout_set_font_description(layout, inFont);
+		pango_layout_set_text(layout, inText.data(), inText.length());
+
+		if (inWidth != 0)
+			pango_layout_set_width(layout, inWidth * PANGO_SCALE);
+		pango_layout_set_ellipsize(layout, inEllipsize ? PANGO_ELLIPSIZE_END : PANGO_ELLIPSIZE_NONE);
+
+		PangoRectangle r;
+		pango_layout_get_extents(layout, nullptr, &r);
+
+		float advance = float(r.width) / PANGO_SCALE;
+		pango_extents_to_pixels(&r, nullptr);
+
+		int32_t xOffset = 0;
+		if (inEllipsize and static_cast<uint32_t>(r.width) < inWidth)
+		{
+			if (inAlign == eAlignCenter)
+				xOffset = (inWidth - r.width) / 2;
+			else if (inAlign == eAlignRight)
+				xOffset = inWidth - r.width;
+		}
+
+		fc.mLRU.push_front({ std::string{ inText }, inWidth, inEllipsize, inAlign, layout, r.width, advance, xOffset });
+
+		auto &e = fc.mLRU.front();
+		fc.mIndex.emplace(MKey{ e.mText, e.mWidth, e.mEllipsize, e.mAlign }, fc.mLRU.begin());
+
+		return e;
+	}
+
+	// Return the cached layout as Get would, or null if there is none.
+	// Does not add an entry, nor move one to the front.
+	const MEntry *Find(const PangoFontDescription *inFont, std::string_view inText, uint32_t inWidth)
+	{
+		MFontCache &fc = GetFontCache(inFont);
+
+		auto i = fc.mIndex.find(MKey{ inText, inWidth, false, eAlignNone });
+		if (i == fc.mIndex.end())
+			return nullptr;
+
+		++mStatistics.mHits;
+		return &*i->second;
+	}
+
+	MTextLayoutCacheStatistics GetStatistics() const
+	{
+		MTextLayoutCacheStatistics result = mStatistics;
+		result.mEntries = 0;
+		for (auto &fc : mFonts)
+			result.mEntries += fc.mLRU.size();
+		return result;
+	}
+
+  private:
+	// the key refers to the text stored in the entry
+	struct MKey
+	{
+		std::string_view mText;
+		uint32_t mWidth;
+		bool mEllipsize;
+		MAlignment mAlign;
+
+		bool operator==(const MKey &inKey) const = default;
+	};
+
+	struct MKeyHash
+	{
+		size_t operator()(const MKey &inKey) const
+		{
+			size_t h = std::hash<std::string_view>{}(inKey.mText);
+			return h ^ (inKey.mWidth << 3) ^ (inKey.mEllipsize << 1) ^ inKey.mAlign;
+		}
+	};
+
+	typedef std::list<MEntry> MEntryList;
+
+	struct MFontCache
+	{
+		PangoFontDescription *mFont;
+		MEntryList mLRU;
+		std::unordered_map<MKey, MEntryList::iterator, MKeyHash> mIndex;
+	};
+
+	MFontCache &GetFontCache(const PangoFontDescription *inFont)
+	{
+		auto i = std::find_if(mFonts.begin(), mFonts.end(), [inFont](const MFontCache &fc)
+			{ return fc.mFont == inFont or
+					 (fc.mFont != nullptr and inFont != nullptr and pango_font_description_equal(fc.mFont, inFont)); });
+
+		if (i == mFonts.end())
+		{
+			mFonts.emplace_back();
+			i = std::prev(mFonts.end());
+			i->mFont = inFont ? pango_font_description_copy(inFont) : nullptr;
+		}
+
+		return *i;
+	}
+
+	std::list<MFontCache> mFonts;
+	MTextLayoutCacheStatistics mStatistics;
+};
+
+MTextLayoutCacheStatistics MDevice::GetTextLayoutCacheStatistics()
+{
+	return MPangoLayoutCache::Instance().GetStatistics();
+}
+
+// --------------------------------------------------------------------
+
 MGtkDeviceImpl::MGtkDeviceImpl()
 	: MGtkDeviceImpl(pango_layout_new(MPangoContext::instance().mPangoContext))
 
@@ -78,22 +267,32 @@ MGtkDeviceImpl::MGtkDeviceImpl()
 
 MGtkDeviceImpl::MGtkDeviceImpl(PangoLayout *inLayout)
 	: mPangoLayout(inLayout)
+	, mOwnLayout(nullptr)
+	, mAttributes(pango_attr_list_new())
+	, mFontImpl(nullptr)
 	, mFont(nullptr)
 	, mMetrics(nullptr)
+	, mTextEndsWithNewLine(false)
+	, mTabWidth(0)
 {
 	mPangoScale = PANGO_SCALE;
+
+	if (mPangoLayout != nullptr)
+		pango_layout_set_attributes(mPangoLayout, mAttributes);
 }
 
 MGtkDeviceImpl::~MGtkDeviceImpl()
 {
-	if (mMetrics != nullptr)
+	if (mMetrics != nullptr and mFontImpl == nullptr)
 		pango_font_metrics_unref(mMetrics);
 
-	if (mFont != nullptr)
-		pango_font_description_free(mFont);
-
 	if (mPangoLayout != nullptr)
 		g_object_unref(mPangoLayout);
+
+	if (mOwnLayout != nullptr)
+		g_object_unref(mOwnLayout);
+
+	pango_attr_list_unref(mAttributes);
 }
 
 void MGtkDeviceImpl::Save()
@@ -110,29 +309,29 @@ void MGtkDeviceImpl::SetOrigin(int32_t inX, int32_t inY)
 
 void MGtkDeviceImpl::SetFont(const std::string &inFont)
 {
-	PangoFontDescription *newFontDesc = pango_font_description_from_string(inFont.c_str());
+	SetFont(MFontImpl::Intern(inFont));
+}
 
-	if (mFont == nullptr or newFontDesc == nullptr or
-		not pango_font_description_equal(mFont, newFontDesc))
-	{
-		if (mMetrics != nullptr)
-			pango_font_metrics_unref(mMetrics);
+void MGtkDeviceImpl::SetFont(const MFontImpl *inFont)
+{
+	auto font = static_cast<const MGtkFontImpl *>(inFont);
 
-		if (mFont != nullptr)
-			pango_font_description_free(mFont);
+	if (font == nullptr or font == mFontImpl or font->mDescription == nullptr)
+		return;
 
-		mFont = newFontDesc;
+	UnshareLayout();
 
-		if (mFont != nullptr)
-		{
-			mMetrics = GetMetrics();
+	if (mMetrics != nullptr and mFontImpl == nullptr)
+		pango_font_metrics_unref(mMetrics);
 
-			pango_layout_set_font_description(mPangoLayout, mFont);
-			GetWhiteSpaceGlyphs(mSpaceGlyph, mTabGlyph, mNewLineGlyph);
-		}
-	}
-	else
-		pango_font_description_free(newFontDesc);
+	mFontImpl = font;
+	mFont = font->mDescription;
+	mMetrics = font->mMetrics;
+	mSpaceGlyph = font->mSpaceGlyph;
+	mTabGlyph = font->mTabGlyph;
+	mNewLineGlyph = font->mNewLineGlyph;
+
+	pango_layout_set_font_description(mPangoLayout, mFont);
 }
 
 void MGtkDeviceImpl::SetForeColor(MColor inColor)
@@ -157,10 +356,9 @@ void MGtkDeviceImpl::ClipRect(MRect inRect)
 {
 }
 
-// void MGtkDeviceImpl::ClipRegion(
-//	MRegion				inRegion)
-//{
-// }
+void MGtkDeviceImpl::ClipRegion(const MRegion &inRegion)
+{
+}
 
 void MGtkDeviceImpl::EraseRect(MRect inRect)
 {
@@ -182,7 +380,7 @@ void MGtkDeviceImpl::DrawImage(cairo_surface_t *inImage, float inX, float inY, f
 {
 }
 
-void MGtkDeviceImpl::CreateAndUsePattern(MColor inColor1, MColor inColor2)
+void MGtkDeviceImpl::CreateAndUsePattern(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation)
 {
 }
 
@@ -248,25 +446,267 @@ void MGtkDeviceImpl::DrawString(const std::string &inText, float inX, float inY,
 
 uint32_t MGtkDeviceImpl::GetStringWidth(const std::string &inText)
 {
-	// reset attributes first
+	return MPangoLayoutCache::Instance().Get(mFont, inText, 0, false, eAlignNone).mTextWidth;
+}
+
+float MGtkDeviceImpl::GetStringAdvance(std::string_view inText)
+{
+	return MPangoLayoutCache::Instance().Get(mFont, inText, 0, false, eAlignNone).mAdvance;
+}
+
+void MGtkDeviceImpl::GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns)
+{
+	ShapeStrings(inStrings, 0, outRuns, nullptr);
+}
+
+namespace
+{
+
+// A single line of text shaped without a PangoLayout, the items are
+// in visual order.
+
+struct MShapedLine
+{
+	MShapedLine() = default;
+	MShapedLine(const MShapedLine &) = delete;
+	MShapedLine &operator=(const MShapedLine &) = delete;
+
+	~MShapedLine()
+	{
+		for (auto &[item, glyphs] : mItems)
+		{
+			pango_item_free(item);
+			pango_glyph_string_free(glyphs);
+		}
+	}
+
+	std::vector<std::pair<PangoItem *, PangoGlyphString *>> mItems;
+	int32_t mWidth = 0;    // in pango units
+	int32_t mBaseLine = 0; // in pango units
+};
+
+// Shape inText the way a PangoLayout would if it fits on one line.
+// Returns false if a layout is needed after all: for line breaks, text
+// that is wider than inWidth or text that is not left to right, since
+// a layout aligns that to the right of its width.
+bool ShapeLine(PangoContext *inContext, PangoAttrList *inAttrs, std::string_view inText,
+	uint32_t inWidth, MShapedLine &outLine)
+{
+	if (inText.find_first_of("\n\r") != std::string_view::npos or
+		inText.find("\xe2\x80\xa8") != std::string_view::npos or
+		inText.find("\xe2\x80\xa9") != std::string_view::npos)
+	{
+		return false;
+	}
+
+	GList *items = pango_itemize(inContext, inText.data(), 0, inText.length(), inAttrs, nullptr);
+
+	bool result = true;
+
+	for (GList *i = items; i != nullptr; i = i->next)
+	{
+		PangoItem *item = static_cast<PangoItem *>(i->data);
+
+		// hand the item over to outLine, which frees it
+		outLine.mItems.emplace_back(item, pango_glyph_string_new());
+
+		if (item->analysis.level % 2 == 1)
+			result = false;
+
+		if (not result)
+			continue;
+
+		PangoGlyphString *gs = outLine.mItems.back().second;
+
+		pango_shape_with_flags(inText.data() + item->offset, item->length, inText.data(), inText.length(),
+			&item->analysis, gs,
+			pango_context_get_round_glyph_positions(inContext) ? PANGO_SHAPE_ROUND_POSITIONS : PANGO_SHAPE_NONE);
+
+		PangoRectangle logical;
+		pango_glyph_string_extents(gs, item->analysis.font, nullptr, &logical);
+
+		outLine.mWidth += logical.width;
+		outLine.mBaseLine = std::max(outLine.mBaseLine, -logical.y);
+	}
+
+	g_list_free(items);
+
+	if (inWidth != 0 and outLine.mWidth > static_cast<int32_t>(inWidth * PANGO_SCALE))
+		result = false;
+
+	return result;
+}
+
+} // namespace
+
+void MGtkDeviceImpl::ShapeStrings(std::span<const MStringItem> inStrings, uint32_t inWidth,
+	std::vector<MGlyphRun> &outRuns, std::vector<size_t> *outMissing)
+{
+	auto &cache = MPangoLayoutCache::Instance();
+
+	// Strings that are not in the layout cache are shaped without a
+	// layout and are not added to it. A batch can easily contain more
+	// distinct strings than the cache holds, each one would then cost
+	// a new layout and evict one DrawString still needs.
+	PangoContext *context = MPangoContext::instance().mPangoContext;
 	PangoAttrList *attrs = pango_attr_list_new();
-	pango_layout_set_attributes(mPangoLayout, attrs);
+	if (mFont != nullptr)
+		pango_attr_list_insert(attrs, pango_attr_font_desc_new(mFont));
+
+	MColor color = GetForeColor();
+
+	// glyphs are added to the run for their font, runs that were
+	// already in outRuns are left alone.
+	size_t first = outRuns.size(), run = first;
+	const MGtkFontImpl *runFont = nullptr;
+
+	// Add the glyphs in inGlyphs starting at inX on inBaseLine, both in
+	// pango units relative to the string. Returns false if one of them
+	// is missing from the font.
+	auto addGlyphs = [&](const MStringItem &inString, PangoFont *inFont, PangoGlyphString *inGlyphs,
+						 int inX, int inBaseLine)
+	{
+		auto font = MGtkFontImpl::Intern(inFont);
+		if (font != runFont)
+		{
+			runFont = font;
+
+			for (run = first; run < outRuns.size(); ++run)
+			{
+				if (outRuns[run].mFont.GetImpl() == font)
+					break;
+			}
+
+			if (run == outRuns.size())
+				outRuns.emplace_back(MGlyphRun{ MFont(font), color, {} });
+		}
+
+		auto &glyphs = outRuns[run].mGlyphs;
+
+		int x = inX;
+		for (int i = 0; i < inGlyphs->num_glyphs; ++i)
+		{
+			PangoGlyphInfo &gi = inGlyphs->glyphs[i];
+
+			if (gi.glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+				return false;
+
+			if (gi.glyph != PANGO_GLYPH_EMPTY)
+			{
+				glyphs.push_back({ gi.glyph,
+					inString.mX + float(x + gi.geometry.x_offset) / PANGO_SCALE,
+					inString.mY + float(inBaseLine + gi.geometry.y_offset) / PANGO_SCALE });
+			}
+
+			x += gi.geometry.width;
+		}
+
+		return true;
+	};
+
+	// the number of glyphs in each run before the current string
+	static thread_local std::vector<size_t> sRunSizes;
+
+	for (size_t si = 0; si < inStrings.size(); ++si)
+	{
+		auto &s = inStrings[si];
+
+		if (s.mText.empty())
+			continue;
+
+		sRunSizes.clear();
+		for (size_t r = first; r < outRuns.size(); ++r)
+			sRunSizes.push_back(outRuns[r].mGlyphs.size());
+		size_t runCount = outRuns.size();
+
+		bool missing = false;
+
+		MShapedLine line;
+		const MPangoLayoutCache::MEntry *e = cache.Find(mFont, s.mText, inWidth);
+
+		if (e == nullptr and ShapeLine(context, attrs, s.mText, inWidth, line))
+		{
+			int x = 0;
+			for (auto &[item, gs] : line.mItems)
+			{
+				if (not addGlyphs(s, item->analysis.font, gs, x, line.mBaseLine))
+				{
+					missing = true;
+					break;
+				}
+
+				x += pango_glyph_string_get_width(gs);
+			}
+		}
+		else
+		{
+			if (e == nullptr)
+				e = &cache.Get(mFont, s.mText, inWidth, false, eAlignNone);
+
+			PangoLayoutIter *iter = pango_layout_get_iter(e->mLayout);
+
+			do
+			{
+				PangoGlyphItem *glyphItem = pango_layout_iter_get_run_readonly(iter);
+				if (glyphItem == nullptr) // end of a line
+					continue;
+
+				PangoRectangle logical;
+				pango_layout_iter_get_run_extents(iter, nullptr, &logical);
+
+				missing = not addGlyphs(s, glyphItem->item->analysis.font, glyphItem->glyphs,
+					logical.x, pango_layout_iter_get_baseline(iter));
+			} while (not missing and pango_layout_iter_next_run(iter));
+
+			pango_layout_iter_free(iter);
+		}
+
+		if (missing)
+		{
+			// take back what was added for this string
+			outRuns.erase(outRuns.begin() + runCount, outRuns.end());
+			for (size_t r = first; r < runCount; ++r)
+				outRuns[r].mGlyphs.resize(sRunSizes[r - first]);
+			runFont = nullptr;
+
+			if (outMissing != nullptr)
+				outMissing->push_back(si);
+		}
+	}
+
 	pango_attr_list_unref(attrs);
+}
 
-	pango_layout_set_text(mPangoLayout, inText.c_str(), inText.length());
+namespace
+{
 
-	PangoRectangle r;
-	pango_layout_get_pixel_extents(mPangoLayout, nullptr, &r);
+void ClearAttributes(PangoAttrList *inAttributes)
+{
+	PangoAttrList *removed = pango_attr_list_filter(inAttributes,
+		[](PangoAttribute *, gpointer) -> gboolean
+		{ return true; },
+		nullptr);
 
-	return r.width;
+	if (removed != nullptr)
+		pango_attr_list_unref(removed);
 }
 
+} // namespace
+
 void MGtkDeviceImpl::SetText(const std::string &inText)
 {
-	// reset attributes first
-	PangoAttrList *attrs = pango_attr_list_new();
-	pango_layout_set_attributes(mPangoLayout, attrs);
-	pango_attr_list_unref(attrs);
+	// the text replaces a shared layout, no need to copy it
+	if (mOwnLayout != nullptr)
+	{
+		g_object_unref(mPangoLayout);
+		mPangoLayout = mOwnLayout;
+		mOwnLayout = nullptr;
+	}
+
+	// reset attributes first, the list is reused
+	ClearAttributes(mAttributes);
+	if (pango_layout_get_attributes(mPangoLayout) != mAttributes)
+		pango_layout_set_attributes(mPangoLayout, mAttributes);
 
 	pango_layout_set_text(mPangoLayout, inText.c_str(), inText.length());
 	mTextEndsWithNewLine = inText.length() > 0 and inText[inText.length() - 1] == '\n';
@@ -274,6 +714,12 @@ void MGtkDeviceImpl::SetText(const std::string &inText)
 
 void MGtkDeviceImpl::SetTabStops(float inTabWidth)
 {
+	if (mOwnLayout != nullptr and inTabWidth == mTabWidth)
+		return;
+
+	UnshareLayout();
+	mTabWidth = inTabWidth;
+
 	PangoTabArray *tabs = pango_tab_array_new(2, false);
 
 	uint32_t next = inTabWidth;
@@ -291,6 +737,8 @@ void MGtkDeviceImpl::SetTabStops(float inTabWidth)
 
 void MGtkDeviceImpl::SetTextColors(uint32_t inColorCount, uint32_t inColorIndices[], uint32_t inOffsets[], MColor inColors[])
 {
+	UnshareLayout();
+
 	PangoAttrList *attrs = pango_layout_get_attributes(mPangoLayout);
 
 	for (uint32_t ix = 0; ix < inColorCount; ++ix)
@@ -317,6 +765,8 @@ void MGtkDeviceImpl::SetTextColors(uint32_t inColorCount, uint32_t inColorIndice
 
 void MGtkDeviceImpl::RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor)
 {
+	UnshareLayout();
+
 	PangoAttrList *attrs = pango_layout_get_attributes(mPangoLayout);
 
 	uint16_t red = inColor.red << 8 | inColor.red;
@@ -332,6 +782,8 @@ void MGtkDeviceImpl::RenderTextBackground(float inX, float inY, uint32_t inStart
 
 void MGtkDeviceImpl::SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t inOffsets[])
 {
+	UnshareLayout();
+
 	PangoAttrList *attrs = pango_layout_get_attributes(mPangoLayout);
 
 	for (uint32_t ix = 0; ix < inStyleCount; ++ix)
@@ -361,8 +813,72 @@ void MGtkDeviceImpl::SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], u
 	}
 }
 
+// Build the attribute list in one pass. Attributes are inserted in
+// order so each insert is an append, runs that look the same are merged
+// and attributes equal to the font's own weight and style are left out.
+void MGtkDeviceImpl::SetTextRuns(std::span<const MTextRun> inRuns)
+{
+	UnshareLayout();
+	ClearAttributes(mAttributes);
+
+	PangoWeight fontWeight = PANGO_WEIGHT_NORMAL;
+	PangoStyle fontStyle = PANGO_STYLE_NORMAL;
+
+	if (mFont != nullptr)
+	{
+		fontWeight = pango_font_description_get_weight(mFont);
+		fontStyle = pango_font_description_get_style(mFont);
+	}
+
+	for (size_t ix = 0; ix < inRuns.size();)
+	{
+		const MTextRun &run = inRuns[ix];
+
+		size_t next = ix + 1;
+		while (next < inRuns.size() and inRuns[next].mColor == run.mColor and inRuns[next].mStyle == run.mStyle)
+			++next;
+
+		uint32_t start_index = run.mOffset;
+		uint32_t end_index = next == inRuns.size() ? G_MAXUINT : inRuns[next].mOffset;
+		assert(end_index >= start_index);
+
+		auto insert = [this, start_index, end_index](PangoAttribute *attr)
+		{
+			attr->start_index = start_index;
+			attr->end_index = end_index;
+			pango_attr_list_insert(mAttributes, attr);
+		};
+
+		if (end_index > start_index)
+		{
+			MColor c = run.mColor;
+			insert(pango_attr_foreground_new(c.red << 8 | c.red, c.green << 8 | c.green, c.blue << 8 | c.blue));
+
+			PangoWeight weight = run.mStyle & MDevice::eTextStyleBold ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL;
+			if (weight != fontWeight)
+				insert(pango_attr_weight_new(weight));
+
+			PangoStyle style = run.mStyle & MDevice::eTextStyleItalic ? PANGO_STYLE_ITALIC : PANGO_STYLE_NORMAL;
+			if (style != fontStyle)
+				insert(pango_attr_style_new(style));
+
+			if (run.mStyle & MDevice::eTextStyleDoubleUnderline)
+				insert(pango_attr_underline_new(PANGO_UNDERLINE_DOUBLE));
+			else if (run.mStyle & MDevice::eTextStyleUnderline)
+				insert(pango_attr_underline_new(PANGO_UNDERLINE_SINGLE));
+		}
+
+		ix = next;
+	}
+
+	// the list was changed in place, the layout has to know
+	pango_layout_context_changed(mPangoLayout);
+}
+
 void MGtkDeviceImpl::SetTextSelection(uint32_t inStart, uint32_t inLength, MColor inSelectionColor)
 {
+	UnshareLayout();
+
 	uint16_t red = inSelectionColor.red << 8 | inSelectionColor.red;
 	uint16_t green = inSelectionColor.green << 8 | inSelectionColor.green;
 	uint16_t blue = inSelectionColor.blue << 8 | inSelectionColor.blue;
@@ -375,32 +891,210 @@ void MGtkDeviceImpl::SetTextSelection(uint32_t inStart, uint32_t inLength, MColo
 	pango_attr_list_change(attrs, attr);
 }
 
+// --------------------------------------------------------------------
+// The x offset of each cluster in a single line layout, kept with the
+// layout itself so that hit testing is a binary search in both
+// directions. The layout's serial tells whether it changed since the
+// offsets were computed. Layouts with more than one line or with right
+// to left runs are left to pango.
+
+namespace
+{
+
+const char kClusterOffsetsKey[] = "mgui-cluster-offsets";
+
+struct MClusterOffsets
+{
+	struct MCluster
+	{
+		uint32_t mStart, mEnd; // byte offsets in the text
+		int32_t mX, mWidth;    // in pango units
+	};
+
+	guint mSerial;
+	bool mValid = true;
+	std::vector<MCluster> mClusters;
+
+	static const MClusterOffsets *Get(PangoLayout *inLayout);
+
+	// the number of characters in inText from inStart up to inEnd
+	static uint32_t CountChars(const char *inText, uint32_t inStart, uint32_t inEnd)
+	{
+		uint32_t result = 0;
+		for (uint32_t i = inStart; i < inEnd; ++i)
+		{
+			if ((inText[i] & 0x0C0) != 0x080)
+				++result;
+		}
+		return result;
+	}
+};
+
+const MClusterOffsets *MClusterOffsets::Get(PangoLayout *inLayout)
+{
+	guint serial = pango_layout_get_serial(inLayout);
+
+	auto result = static_cast<MClusterOffsets *>(g_object_get_data(G_OBJECT(inLayout), kClusterOffsetsKey));
+
+	if (result == nullptr or result->mSerial != serial)
+	{
+		result = new MClusterOffsets{ serial };
+		g_object_set_data_full(G_OBJECT(inLayout), kClusterOffsetsKey, result,
+			[](gpointer inData)
+			{ delete static_cast<MClusterOffsets *>(inData); });
+
+		result->mValid = pango_layout_get_line_count(inLayout) == 1;
+
+		if (result->mValid)
+		{
+			const char *text = pango_layout_get_text(inLayout);
+			PangoLayoutIter *iter = pango_layout_get_iter(inLayout);
+
+			do
+			{
+				PangoGlyphItem *run = pango_layout_iter_get_run_readonly(iter);
+				if (run == nullptr)
+					continue;
+
+				if (run->item->analysis.level % 2)
+				{
+					result->mValid = false;
+					break;
+				}
+
+				PangoRectangle logical;
+				pango_layout_iter_get_run_extents(iter, nullptr, &logical);
+
+				int32_t x = logical.x;
+
+				PangoGlyphItemIter gi;
+				for (bool more = pango_glyph_item_iter_init_start(&gi, run, text);
+					 more;
+					 more = pango_glyph_item_iter_next_cluster(&gi))
+				{
+					int32_t width = 0;
+					for (int i = gi.start_glyph; i < gi.end_glyph; ++i)
+						width += gi.glyph_item->glyphs->glyphs[i].geometry.width;
+
+					result->mClusters.push_back({ static_cast<uint32_t>(gi.start_index), static_cast<uint32_t>(gi.end_index), x, width });
+					x += width;
+				}
+			} while (pango_layout_iter_next_run(iter));
+
+			pango_layout_iter_free(iter);
+		}
+
+		if (not result->mValid)
+			result->mClusters.clear();
+	}
+
+	return result->mValid ? result : nullptr;
+}
+
+} // namespace
+
 void MGtkDeviceImpl::IndexToPosition(uint32_t inIndex, bool inTrailing, int32_t &outPosition)
 {
-	PangoRectangle r;
-	pango_layout_index_to_pos(mPangoLayout, inIndex, &r);
-	outPosition = r.x / mPangoScale;
+	auto offsets = MClusterOffsets::Get(mPangoLayout);
+
+	if (offsets == nullptr)
+	{
+		PangoRectangle r;
+		pango_layout_index_to_pos(mPangoLayout, inIndex, &r);
+		outPosition = r.x / mPangoScale;
+		return;
+	}
+
+	auto &clusters = offsets->mClusters;
+
+	int32_t x = 0;
+
+	auto c = std::upper_bound(clusters.begin(), clusters.end(), inIndex,
+		[](uint32_t index, const MClusterOffsets::MCluster &cluster)
+		{ return index < cluster.mStart; });
+
+	if (c != clusters.begin())
+	{
+		--c;
+
+		if (inIndex >= c->mEnd)
+			x = c->mX + c->mWidth;
+		else
+		{
+			// within a cluster, like pango divide the width over the characters
+			const char *text = pango_layout_get_text(mPangoLayout);
+			uint32_t n = MClusterOffsets::CountChars(text, c->mStart, c->mEnd);
+			x = c->mX + c->mWidth * static_cast<int32_t>(MClusterOffsets::CountChars(text, c->mStart, inIndex)) / static_cast<int32_t>(n);
+		}
+	}
+	else if (not clusters.empty())
+		x = clusters.front().mX;
+
+	outPosition = x / mPangoScale;
 }
 
 bool MGtkDeviceImpl::PositionToIndex(int32_t inPosition, uint32_t &outIndex)
 {
-	int index, trailing;
+	auto offsets = MClusterOffsets::Get(mPangoLayout);
+
+	if (offsets == nullptr)
+	{
+		int index, trailing;
+
+		bool result = pango_layout_xy_to_index(mPangoLayout, inPosition * mPangoScale, 0, &index, &trailing);
+
+		MEncodingTraits<kEncodingUTF8> enc;
+		const char *text = pango_layout_get_text(mPangoLayout);
+
+		while (trailing-- > 0)
+		{
+			uint32_t n = enc.GetNextCharLength(text);
+			text += n;
+			index += n;
+		}
 
-	bool result = pango_layout_xy_to_index(mPangoLayout, inPosition * mPangoScale, 0, &index, &trailing);
+		outIndex = index;
 
-	MEncodingTraits<kEncodingUTF8> enc;
+		return result;
+	}
+
+	auto &clusters = offsets->mClusters;
+	int32_t x = inPosition * mPangoScale;
+
+	if (clusters.empty() or x < clusters.front().mX)
+	{
+		outIndex = clusters.empty() ? 0 : clusters.front().mStart;
+		return false;
+	}
+
+	auto c = std::upper_bound(clusters.begin(), clusters.end(), x,
+		[](int32_t x, const MClusterOffsets::MCluster &cluster)
+		{ return x < cluster.mX; });
+	--c;
+
+	if (x >= c->mX + c->mWidth)
+	{
+		outIndex = clusters.back().mEnd;
+		return false;
+	}
+
+	// find the character within the cluster, and the nearest edge of it
 	const char *text = pango_layout_get_text(mPangoLayout);
+	uint32_t n = MClusterOffsets::CountChars(text, c->mStart, c->mEnd);
+	uint32_t ch = static_cast<uint32_t>(int64_t(x - c->mX) * n * 2 / std::max(c->mWidth, 1));
+	uint32_t skip = std::min((ch + 1) / 2, n);
 
-	while (trailing-- > 0)
+	uint32_t index = c->mStart;
+	while (skip-- > 0)
 	{
-		uint32_t n = enc.GetNextCharLength(text);
-		text += n;
-		index += n;
+		do
+			++index;
+		while (index < c->mEnd and (text[index] & 0x0C0) == 0x080);
 	}
 
 	outIndex = index;
 
-	return result;
+	return true;
 }
 
 float MGtkDeviceImpl::GetTextWidth()
@@ -422,6 +1116,8 @@ void MGtkDeviceImpl::DrawCaret(float inX, float inY, uint32_t inOffset)
 
 void MGtkDeviceImpl::BreakLines(uint32_t inWidth, std::vector<uint32_t> &outBreaks)
 {
+	UnshareLayout();
+
 	pango_layout_set_width(mPangoLayout, inWidth * mPangoScale);
 	pango_layout_set_wrap(mPangoLayout, PANGO_WRAP_WORD_CHAR);
 
@@ -441,51 +1137,345 @@ void MGtkDeviceImpl::BreakLines(uint32_t inWidth, std::vector<uint32_t> &outBrea
 	}
 }
 
-PangoItem *MGtkDeviceImpl::Itemize(const char *inText, PangoAttrList *inAttrs)
+// --------------------------------------------------------------------
+// A shaped line kept by MLineLayoutCache, the layout is shared with the
+// device that created it and is never changed after that.
+
+struct MGtkTextLayoutImpl : public MTextLayoutImpl
 {
-	PangoContext *context = pango_layout_get_context(mPangoLayout);
-	GList *items = pango_itemize(context, inText, 0, strlen(inText), inAttrs, nullptr);
-	PangoItem *item = static_cast<PangoItem *>(items->data);
-	g_list_free(items);
-	return item;
+	MGtkTextLayoutImpl(PangoLayout *inLayout, const MGtkFontImpl *inFont, float inTabWidth, bool inEndsWithNewLine)
+		: mLayout(inLayout)
+		, mFont(inFont)
+		, mTabWidth(inTabWidth)
+		, mEndsWithNewLine(inEndsWithNewLine)
+	{
+		PangoRectangle r;
+		pango_layout_get_pixel_extents(mLayout, nullptr, &r);
+
+		mWidth = r.width;
+		mHeight = r.height;
+	}
+
+	~MGtkTextLayoutImpl()
+	{
+		g_object_unref(mLayout);
+	}
+
+	PangoLayout *mLayout;
+	const MGtkFontImpl *mFont;
+	float mTabWidth;
+	bool mEndsWithNewLine;
+};
+
+// Hand the current layout to the cache. The device continues with a new
+// layout that has the same settings and an attribute list of its own.
+MTextLayoutImpl *MGtkDeviceImpl::SaveTextLayout()
+{
+	if (mOwnLayout != nullptr)
+		return nullptr;
+
+	auto result = new MGtkTextLayoutImpl(mPangoLayout, mFontImpl, mTabWidth, mTextEndsWithNewLine);
+
+	mOwnLayout = pango_layout_copy(mPangoLayout);
+	g_object_ref(mPangoLayout);
+
+	pango_attr_list_unref(mAttributes);
+	mAttributes = pango_attr_list_new();
+	pango_layout_set_attributes(mOwnLayout, mAttributes);
+	pango_layout_set_text(mOwnLayout, "", 0);
+
+	return result;
+}
+
+bool MGtkDeviceImpl::UseTextLayout(MTextLayoutImpl *inLayout)
+{
+	auto layout = static_cast<MGtkTextLayoutImpl *>(inLayout);
+
+	if (layout->mFont != mFontImpl or layout->mTabWidth != mTabWidth)
+		return false;
+
+	if (mOwnLayout == nullptr)
+		mOwnLayout = mPangoLayout;
+	else
+		g_object_unref(mPangoLayout);
+
+	mPangoLayout = static_cast<PangoLayout *>(g_object_ref(layout->mLayout));
+	mTextEndsWithNewLine = layout->mEndsWithNewLine;
+
+	return true;
+}
+
+// Copy the text and attributes of the shared layout to our own, it
+// will be shaped again when it is used.
+void MGtkDeviceImpl::UnshareLayout()
+{
+	if (mOwnLayout == nullptr)
+		return;
+
+	PangoLayout *shared = mPangoLayout;
+
+	mPangoLayout = mOwnLayout;
+	mOwnLayout = nullptr;
+
+	ClearAttributes(mAttributes);
+	pango_attr_list_splice(mAttributes, pango_layout_get_attributes(shared), 0, 0);
+	pango_layout_set_text(mPangoLayout, pango_layout_get_text(shared), -1);
+
+	g_object_unref(shared);
+}
+
+namespace
+{
+
+uint32_t GetGlyph(PangoContext *inContext, const char *inText, PangoAttrList *inAttrs)
+{
+	uint32_t result = 0;
+
+	GList *items = pango_itemize(inContext, inText, 0, strlen(inText), inAttrs, nullptr);
+	if (items != nullptr)
+	{
+		PangoItem *item = static_cast<PangoItem *>(items->data);
+		assert(item->analysis.font);
+
+		PangoGlyphString *gs = pango_glyph_string_new();
+		pango_shape(inText, strlen(inText), &item->analysis, gs);
+		if (gs->num_glyphs > 0)
+			result = gs->glyphs[0].glyph;
+		pango_glyph_string_free(gs);
+
+		g_list_free_full(items, reinterpret_cast<GDestroyNotify>(&pango_item_free));
+	}
+
+	return result;
+}
+
+} // namespace
+
+MGtkFontImpl::MGtkFontImpl(const std::string &inName)
+	: MFontImpl(inName)
+	, mDescription(pango_font_description_from_string(inName.c_str()))
+	, mMetrics(nullptr)
+	, mFont(nullptr)
+	, mScaledFont(nullptr)
+	, mSpaceGlyph(0)
+	, mTabGlyph(0)
+	, mNewLineGlyph(0)
+{
+	PangoContext *context = MPangoContext::instance().mPangoContext;
+
+	mMetrics = pango_context_get_metrics(context, mDescription, nullptr);
+
+	mFont = pango_font_map_load_font(pango_cairo_font_map_get_default(), context, mDescription);
+	if (mFont != nullptr)
+	{
+		mScaledFont = pango_cairo_font_get_scaled_font(reinterpret_cast<PangoCairoFont *>(mFont));
+		if (mScaledFont != nullptr and cairo_scaled_font_status(mScaledFont) != CAIRO_STATUS_SUCCESS)
+			mScaledFont = nullptr;
+	}
+
+	//	long kMiddleDot = 0x00B7, kRightChevron = 0x00BB, kNotSign = 0x00AC;
+
+	const char
+		not_sign[] = "\xc2\xac",      // 0x00AC
+		right_chevron[] = "\xc2\xbb", // 0x00BB
+		middle_dot[] = "\xc2\xb7";    // 0x00B7
+
+	PangoAttrList *attrs = pango_attr_list_new();
+
+	PangoAttribute *attr = pango_attr_font_desc_new(mDescription);
+	attr->start_index = 0;
+	attr->end_index = 2;
+
+	pango_attr_list_insert(attrs, attr);
+
+	mSpaceGlyph = GetGlyph(context, middle_dot, attrs);
+	mTabGlyph = GetGlyph(context, right_chevron, attrs);
+	mNewLineGlyph = GetGlyph(context, not_sign, attrs);
+
+	pango_attr_list_unref(attrs);
+}
+
+MGtkFontImpl::~MGtkFontImpl()
+{
+	if (mFont != nullptr)
+		g_object_unref(mFont);
+
+	if (mMetrics != nullptr)
+		pango_font_metrics_unref(mMetrics);
+
+	if (mDescription != nullptr)
+		pango_font_description_free(mDescription);
+}
+
+// Fonts are interned for the lifetime of the application, the
+// number of distinct font descriptions used is small.
+
+const MFontImpl *MFontImpl::Intern(const std::string &inFont)
+{
+	static std::mutex sMutex;
+	static std::unordered_map<std::string, std::unique_ptr<MGtkFontImpl>> sFonts;
+
+	std::unique_lock lock(sMutex);
+
+	auto &font = sFonts[inFont];
+	if (not font)
+		font.reset(new MGtkFontImpl(inFont));
+
+	return font.get();
+}
+
+const MGtkFontImpl *MGtkFontImpl::Intern(PangoFont *inFont)
+{
+	// Pango hands out the same PangoFont for the same font, so keep a
+	// per thread index to avoid describing the font each time. The
+	// reference we keep makes sure the pointer is not reused.
+
+	struct MFontIndex
+	{
+		~MFontIndex()
+		{
+			for (auto &[font, impl] : mIndex)
+				g_object_unref(font);
+		}
+
+		std::unordered_map<PangoFont *, const MGtkFontImpl *> mIndex;
+	};
+
+	static thread_local MFontIndex sIndex;
+
+	auto i = sIndex.mIndex.find(inFont);
+	if (i == sIndex.mIndex.end())
+	{
+		PangoFontDescription *desc = pango_font_describe(inFont);
+		char *name = pango_font_description_to_string(desc);
+
+		auto impl = static_cast<const MGtkFontImpl *>(MFontImpl::Intern(name));
+
+		g_free(name);
+		pango_font_description_free(desc);
+
+		i = sIndex.mIndex.emplace(static_cast<PangoFont *>(g_object_ref(inFont)), impl).first;
+	}
+
+	return i->second;
 }
 
-void MGtkDeviceImpl::GetWhiteSpaceGlyphs(uint32_t &outSpace, uint32_t &outTab, uint32_t &outNL)
-{
-	//	long kMiddleDot = 0x00B7, kRightChevron = 0x00BB, kNotSign = 0x00AC;
+// --------------------------------------------------------------------
+// MCairoGeometryImpl records the path data in the format used by
+// cairo_path_t so it can be appended to a cairo context without any
+// further processing. Recording does not need a cairo context, so a
+// geometry can outlive the device it was created for.
+
+class MCairoGeometryImpl : public MGeometryImpl
+{
+  public:
+	MCairoGeometryImpl(MGeometryFillMode inMode)
+		: mFillRule(inMode == eGeometryFillModeWinding ? CAIRO_FILL_RULE_WINDING : CAIRO_FILL_RULE_EVEN_ODD)
+	{
+	}
+
+	void Begin(float inX, float inY, MGeometryBegin inBegin) override
+	{
+		mFigures.push_back({ mData.size(), inBegin == eGeometryBeginFilled });
+		if (inBegin != eGeometryBeginFilled)
+			mAllFilled = false;
+
+		Append(CAIRO_PATH_MOVE_TO, 1);
+		AppendPoint(inX, inY);
+	}
+
+	void LineTo(float inX, float inY) override
+	{
+		Append(CAIRO_PATH_LINE_TO, 1);
+		AppendPoint(inX, inY);
+	}
+
+	void CurveTo(float inX1, float inY1, float inX2, float inY2, float inX3, float inY3) override
+	{
+		Append(CAIRO_PATH_CURVE_TO, 3);
+		AppendPoint(inX1, inY1);
+		AppendPoint(inX2, inY2);
+		AppendPoint(inX3, inY3);
+	}
+
+	void End(bool inClose) override
+	{
+		if (inClose)
+			Append(CAIRO_PATH_CLOSE_PATH, 0);
+	}
 
-	const char
-		not_sign[] = "\xc2\xac",      // 0x00AC
-		right_chevron[] = "\xc2\xbb", // 0x00BB
-		middle_dot[] = "\xc2\xb7";    // 0x00B7
+	MGeometryImpl *Clone() const override
+	{
+		return new MCairoGeometryImpl(*this);
+	}
 
-	PangoAttrList *attrs = pango_attr_list_new();
+	// Append the recorded path to the current path in inContext,
+	// hollow figures are skipped if inFilledOnly is true
+	void AppendTo(cairo_t *inContext, bool inFilledOnly)
+	{
+		if (not inFilledOnly or mAllFilled)
+			AppendTo(inContext, 0, mData.size());
+		else
+		{
+			for (size_t i = 0; i < mFigures.size(); ++i)
+			{
+				if (not mFigures[i].mFilled)
+					continue;
 
-	PangoAttribute *attr = pango_attr_font_desc_new(mFont);
-	attr->start_index = 0;
-	attr->end_index = 2;
+				size_t end = i + 1 < mFigures.size() ? mFigures[i + 1].mOffset : mData.size();
+				AppendTo(inContext, mFigures[i].mOffset, end);
+			}
+		}
+	}
 
-	pango_attr_list_insert(attrs, attr);
+	cairo_fill_rule_t GetFillRule() const { return mFillRule; }
+
+  private:
+	void AppendTo(cairo_t *inContext, size_t inBegin, size_t inEnd)
+	{
+		if (inBegin < inEnd)
+		{
+			cairo_path_t path{ CAIRO_STATUS_SUCCESS, mData.data() + inBegin, static_cast<int>(inEnd - inBegin) };
+			cairo_append_path(inContext, &path);
+		}
+	}
 
-	PangoGlyphString *ts = pango_glyph_string_new();
+	void Append(cairo_path_data_type_t inType, int inPointCount)
+	{
+		cairo_path_data_t d;
+		d.header.type = inType;
+		d.header.length = 1 + inPointCount;
+		mData.push_back(d);
+	}
 
-	PangoItem *item = Itemize(middle_dot, attrs);
-	assert(item->analysis.font);
-	pango_shape(middle_dot, strlen(middle_dot), &item->analysis, ts);
-	outSpace = ts->glyphs[0].glyph;
+	void AppendPoint(double inX, double inY)
+	{
+		cairo_path_data_t d;
+		d.point.x = inX;
+		d.point.y = inY;
+		mData.push_back(d);
+	}
 
-	item = Itemize(right_chevron, attrs);
-	assert(item->analysis.font);
-	pango_shape(right_chevron, strlen(right_chevron), &item->analysis, ts);
-	outTab = ts->glyphs[0].glyph;
+	struct MFigure
+	{
+		size_t mOffset;
+		bool mFilled;
+	};
+
+	cairo_fill_rule_t mFillRule;
+	std::vector<cairo_path_data_t> mData;
+	std::vector<MFigure> mFigures;
+	bool mAllFilled = true;
+};
 
-	item = Itemize(not_sign, attrs);
-	assert(item->analysis.font);
-	pango_shape(not_sign, strlen(not_sign), &item->analysis, ts);
-	outNL = ts->glyphs[0].glyph;
+MGeometryImpl *MGeometryImpl::Create(MGeometryFillMode inMode)
+{
+	return new MCairoGeometryImpl(inMode);
+}
 
-	pango_glyph_string_free(ts);
-	pango_attr_list_unref(attrs);
+MGeometryImpl *MGeometryImpl::Create(MDevice &inDevice, MGeometryFillMode inMode)
+{
+	return new MCairoGeometryImpl(inMode);
 }
 
 // --------------------------------------------------------------------
@@ -496,6 +1486,8 @@ class MCairoDeviceImp : public MGtkDeviceImpl
 {
   public:
 	MCairoDeviceImp(MView *inView);
+	MCairoDeviceImp(MView *inView, MRect inRect, bool inCreateOffscreen);
+	MCairoDeviceImp(MBitmap &inBitmap);
 	// MCairoDeviceImp(GtkPrintContext *inContext, MRect inRect, int32_t inPage);
 	~MCairoDeviceImp();
 
@@ -508,23 +1500,33 @@ class MCairoDeviceImp : public MGtkDeviceImpl
 	}
 
 	virtual MRect GetBounds() const { return mRect; }
+	virtual bool IsOffscreenValid() const { return mOffscreenValid; }
 	virtual void SetOrigin(int32_t inX, int32_t inY);
 	virtual void SetForeColor(MColor inColor);
 	virtual MColor GetForeColor() const;
 	virtual void SetBackColor(MColor inColor);
 	virtual MColor GetBackColor() const;
 	virtual void ClipRect(MRect inRect);
+	virtual void ClipRegion(const MRegion &inRegion);
 	virtual void EraseRect(MRect inRect);
 	virtual void FillRect(MRect inRect);
 	virtual void StrokeRect(MRect inRect, uint32_t inLineWidth = 1);
+	virtual void StrokeLine(float inFromX, float inFromY, float inToX, float inToY, uint32_t inLineWidth);
 	virtual void FillEllipse(MRect inRect);
+	virtual void StrokeGeometry(MGeometryImpl &inGeometry, float inLineWidth);
+	virtual void FillGeometry(MGeometryImpl &inGeometry);
 	virtual void DrawImage(cairo_surface_t *inImage, float inX, float inY, float inShear);
 	virtual void DrawBitmap(const MBitmap &inBitmap, float inX, float inY);
-	virtual void CreateAndUsePattern(MColor inColor1, MColor inColor2);
+	virtual void CreateAndUsePattern(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation);
 	virtual void DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth, MAlignment inAlign);
+
+	virtual void GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns);
+	virtual void DrawStrings(std::span<const MStringItem> inStrings);
+	virtual void DrawGlyphRuns(std::span<const MGlyphRun> inRuns);
 	virtual void RenderText(float inX, float inY);
 	virtual void DrawCaret(float inX, float inY, uint32_t inOffset);
 	virtual void MakeTransparent(float inOpacity);
+	virtual void SetScale(float inScaleX, float inScaleY, float inCenterX, float inCenterY);
 	virtual void SetDrawWhiteSpace(bool inDrawWhiteSpace, MColor inWhiteSpaceColor);
 
   protected:
@@ -536,9 +1538,19 @@ class MCairoDeviceImp : public MGtkDeviceImpl
 	MColor mEvenRowColor;
 	MColor mWhiteSpaceColor;
 	cairo_t *mContext;
-	uint32_t mPatternData[8][8];
 	int32_t mPage;
 	bool mDrawWhiteSpace;
+
+	// when drawing offscreen, mContext draws in mOffscreen and
+	// mTarget is the context of the view
+	cairo_t *mTarget = nullptr;
+	cairo_surface_t *mOffscreen = nullptr;
+	MRect mOffscreenRect;
+	bool mOffscreenValid = false;
+
+	// when drawing in a bitmap, mContext draws in mBitmapSurface
+	MBitmap *mBitmap = nullptr;
+	cairo_surface_t *mBitmapSurface = nullptr;
 };
 
 MCairoDeviceImp::MCairoDeviceImp(MView *inView)
@@ -553,12 +1565,105 @@ MCairoDeviceImp::MCairoDeviceImp(MView *inView)
 	MGtkCanvasImpl *target = static_cast<MGtkCanvasImpl *>(canvas->GetImpl());
 	mContext = target->GetCairo();
 
-	auto bounds = inView->GetBounds();
-	SetOrigin(-bounds.x, -bounds.y);
+	mRect = inView->GetBounds();
+
+	cairo_save(mContext);
+	SetOrigin(-mRect.x, -mRect.y);
+}
+
+MCairoDeviceImp::MCairoDeviceImp(MView *inView, MRect inRect, bool inCreateOffscreen)
+	: mContext(nullptr)
+	, mPage(-1)
+	, mDrawWhiteSpace(false)
+{
+	mForeColor = kBlack;
+	mBackColor = kWhite;
+
+	MCanvas *canvas = dynamic_cast<MCanvas *>(inView);
+	MGtkCanvasImpl *target = static_cast<MGtkCanvasImpl *>(canvas->GetImpl());
+
+	mRect = inRect;
+
+	if (inCreateOffscreen)
+	{
+		MRect bounds = inView->GetBounds();
+
+		mTarget = target->GetCairo();
+		mOffscreen = target->GetLayer(inRect, mOffscreenValid);
+		mOffscreenRect = { inRect.x - bounds.x, inRect.y - bounds.y, inRect.width, inRect.height };
+
+		mContext = cairo_create(mOffscreen);
+
+		if (not mOffscreenValid)
+		{
+			cairo_set_operator(mContext, CAIRO_OPERATOR_CLEAR);
+			cairo_paint(mContext);
+			cairo_set_operator(mContext, CAIRO_OPERATOR_OVER);
+		}
+
+		SetOrigin(-inRect.x, -inRect.y);
+	}
+	else
+	{
+		MRect bounds = inView->GetBounds();
+
+		mContext = target->GetCairo();
+
+		cairo_save(mContext);
+		SetOrigin(-bounds.x, -bounds.y);
+		ClipRect(inRect);
+	}
+}
+
+MCairoDeviceImp::MCairoDeviceImp(MBitmap &inBitmap)
+	: mContext(nullptr)
+	, mPage(-1)
+	, mDrawWhiteSpace(false)
+	, mBitmap(&inBitmap)
+{
+	mForeColor = kBlack;
+	mBackColor = kWhite;
+
+	mRect = { 0, 0, static_cast<int32_t>(inBitmap.Width()), static_cast<int32_t>(inBitmap.Height()) };
+
+	cairo_format_t format = inBitmap.UseAlpha() ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+
+	mBitmapSurface = cairo_image_surface_create_for_data(
+		reinterpret_cast<uint8_t *>(inBitmap.Data()),
+		format, inBitmap.Width(), inBitmap.Height(), inBitmap.Stride());
+
+	if (cairo_surface_status(mBitmapSurface) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(mBitmapSurface);
+		throw std::runtime_error("cannot create a surface for the bitmap");
+	}
+
+	mContext = cairo_create(mBitmapSurface);
 }
 
 MCairoDeviceImp::~MCairoDeviceImp()
 {
+	if (mBitmapSurface != nullptr)
+	{
+		cairo_destroy(mContext);
+
+		cairo_surface_flush(mBitmapSurface);
+		cairo_surface_destroy(mBitmapSurface);
+
+		mBitmap->MarkDirty();
+	}
+	else if (mOffscreen != nullptr)
+	{
+		cairo_destroy(mContext);
+
+		cairo_save(mTarget);
+		cairo_set_source_surface(mTarget, mOffscreen, mOffscreenRect.x, mOffscreenRect.y);
+		cairo_rectangle(mTarget, mOffscreenRect.x, mOffscreenRect.y, mOffscreenRect.width, mOffscreenRect.height);
+		cairo_fill(mTarget);
+		cairo_restore(mTarget);
+	}
+	else if (mContext != nullptr)
+		cairo_restore(mContext);
 }
 
 void MCairoDeviceImp::Save()
@@ -604,13 +1709,14 @@ void MCairoDeviceImp::ClipRect(MRect inRect)
 	cairo_clip(mContext);
 }
 
-// void MCairoDeviceImp::ClipRegion(
-//	MRegion				inRegion)
-//{
-//	GdkRegion* gdkRegion = const_cast<GdkRegion*>(inRegion.operator const GdkRegion*());
-//	gdk_cairo_region(mContext, gdkRegion);
-//	cairo_clip(mContext);
-// }
+void MCairoDeviceImp::ClipRegion(const MRegion &inRegion)
+{
+	// the rectangles in a region do not overlap, so the
+	// default winding rule gives the right result
+	for (auto &r : inRegion.GetRects())
+		cairo_rectangle(mContext, r.x, r.y, r.width, r.height);
+	cairo_clip(mContext);
+}
 
 void MCairoDeviceImp::EraseRect(MRect inRect)
 {
@@ -640,6 +1746,18 @@ void MCairoDeviceImp::StrokeRect(MRect inRect, uint32_t inLineWidth)
 	cairo_stroke(mContext);
 }
 
+void MCairoDeviceImp::StrokeLine(float inFromX, float inFromY, float inToX, float inToY, uint32_t inLineWidth)
+{
+	double lineWidth = cairo_get_line_width(mContext);
+
+	cairo_set_line_width(mContext, inLineWidth);
+	cairo_move_to(mContext, inFromX, inFromY);
+	cairo_line_to(mContext, inToX, inToY);
+	cairo_stroke(mContext);
+
+	cairo_set_line_width(mContext, lineWidth);
+}
+
 void MCairoDeviceImp::FillEllipse(MRect inRect)
 {
 	cairo_save(mContext);
@@ -650,20 +1768,46 @@ void MCairoDeviceImp::FillEllipse(MRect inRect)
 	cairo_restore(mContext);
 }
 
+void MCairoDeviceImp::StrokeGeometry(MGeometryImpl &inGeometry, float inLineWidth)
+{
+	MCairoGeometryImpl &geometry = static_cast<MCairoGeometryImpl &>(inGeometry);
+
+	cairo_save(mContext);
+	cairo_new_path(mContext);
+	geometry.AppendTo(mContext, false);
+	cairo_set_line_width(mContext, inLineWidth);
+	cairo_stroke(mContext);
+	cairo_restore(mContext);
+}
+
+void MCairoDeviceImp::FillGeometry(MGeometryImpl &inGeometry)
+{
+	MCairoGeometryImpl &geometry = static_cast<MCairoGeometryImpl &>(inGeometry);
+
+	cairo_save(mContext);
+	cairo_new_path(mContext);
+	geometry.AppendTo(mContext, true);
+	cairo_set_fill_rule(mContext, geometry.GetFillRule());
+	cairo_fill(mContext);
+	cairo_restore(mContext);
+}
+
 void MCairoDeviceImp::DrawImage(cairo_surface_t *inImage, float inX, float inY, float inShear)
 {
 	cairo_save(mContext);
 
-	cairo_surface_set_device_offset(inImage, -inX, -inY);
+	// the device scale of the image maps units to pixels
+	double sx, sy;
+	cairo_surface_get_device_scale(inImage, &sx, &sy);
 
 	cairo_pattern_t *p = cairo_pattern_create_for_surface(inImage);
 
 	if (p != nullptr)
 	{
+		// The image is placed with the pattern matrix, the surface
+		// belongs to a bitmap that may be drawn on other threads.
 		cairo_matrix_t m;
-		cairo_matrix_init_translate(&m, -inX, -inY);
-		//		cairo_matrix_init_rotate(&m, 2.356);
-		cairo_matrix_init(&m, 1, inShear, inShear, 1, 0, 0);
+		cairo_matrix_init(&m, 1, inShear, inShear, 1, -inX, -inY);
 		cairo_pattern_set_matrix(p, &m);
 
 		cairo_set_source(mContext, p);
@@ -673,196 +1817,358 @@ void MCairoDeviceImp::DrawImage(cairo_surface_t *inImage, float inX, float inY,
 		int w = cairo_image_surface_get_width(inImage);
 		int h = cairo_image_surface_get_height(inImage);
 
-		cairo_rectangle(mContext, inX, inY, w, h);
+		cairo_rectangle(mContext, inX, inY, w / sx, h / sy);
 		cairo_fill(mContext);
 	}
 
 	cairo_restore(mContext);
 }
 
-void MCairoDeviceImp::DrawBitmap(const MBitmap &inBitmap, float inX, float inY)
+// --------------------------------------------------------------------
+// The cairo surface for an MBitmap shares the pixels with the bitmap,
+// it is kept as long as the bitmap exists so cairo can cache whatever
+// it needs to draw it.
+
+struct MCairoBitmapImpl : public MBitmapImpl
 {
-	cairo_surface_t *surface = cairo_image_surface_create_for_data((uint8_t *)inBitmap.Data(), CAIRO_FORMAT_ARGB32, inBitmap.Width(), inBitmap.Height(), inBitmap.Stride());
+	MCairoBitmapImpl(const MBitmap &inBitmap)
+	{
+		cairo_format_t format = inBitmap.UseAlpha() ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+
+		mSurface = cairo_image_surface_create_for_data(
+			reinterpret_cast<uint8_t *>(const_cast<uint32_t *>(inBitmap.Data())),
+			format, inBitmap.Width(), inBitmap.Height(), inBitmap.Stride());
+
+		if (cairo_surface_status(mSurface) != CAIRO_STATUS_SUCCESS)
+		{
+			cairo_surface_destroy(mSurface);
+			mSurface = nullptr;
+		}
+		else
+			SetScale(inBitmap.GetScale());
+	}
+
+	~MCairoBitmapImpl()
+	{
+		if (mSurface != nullptr)
+			cairo_surface_destroy(mSurface);
+	}
+
+	virtual void MarkDirty()
+	{
+		if (mSurface != nullptr)
+			cairo_surface_mark_dirty(mSurface);
+	}
 
-	if (surface != nullptr)
+	virtual void SetScale(uint32_t inScale)
 	{
-		DrawImage(surface, inX, inY, 0);
-		cairo_surface_destroy(surface);
+		if (mSurface != nullptr)
+			cairo_surface_set_device_scale(mSurface, inScale, inScale);
 	}
+
+	cairo_surface_t *mSurface;
+};
+
+MBitmapImpl *MBitmapImpl::Create(const MBitmap &inBitmap)
+{
+	return new MCairoBitmapImpl(inBitmap);
 }
 
-void MCairoDeviceImp::CreateAndUsePattern(MColor inColor1, MColor inColor2)
+void MCairoDeviceImp::DrawBitmap(const MBitmap &inBitmap, float inX, float inY)
 {
-	uint32_t c1 = 0, c2 = 0;
+	auto impl = static_cast<MCairoBitmapImpl *>(inBitmap.GetImpl());
 
-	assert(cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, 8) == 32);
+	if (impl != nullptr and impl->mSurface != nullptr)
+		DrawImage(impl->mSurface, inX, inY, 0);
+}
 
-	c1 |= inColor1.red << 16;
-	c1 |= inColor1.green << 8;
-	c1 |= inColor1.blue << 0;
+// --------------------------------------------------------------------
+// MCairoPatternCache keeps the striped patterns created by
+// CreateAndUsePattern. A pattern only depends on its colours, the width
+// of the stripes and the rotation, so they can be shared by all devices
+// on a thread.
 
-	c2 |= inColor2.red << 16;
-	c2 |= inColor2.green << 8;
-	c2 |= inColor2.blue << 0;
+class MCairoPatternCache
+{
+  public:
+	static constexpr size_t kMaxEntries = 64;
 
-	for (uint32_t y = 0; y < 8; ++y)
+	static MCairoPatternCache &Instance()
 	{
-		for (uint32_t x = 0; x < 4; ++x)
-			mPatternData[y][x] = c1;
-		for (uint32_t x = 4; x < 8; ++x)
-			mPatternData[y][x] = c2;
+		static thread_local MCairoPatternCache sInstance;
+		return sInstance;
 	}
 
-	cairo_surface_t *s = cairo_image_surface_create_for_data(reinterpret_cast<uint8_t *>(mPatternData), CAIRO_FORMAT_RGB24, 8, 8, 32);
+	~MCairoPatternCache()
+	{
+		Clear();
+	}
 
-	if (s != nullptr)
+	// Return a pattern with alternating stripes of inWidth pixels in
+	// inColor1 and inColor2, rotated inRotation degrees. The pattern
+	// is owned by the cache.
+	cairo_pattern_t *Get(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation)
 	{
-		cairo_pattern_t *p = cairo_pattern_create_for_surface(s);
-		cairo_pattern_set_extend(p, CAIRO_EXTEND_REPEAT);
+		if (inWidth == 0)
+			inWidth = 1;
+
+		MKey key{ RGB(inColor1), RGB(inColor2), inWidth, inRotation };
+
+		auto i = mPatterns.find(key);
+		if (i != mPatterns.end())
+			return i->second;
 
+		if (mPatterns.size() >= kMaxEntries)
+			Clear();
+
+		cairo_pattern_t *p = Create(key);
 		if (p != nullptr)
+			mPatterns.emplace(key, p);
+		return p;
+	}
+
+	void Clear()
+	{
+		for (auto &[key, pattern] : mPatterns)
+			cairo_pattern_destroy(pattern);
+		mPatterns.clear();
+	}
+
+  private:
+	struct MKey
+	{
+		uint32_t mColor1, mColor2;
+		uint32_t mWidth;
+		float mRotation;
+
+		bool operator==(const MKey &) const = default;
+	};
+
+	struct MKeyHash
+	{
+		size_t operator()(const MKey &inKey) const
+		{
+			size_t h = std::hash<uint32_t>{}(inKey.mColor1);
+			h = h * 31 + std::hash<uint32_t>{}(inKey.mColor2);
+			h = h * 31 + std::hash<uint32_t>{}(inKey.mWidth);
+			h = h * 31 + std::hash<float>{}(inKey.mRotation);
+			return h;
+		}
+	};
+
+	static uint32_t RGB(MColor inColor)
+	{
+		return inColor.red << 16 | inColor.green << 8 | inColor.blue;
+	}
+
+	// The stripes are horizontal in pattern space, a single pixel wide
+	// column is enough since the pattern repeats.
+	static cairo_pattern_t *Create(const MKey &inKey)
+	{
+		const int32_t height = 2 * inKey.mWidth;
+
+		cairo_surface_t *s = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, height);
+		if (cairo_surface_status(s) != CAIRO_STATUS_SUCCESS)
 		{
-			cairo_matrix_t m;
-			cairo_matrix_init_rotate(&m, 2.356);
-			cairo_pattern_set_matrix(p, &m);
+			cairo_surface_destroy(s);
+			return nullptr;
+		}
+
+		cairo_surface_flush(s);
 
-			cairo_set_source(mContext, p);
+		uint8_t *data = cairo_image_surface_get_data(s);
+		int32_t stride = cairo_image_surface_get_stride(s);
 
+		for (int32_t y = 0; y < height; ++y)
+			*reinterpret_cast<uint32_t *>(data + y * stride) = y < static_cast<int32_t>(inKey.mWidth) ? inKey.mColor1 : inKey.mColor2;
+
+		cairo_surface_mark_dirty(s);
+
+		cairo_pattern_t *p = cairo_pattern_create_for_surface(s);
+		cairo_surface_destroy(s);
+
+		if (cairo_pattern_status(p) != CAIRO_STATUS_SUCCESS)
+		{
 			cairo_pattern_destroy(p);
+			return nullptr;
 		}
 
-		cairo_surface_destroy(s);
+		cairo_pattern_set_extend(p, CAIRO_EXTEND_REPEAT);
+		cairo_pattern_set_filter(p, CAIRO_FILTER_NEAREST);
+
+		cairo_matrix_t m;
+		cairo_matrix_init_rotate(&m, inKey.mRotation * M_PI / 180);
+		cairo_pattern_set_matrix(p, &m);
+
+		return p;
 	}
+
+	std::unordered_map<MKey, cairo_pattern_t *, MKeyHash> mPatterns;
+};
+
+void MCairoDeviceImp::CreateAndUsePattern(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation)
+{
+	cairo_pattern_t *p = MCairoPatternCache::Instance().Get(inColor1, inColor2, inWidth, inRotation);
+	if (p != nullptr)
+		cairo_set_source(mContext, p);
 }
 
 void MCairoDeviceImp::DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth, MAlignment inAlign)
 {
-	// reset attributes first
-	PangoAttrList *attrs = pango_attr_list_new();
-	pango_layout_set_attributes(mPangoLayout, attrs);
-	pango_attr_list_unref(attrs);
+	auto &cache = MPangoLayoutCache::Instance();
 
-	pango_layout_set_text(mPangoLayout, inText.c_str(), inText.length());
+	auto &e = inTruncateWidth != 0
+	              ? cache.Get(mFont, inText, inTruncateWidth, true, inAlign)
+	              : cache.Get(mFont, inText, mRect.width, false, eAlignNone);
 
-	if (inTruncateWidth != 0)
-	{
-		pango_layout_set_ellipsize(mPangoLayout, PANGO_ELLIPSIZE_END);
-		pango_layout_set_width(mPangoLayout, inTruncateWidth * mPangoScale);
+	cairo_move_to(mContext, inX + e.mXOffset, inY);
 
-		if (inAlign != eAlignNone and inAlign != eAlignLeft)
-		{
-			PangoRectangle r;
-			pango_layout_get_pixel_extents(mPangoLayout, nullptr, &r);
+	pango_cairo_show_layout(mContext, e.mLayout);
+}
 
-			if (static_cast<uint32_t>(r.width) < inTruncateWidth)
-			{
-				if (inAlign == eAlignCenter)
-					inX += (inTruncateWidth - r.width) / 2;
-				else
-					inX += inTruncateWidth - r.width;
-			}
-		}
-	}
-	else
+void MCairoDeviceImp::GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns)
+{
+	ShapeStrings(inStrings, mRect.width, outRuns, nullptr);
+}
+
+void MCairoDeviceImp::DrawStrings(std::span<const MStringItem> inStrings)
+{
+	static thread_local std::vector<MGlyphRun> sRuns;
+	static thread_local std::vector<size_t> sMissing;
+
+	// shaped exactly as DrawString would
+	ShapeStrings(inStrings, mRect.width, sRuns, &sMissing);
+	DrawGlyphRuns(sRuns);
+
+	// pango draws the characters missing from the fonts as hex boxes
+	for (size_t i : sMissing)
 	{
-		pango_layout_set_ellipsize(mPangoLayout, PANGO_ELLIPSIZE_NONE);
-		pango_layout_set_width(mPangoLayout, mRect.width * mPangoScale);
-	}
+		auto &e = MPangoLayoutCache::Instance().Get(mFont, inStrings[i].mText, mRect.width, false, eAlignNone);
 
-	cairo_move_to(mContext, inX, inY);
+		cairo_move_to(mContext, inStrings[i].mX, inStrings[i].mY);
+		pango_cairo_show_layout(mContext, e.mLayout);
+	}
 
-	pango_cairo_show_layout(mContext, mPangoLayout);
+	sRuns.clear();
+	sMissing.clear();
 }
 
-void MCairoDeviceImp::DrawWhiteSpace(float inX, float inY)
+void MCairoDeviceImp::DrawGlyphRuns(std::span<const MGlyphRun> inRuns)
 {
-#if PANGO_VERSION_CHECK(1, 22, 0)
-	int baseLine = pango_layout_get_baseline(mPangoLayout);
-	PangoLayoutLine *line = pango_layout_get_line(mPangoLayout, 0);
+	static thread_local std::vector<cairo_glyph_t> sGlyphs;
 
-	cairo_set_source_rgb(mContext, mWhiteSpaceColor.red / 255.0, mWhiteSpaceColor.green / 255.0, mWhiteSpaceColor.blue / 255.0);
+	cairo_save(mContext);
 
-	// we're using one font anyway
-	PangoFontMap *fontMap = pango_cairo_font_map_get_default();
-	PangoContext *context = pango_layout_get_context(mPangoLayout);
-	PangoFont *font = pango_font_map_load_font(fontMap, context, mFont);
-	cairo_scaled_font_t *scaledFont =
-		pango_cairo_font_get_scaled_font(reinterpret_cast<PangoCairoFont *>(font));
+	for (auto &run : inRuns)
+	{
+		auto font = static_cast<const MGtkFontImpl *>(run.mFont.GetImpl());
+		if (font == nullptr or font->mScaledFont == nullptr or run.mGlyphs.empty())
+			continue;
 
-	if (scaledFont == nullptr or cairo_scaled_font_status(scaledFont) != CAIRO_STATUS_SUCCESS)
-		return;
+		sGlyphs.clear();
+		for (auto &g : run.mGlyphs)
+			sGlyphs.push_back({ g.mIndex, g.mX, g.mY });
+
+		cairo_set_scaled_font(mContext, font->mScaledFont);
+		cairo_set_source_rgb(mContext, run.mColor.red / 255.0, run.mColor.green / 255.0, run.mColor.blue / 255.0);
+		cairo_show_glyphs(mContext, sGlyphs.data(), sGlyphs.size());
+	}
+
+	cairo_restore(mContext);
+}
+
+void MCairoDeviceImp::DrawWhiteSpace(float inX, float inY)
+{
+	// The scaled font and the whitespace glyphs are cached by the
+	// interned font, without a font set there's nothing to draw with.
 
-	cairo_set_scaled_font(mContext, scaledFont);
+	if (mFontImpl == nullptr)
+		return;
 
-	int x_position = 0;
-	std::vector<cairo_glyph_t> cairo_glyphs;
+	cairo_scaled_font_t *scaledFont = mFontImpl->mScaledFont;
 
-	for (GSList *run = line->runs; run != nullptr; run = run->next)
+	if (scaledFont != nullptr)
 	{
-		PangoGlyphItem *glyphItem = reinterpret_cast<PangoGlyphItem *>(run->data);
+		// The scratch buffer is reused for every line drawn on this thread
+
+		static thread_local std::vector<cairo_glyph_t> sGlyphs;
+		sGlyphs.clear();
 
-		PangoGlyphItemIter iter;
 		const char *text = pango_layout_get_text(mPangoLayout);
+		int x_position = 0, baseLine = 0;
+
+		PangoLayoutIter *iter = pango_layout_get_iter(mPangoLayout);
 
-		for (bool more = pango_glyph_item_iter_init_start(&iter, glyphItem, text);
-			 more;
-			 more = pango_glyph_item_iter_next_cluster(&iter))
+		do
 		{
-			PangoGlyphString *gs = iter.glyph_item->glyphs;
-			char ch = text[iter.start_index];
+			PangoGlyphItem *glyphItem = pango_layout_iter_get_run(iter);
+			if (glyphItem == nullptr) // end of a line
+				continue;
 
-			for (int i = iter.start_glyph; i < iter.end_glyph; ++i)
+			PangoRectangle logical;
+			pango_layout_iter_get_run_extents(iter, nullptr, &logical);
+
+			x_position = logical.x;
+			baseLine = pango_layout_iter_get_baseline(iter);
+
+			PangoGlyphItemIter gi_iter;
+			for (bool more = pango_glyph_item_iter_init_start(&gi_iter, glyphItem, text);
+				 more;
+				 more = pango_glyph_item_iter_next_cluster(&gi_iter))
 			{
-				PangoGlyphInfo *gi = &gs->glyphs[i];
+				PangoGlyphString *gs = gi_iter.glyph_item->glyphs;
+				char ch = text[gi_iter.start_index];
 
-				if (ch == ' ' or ch == '\t')
+				for (int i = gi_iter.start_glyph; i < gi_iter.end_glyph; ++i)
 				{
-					double cx = inX + double(x_position + gi->geometry.x_offset) / mPangoScale;
-					double cy = inY + double(baseLine + gi->geometry.y_offset) / mPangoScale;
-
-					cairo_glyph_t g;
-					if (ch == ' ')
-						g.index = mSpaceGlyph;
-					else
-						g.index = mTabGlyph;
-					g.x = cx;
-					g.y = cy;
-
-					cairo_glyphs.push_back(g);
-				}
+					PangoGlyphInfo *gi = &gs->glyphs[i];
+
+					if (ch == ' ' or ch == '\t')
+					{
+						cairo_glyph_t g;
+						g.index = ch == ' ' ? mSpaceGlyph : mTabGlyph;
+						g.x = inX + double(x_position + gi->geometry.x_offset) / mPangoScale;
+						g.y = inY + double(baseLine + gi->geometry.y_offset) / mPangoScale;
 
-				x_position += gi->geometry.width;
+						sGlyphs.push_back(g);
+					}
+
+					x_position += gi->geometry.width;
+				}
 			}
-		}
-	}
+		} while (pango_layout_iter_next_run(iter));
 
-	// and a trailing newline perhaps?
+		pango_layout_iter_free(iter);
 
-	if (mTextEndsWithNewLine)
-	{
-		double cx = inX + double(x_position) / mPangoScale;
-		double cy = inY + double(baseLine) / mPangoScale;
+		// and a trailing newline perhaps?
 
-		cairo_glyph_t g;
-		g.index = mNewLineGlyph;
-		g.x = cx;
-		g.y = cy;
+		if (mTextEndsWithNewLine)
+		{
+			cairo_glyph_t g;
+			g.index = mNewLineGlyph;
+			g.x = inX + double(x_position) / mPangoScale;
+			g.y = inY + double(baseLine) / mPangoScale;
 
-		cairo_glyphs.push_back(g);
-	}
+			sGlyphs.push_back(g);
+		}
 
-	cairo_show_glyphs(mContext, &cairo_glyphs[0], cairo_glyphs.size());
-#endif
+		// all whitespace glyphs of the layout go out in a single run
+
+		if (not sGlyphs.empty())
+		{
+			cairo_save(mContext);
+			cairo_set_source_rgb(mContext, mWhiteSpaceColor.red / 255.0, mWhiteSpaceColor.green / 255.0, mWhiteSpaceColor.blue / 255.0);
+			cairo_set_scaled_font(mContext, scaledFont);
+			cairo_show_glyphs(mContext, sGlyphs.data(), sGlyphs.size());
+			cairo_restore(mContext);
+		}
+	}
 }
 
 void MCairoDeviceImp::RenderText(float inX, float inY)
 {
 	if (mDrawWhiteSpace)
-	{
-		Save();
 		DrawWhiteSpace(inX, inY);
-		Restore();
-	}
 
 	cairo_move_to(mContext, inX, inY);
 	pango_cairo_show_layout(mContext, mPangoLayout);
@@ -892,6 +2198,15 @@ void MCairoDeviceImp::MakeTransparent(float inOpacity)
 	cairo_paint(mContext);
 }
 
+// Scale everything drawn after this around inCenterX, inCenterY,
+// use Save and Restore to undo
+void MCairoDeviceImp::SetScale(float inScaleX, float inScaleY, float inCenterX, float inCenterY)
+{
+	cairo_translate(mContext, inCenterX, inCenterY);
+	cairo_scale(mContext, inScaleX, inScaleY);
+	cairo_translate(mContext, -inCenterX, -inCenterY);
+}
+
 // GdkPixmap* MCairoDeviceImp::GetPixmap() const
 //{
 //	g_object_ref(mOffscreenPixmap);
@@ -909,16 +2224,21 @@ MDeviceImpl *MDeviceImpl::Create()
 	return new MGtkDeviceImpl();
 }
 
-// MDeviceImpl* MDeviceImpl::Create(MView* inView, MRect inRect, bool inCreateOffscreen)
-// {
-// 	return new MCairoDeviceImp(inView, inRect, inCreateOffscreen);
-// }
-
 MDeviceImpl *MDeviceImpl::Create(MView *inView)
 {
 	return new MCairoDeviceImp(inView);
 }
 
+MDeviceImpl *MDeviceImpl::Create(MView *inView, MRect inRect, bool inCreateOffscreen)
+{
+	return new MCairoDeviceImp(inView, inRect, inCreateOffscreen);
+}
+
+MDeviceImpl *MDeviceImpl::Create(MBitmap &inBitmap)
+{
+	return new MCairoDeviceImp(inBitmap);
+}
+
 struct MPNGSurface
 {
 	MPNGSurface(const void *inPNG, uint32_t inLength)
@@ -973,25 +2293,21 @@ MBitmap::MBitmap(const void *inPNG, uint32_t inLength)
 
 	mWidth = cairo_image_surface_get_width(surface);
 	mHeight = cairo_image_surface_get_height(surface);
-	mStride = cairo_image_surface_get_stride(surface);
+	mStride = MBitmapOps::AlignedStride(mWidth);
 
-	uint32_t length = mHeight * mStride;
 	switch (cairo_image_surface_get_format(surface))
 	{
-		case CAIRO_FORMAT_RGB24: mUseAlpha = false; // fall through
-		case CAIRO_FORMAT_ARGB32: length *= 4; break;
-		case CAIRO_FORMAT_A8: mUseAlpha = false; break;
+		case CAIRO_FORMAT_RGB24: mUseAlpha = false; break;
+		case CAIRO_FORMAT_ARGB32: break;
 		default: throw std::runtime_error("unsupported format"); break;
 	}
 
-	mData = new uint32_t[length / 4];
-	memcpy(mData, cairo_image_surface_get_data(surface), length);
-}
+	mData = MBitmapOps::AllocatePixels(mStride, mHeight);
 
-MGeometryImpl *MGeometryImpl::Create(MDevice &inDevice, MGeometryFillMode inMode)
-{
-	assert(false);
-	return nullptr;
+	cairo_surface_flush(surface);
+	MBitmapOps::Copy(mData, mStride,
+		reinterpret_cast<const uint32_t *>(cairo_image_surface_get_data(surface)),
+		cairo_image_surface_get_stride(surface), mWidth, mHeight);
 }
 
 void MDevice::ListFonts(bool inFixedWidthOnly, std::vector<std::string> &outFonts)
@@ -33,6 +33,25 @@
 
 #include <stack>
 
+// --------------------------------------------------------------------
+// An interned font, with everything we need that only depends on
+// the font description computed once.
+
+struct MGtkFontImpl : public MFontImpl
+{
+	MGtkFontImpl(const std::string &inName);
+	~MGtkFontImpl();
+
+	// the interned font for a font returned by pango, e.g. a fallback font
+	static const MGtkFontImpl *Intern(PangoFont *inFont);
+
+	PangoFontDescription *mDescription;
+	PangoFontMetrics *mMetrics;
+	PangoFont *mFont;
+	cairo_scaled_font_t *mScaledFont; // owned by mFont, may be null
+	uint32_t mSpaceGlyph, mTabGlyph, mNewLineGlyph;
+};
+
 // --------------------------------------------------------------------
 // base class for MDeviceImp
 // provides only the basic Pango functionality
@@ -53,6 +72,7 @@ class MGtkDeviceImpl : public MDeviceImpl
 	virtual void SetOrigin(int32_t inX, int32_t inY);
 
 	virtual void SetFont(const std::string &inFont);
+	virtual void SetFont(const MFontImpl *inFont);
 
 	virtual void SetForeColor(MColor inColor);
 
@@ -64,7 +84,7 @@ class MGtkDeviceImpl : public MDeviceImpl
 
 	virtual void ClipRect(MRect inRect);
 
-	//	virtual void			ClipRegion(// MRegion inRegion);
+	virtual void ClipRegion(const MRegion &inRegion);
 
 	virtual void EraseRect(MRect inRect);
 
@@ -76,7 +96,7 @@ class MGtkDeviceImpl : public MDeviceImpl
 
 	virtual void DrawImage(cairo_surface_t *inImage, float inX, float inY, float inShear);
 
-	virtual void CreateAndUsePattern(MColor inColor1, MColor inColor2);
+	virtual void CreateAndUsePattern(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation);
 
 	PangoFontMetrics *GetMetrics();
 
@@ -91,6 +111,9 @@ class MGtkDeviceImpl : public MDeviceImpl
 	virtual void DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth = 0, MAlignment inAlign = eAlignNone);
 
 	virtual uint32_t GetStringWidth(const std::string &inText);
+	virtual float GetStringAdvance(std::string_view inText);
+
+	virtual void GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns);
 
 	// Text Layout options
 
@@ -100,6 +123,7 @@ class MGtkDeviceImpl : public MDeviceImpl
 
 	virtual void SetTextColors(uint32_t inColorCount, uint32_t inColorIndices[], uint32_t inOffsets[], MColor inColors[]);
 	virtual void SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t inOffsets[]);
+	virtual void SetTextRuns(std::span<const MTextRun> inRuns);
 	virtual void RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor);
 
 	virtual void SetTextSelection(uint32_t inStart, uint32_t inLength, MColor inSelectionColor);
@@ -116,6 +140,9 @@ class MGtkDeviceImpl : public MDeviceImpl
 
 	virtual void BreakLines(uint32_t inWidth, std::vector<uint32_t> &outBreaks);
 
+	virtual MTextLayoutImpl *SaveTextLayout();
+	virtual bool UseTextLayout(MTextLayoutImpl *inLayout);
+
 	virtual void MakeTransparent(float inOpacity) {}
 
 	//	virtual GdkPixmap*		GetPixmap() const		{ return nullptr; }
@@ -123,14 +150,25 @@ class MGtkDeviceImpl : public MDeviceImpl
 	virtual void SetDrawWhiteSpace(bool inDrawWhiteSpace, MColor inWhiteSpaceColor) {}
 
   protected:
-	PangoItem *Itemize(const char *inText, PangoAttrList *inAttrs);
+	// switch back to mOwnLayout before changing a shared layout
+	void UnshareLayout();
 
-	void GetWhiteSpaceGlyphs(uint32_t &outSpace, uint32_t &outTab, uint32_t &outNL);
+	// Shape inStrings as DrawString would for a layout width of inWidth
+	// and append the glyphs to outRuns. Strings not in the layout cache
+	// are shaped directly and are not added to it. A string with
+	// characters none of the fonts has a glyph for is skipped, its
+	// index is added to outMissing if that is not null.
+	void ShapeStrings(std::span<const MStringItem> inStrings, uint32_t inWidth,
+		std::vector<MGlyphRun> &outRuns, std::vector<size_t> *outMissing);
 
 	PangoLayout *mPangoLayout;
-	PangoFontDescription *mFont;
-	PangoFontMetrics *mMetrics;
+	PangoLayout *mOwnLayout;    // set while mPangoLayout is shared with an MLineLayoutCache
+	PangoAttrList *mAttributes; // reused for each SetText
+	const MGtkFontImpl *mFontImpl;
+	PangoFontDescription *mFont; // owned by mFontImpl
+	PangoFontMetrics *mMetrics;  // owned by mFontImpl if it is set
 	bool mTextEndsWithNewLine;
+	float mTabWidth;
 	uint32_t mSpaceGlyph, mTabGlyph, mNewLineGlyph;
 	uint32_t mPangoScale;
 };
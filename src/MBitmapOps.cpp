@@ -0,0 +1,701 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MBitmapOps.hpp"
+#include "MDevice.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#if defined(__SSE2__) or defined(_M_X64)
+#define MBITMAPOPS_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define MBITMAPOPS_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define MBITMAPOPS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+// --------------------------------------------------------------------
+// Scalar kernels, these also handle the pixels left over by the SIMD
+// versions. All kernels work on one row of pixels.
+
+// x / 255, rounded, exact for x in [0, 255 * 255]
+inline uint32_t Div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+void FillRowScalar(uint32_t *outDst, uint32_t inCount, uint32_t inPixel)
+{
+	std::fill_n(outDst, inCount, inPixel);
+}
+
+void PremultiplyRowScalar(uint32_t *ioData, uint32_t inCount)
+{
+	for (uint32_t i = 0; i < inCount; ++i)
+	{
+		uint32_t p = ioData[i];
+		uint32_t a = p >> 24;
+
+		if (a == 255)
+			continue;
+
+		uint32_t r = Div255(((p >> 16) & 0xff) * a);
+		uint32_t g = Div255(((p >> 8) & 0xff) * a);
+		uint32_t b = Div255((p & 0xff) * a);
+
+		ioData[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+}
+
+// Uses the same float arithmetic as the SIMD version, so that the
+// results are identical.
+inline uint32_t Unpremultiply(uint32_t inChannel, float inScale)
+{
+	return static_cast<uint32_t>(std::nearbyint(std::min(inChannel * inScale, 255.f)));
+}
+
+void UnpremultiplyRowScalar(uint32_t *ioData, uint32_t inCount)
+{
+	for (uint32_t i = 0; i < inCount; ++i)
+	{
+		uint32_t p = ioData[i];
+		uint32_t a = p >> 24;
+
+		if (a == 255)
+			continue;
+
+		if (a == 0)
+		{
+			ioData[i] = 0;
+			continue;
+		}
+
+		float scale = 255.f / a;
+
+		uint32_t r = Unpremultiply((p >> 16) & 0xff, scale);
+		uint32_t g = Unpremultiply((p >> 8) & 0xff, scale);
+		uint32_t b = Unpremultiply(p & 0xff, scale);
+
+		ioData[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+}
+
+void SwizzleRowScalar(uint32_t *outDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	for (uint32_t i = 0; i < inCount; ++i)
+	{
+		uint32_t p = inSrc[i];
+
+		uint8_t *d = reinterpret_cast<uint8_t *>(outDst + i);
+		d[0] = static_cast<uint8_t>(p >> 16);
+		d[1] = static_cast<uint8_t>(p >> 8);
+		d[2] = static_cast<uint8_t>(p);
+		d[3] = static_cast<uint8_t>(p >> 24);
+	}
+}
+
+void OverRowScalar(uint32_t *ioDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	for (uint32_t i = 0; i < inCount; ++i)
+	{
+		uint32_t s = inSrc[i];
+		uint32_t ia = 255 - (s >> 24);
+
+		if (ia == 0)
+			ioDst[i] = s;
+		else if (s != 0)
+		{
+			uint32_t d = ioDst[i], r = 0;
+
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				uint32_t c = ((s >> shift) & 0xff) + Div255(((d >> shift) & 0xff) * ia);
+				r |= std::min(c, 255U) << shift;
+			}
+
+			ioDst[i] = r;
+		}
+	}
+}
+
+#if MBITMAPOPS_SSE2
+
+// --------------------------------------------------------------------
+// SSE2 kernels, four pixels at a time
+
+// x / 255 for eight 16 bit values
+inline __m128i Div255(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// the alpha of two unpacked pixels, copied to all four channels
+inline __m128i BroadcastAlpha(__m128i inPixels)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(inPixels, 0xff), 0xff);
+}
+
+void FillRowSSE2(uint32_t *outDst, uint32_t inCount, uint32_t inPixel)
+{
+	__m128i v = _mm_set1_epi32(static_cast<int>(inPixel));
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(outDst + i), v);
+
+	FillRowScalar(outDst + i, inCount - i, inPixel);
+}
+
+void PremultiplyRowSSE2(uint32_t *ioData, uint32_t inCount)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+	{
+		__m128i p = _mm_loadu_si128(reinterpret_cast<__m128i *>(ioData + i));
+
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+
+		lo = Div255(_mm_mullo_epi16(lo, BroadcastAlpha(lo)));
+		hi = Div255(_mm_mullo_epi16(hi, BroadcastAlpha(hi)));
+
+		__m128i r = _mm_packus_epi16(lo, hi);
+		r = _mm_or_si128(_mm_andnot_si128(alphaMask, r), _mm_and_si128(alphaMask, p));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(ioData + i), r);
+	}
+
+	PremultiplyRowScalar(ioData + i, inCount - i);
+}
+
+// one pixel in four 32 bit lanes
+inline __m128i UnpremultiplyPixel(__m128i inPixel)
+{
+	__m128 f = _mm_cvtepi32_ps(inPixel);
+	__m128 a = _mm_shuffle_ps(f, f, 0xff);
+
+	__m128 scale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(255.f), a), _mm_cmpneq_ps(a, _mm_setzero_ps()));
+
+	return _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(f, scale), _mm_set1_ps(255.f)));
+}
+
+void UnpremultiplyRowSSE2(uint32_t *ioData, uint32_t inCount)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+	{
+		__m128i p = _mm_loadu_si128(reinterpret_cast<__m128i *>(ioData + i));
+
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+
+		__m128i p0 = UnpremultiplyPixel(_mm_unpacklo_epi16(lo, zero));
+		__m128i p1 = UnpremultiplyPixel(_mm_unpackhi_epi16(lo, zero));
+		__m128i p2 = UnpremultiplyPixel(_mm_unpacklo_epi16(hi, zero));
+		__m128i p3 = UnpremultiplyPixel(_mm_unpackhi_epi16(hi, zero));
+
+		__m128i r = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+
+		// pixels with zero alpha end up all zero, as the scale is zero
+		r = _mm_or_si128(_mm_andnot_si128(alphaMask, r), _mm_and_si128(alphaMask, p));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(ioData + i), r);
+	}
+
+	UnpremultiplyRowScalar(ioData + i, inCount - i);
+}
+
+// Only valid on little endian machines, which all SSE2 machines are
+void SwizzleRowSSE2(uint32_t *outDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	const __m128i agMask = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+	const __m128i bMask = _mm_set1_epi32(0x000000ff);
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+	{
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inSrc + i));
+
+		__m128i r = _mm_or_si128(_mm_and_si128(p, agMask),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), bMask), _mm_slli_epi32(_mm_and_si128(p, bMask), 16)));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(outDst + i), r);
+	}
+
+	SwizzleRowScalar(outDst + i, inSrc + i, inCount - i);
+}
+
+void OverRowSSE2(uint32_t *ioDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+	{
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inSrc + i));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(ioDst + i));
+
+		__m128i ialo = _mm_sub_epi16(c255, BroadcastAlpha(_mm_unpacklo_epi8(s, zero)));
+		__m128i iahi = _mm_sub_epi16(c255, BroadcastAlpha(_mm_unpackhi_epi8(s, zero)));
+
+		__m128i lo = Div255(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ialo));
+		__m128i hi = Div255(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), iahi));
+
+		__m128i r = _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(ioDst + i), r);
+	}
+
+	OverRowScalar(ioDst + i, inSrc + i, inCount - i);
+}
+
+#endif
+
+#if MBITMAPOPS_AVX2
+
+// --------------------------------------------------------------------
+// AVX2 kernels, eight pixels at a time. These are the SSE2 kernels
+// with twice the width, unpacking and packing work per 128 bit lane
+// which keeps the pixels in order. The remaining pixels are handled by
+// the SSE2 kernels, the upper halves of the registers must be cleared
+// before calling them to avoid the AVX to SSE transition penalty.
+
+#define MBITMAPOPS_AVX2_TARGET __attribute__((target("avx2")))
+
+MBITMAPOPS_AVX2_TARGET inline __m256i Div255(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+MBITMAPOPS_AVX2_TARGET inline __m256i BroadcastAlpha(__m256i inPixels)
+{
+	return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(inPixels, 0xff), 0xff);
+}
+
+MBITMAPOPS_AVX2_TARGET void FillRowAVX2(uint32_t *outDst, uint32_t inCount, uint32_t inPixel)
+{
+	__m256i v = _mm256_set1_epi32(static_cast<int>(inPixel));
+
+	uint32_t i = 0;
+	for (; i + 8 <= inCount; i += 8)
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(outDst + i), v);
+
+	_mm256_zeroupper();
+	FillRowSSE2(outDst + i, inCount - i, inPixel);
+}
+
+MBITMAPOPS_AVX2_TARGET void PremultiplyRowAVX2(uint32_t *ioData, uint32_t inCount)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+
+	uint32_t i = 0;
+	for (; i + 8 <= inCount; i += 8)
+	{
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<__m256i *>(ioData + i));
+
+		__m256i lo = _mm256_unpacklo_epi8(p, zero);
+		__m256i hi = _mm256_unpackhi_epi8(p, zero);
+
+		lo = Div255(_mm256_mullo_epi16(lo, BroadcastAlpha(lo)));
+		hi = Div255(_mm256_mullo_epi16(hi, BroadcastAlpha(hi)));
+
+		__m256i r = _mm256_packus_epi16(lo, hi);
+		r = _mm256_or_si256(_mm256_andnot_si256(alphaMask, r), _mm256_and_si256(alphaMask, p));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(ioData + i), r);
+	}
+
+	_mm256_zeroupper();
+	PremultiplyRowSSE2(ioData + i, inCount - i);
+}
+
+// two pixels in the two 128 bit lanes, four 32 bit channels each
+MBITMAPOPS_AVX2_TARGET inline __m256i UnpremultiplyPixels(const uint32_t *inPixels)
+{
+	__m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(inPixels))));
+	__m256 a = _mm256_shuffle_ps(f, f, 0xff);
+
+	__m256 scale = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(255.f), a), _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+
+	return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(f, scale), _mm256_set1_ps(255.f)));
+}
+
+MBITMAPOPS_AVX2_TARGET void UnpremultiplyRowAVX2(uint32_t *ioData, uint32_t inCount)
+{
+	const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+
+	// packing per lane leaves the pixels in the order 0 2 4 6 1 3 5 7
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	uint32_t i = 0;
+	for (; i + 8 <= inCount; i += 8)
+	{
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<__m256i *>(ioData + i));
+
+		__m256i p01 = UnpremultiplyPixels(ioData + i);
+		__m256i p23 = UnpremultiplyPixels(ioData + i + 2);
+		__m256i p45 = UnpremultiplyPixels(ioData + i + 4);
+		__m256i p67 = UnpremultiplyPixels(ioData + i + 6);
+
+		__m256i r = _mm256_packus_epi16(_mm256_packs_epi32(p01, p23), _mm256_packs_epi32(p45, p67));
+		r = _mm256_permutevar8x32_epi32(r, order);
+
+		// pixels with zero alpha end up all zero, as the scale is zero
+		r = _mm256_or_si256(_mm256_andnot_si256(alphaMask, r), _mm256_and_si256(alphaMask, p));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(ioData + i), r);
+	}
+
+	_mm256_zeroupper();
+	UnpremultiplyRowSSE2(ioData + i, inCount - i);
+}
+
+MBITMAPOPS_AVX2_TARGET void SwizzleRowAVX2(uint32_t *outDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	uint32_t i = 0;
+	for (; i + 8 <= inCount; i += 8)
+	{
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inSrc + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(outDst + i), _mm256_shuffle_epi8(p, shuffle));
+	}
+
+	_mm256_zeroupper();
+	SwizzleRowSSE2(outDst + i, inSrc + i, inCount - i);
+}
+
+MBITMAPOPS_AVX2_TARGET void OverRowAVX2(uint32_t *ioDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i c255 = _mm256_set1_epi16(255);
+
+	uint32_t i = 0;
+	for (; i + 8 <= inCount; i += 8)
+	{
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inSrc + i));
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(ioDst + i));
+
+		__m256i ialo = _mm256_sub_epi16(c255, BroadcastAlpha(_mm256_unpacklo_epi8(s, zero)));
+		__m256i iahi = _mm256_sub_epi16(c255, BroadcastAlpha(_mm256_unpackhi_epi8(s, zero)));
+
+		__m256i lo = Div255(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ialo));
+		__m256i hi = Div255(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), iahi));
+
+		__m256i r = _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(ioDst + i), r);
+	}
+
+	_mm256_zeroupper();
+	OverRowSSE2(ioDst + i, inSrc + i, inCount - i);
+}
+
+#undef MBITMAPOPS_AVX2_TARGET
+
+#endif
+
+#if MBITMAPOPS_NEON
+
+// --------------------------------------------------------------------
+// NEON kernels, sixteen pixels at a time with the channels loaded into
+// separate registers. Channel 0 is blue, 3 is alpha.
+
+// x / 255 for eight 16 bit values, narrowed to eight bits
+inline uint8x8_t Div255(uint16x8_t x)
+{
+	x = vaddq_u16(x, vdupq_n_u16(128));
+	return vshrn_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8);
+}
+
+// a * b / 255 for sixteen channel values
+inline uint8x16_t MulDiv255(uint8x16_t a, uint8x16_t b)
+{
+	return vcombine_u8(
+		Div255(vmull_u8(vget_low_u8(a), vget_low_u8(b))),
+		Div255(vmull_u8(vget_high_u8(a), vget_high_u8(b))));
+}
+
+void FillRowNEON(uint32_t *outDst, uint32_t inCount, uint32_t inPixel)
+{
+	uint32x4_t v = vdupq_n_u32(inPixel);
+
+	uint32_t i = 0;
+	for (; i + 4 <= inCount; i += 4)
+		vst1q_u32(outDst + i, v);
+
+	FillRowScalar(outDst + i, inCount - i, inPixel);
+}
+
+void PremultiplyRowNEON(uint32_t *ioData, uint32_t inCount)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= inCount; i += 16)
+	{
+		uint8_t *d = reinterpret_cast<uint8_t *>(ioData + i);
+
+		uint8x16x4_t p = vld4q_u8(d);
+		for (int c = 0; c < 3; ++c)
+			p.val[c] = MulDiv255(p.val[c], p.val[3]);
+		vst4q_u8(d, p);
+	}
+
+	PremultiplyRowScalar(ioData + i, inCount - i);
+}
+
+void SwizzleRowNEON(uint32_t *outDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= inCount; i += 16)
+	{
+		uint8x16x4_t p = vld4q_u8(reinterpret_cast<const uint8_t *>(inSrc + i));
+		std::swap(p.val[0], p.val[2]);
+		vst4q_u8(reinterpret_cast<uint8_t *>(outDst + i), p);
+	}
+
+	SwizzleRowScalar(outDst + i, inSrc + i, inCount - i);
+}
+
+void OverRowNEON(uint32_t *ioDst, const uint32_t *inSrc, uint32_t inCount)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= inCount; i += 16)
+	{
+		uint8_t *dp = reinterpret_cast<uint8_t *>(ioDst + i);
+
+		uint8x16x4_t s = vld4q_u8(reinterpret_cast<const uint8_t *>(inSrc + i));
+		uint8x16x4_t d = vld4q_u8(dp);
+
+		uint8x16_t ia = vmvnq_u8(s.val[3]);
+		for (int c = 0; c < 4; ++c)
+			d.val[c] = vqaddq_u8(s.val[c], MulDiv255(d.val[c], ia));
+
+		vst4q_u8(dp, d);
+	}
+
+	OverRowScalar(ioDst + i, inSrc + i, inCount - i);
+}
+
+#endif
+
+// --------------------------------------------------------------------
+// The kernels to use are selected once, at first use
+
+struct MKernels
+{
+	void (*mFillRow)(uint32_t *, uint32_t, uint32_t);
+	void (*mPremultiplyRow)(uint32_t *, uint32_t);
+	void (*mUnpremultiplyRow)(uint32_t *, uint32_t);
+	void (*mSwizzleRow)(uint32_t *, const uint32_t *, uint32_t);
+	void (*mOverRow)(uint32_t *, const uint32_t *, uint32_t);
+};
+
+MKernels SelectKernels()
+{
+#if MBITMAPOPS_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return { FillRowAVX2, PremultiplyRowAVX2, UnpremultiplyRowAVX2, SwizzleRowAVX2, OverRowAVX2 };
+#endif
+
+#if MBITMAPOPS_SSE2
+	return { FillRowSSE2, PremultiplyRowSSE2, UnpremultiplyRowSSE2, SwizzleRowSSE2, OverRowSSE2 };
+#elif MBITMAPOPS_NEON
+	return { FillRowNEON, PremultiplyRowNEON, UnpremultiplyRowScalar, SwizzleRowNEON, OverRowNEON };
+#else
+	return { FillRowScalar, PremultiplyRowScalar, UnpremultiplyRowScalar, SwizzleRowScalar, OverRowScalar };
+#endif
+}
+
+const MKernels &Kernels()
+{
+	static const MKernels sKernels = SelectKernels();
+	return sKernels;
+}
+
+template <typename T>
+inline T *Row(T *inData, uint32_t inStride, uint32_t inY)
+{
+	using byte_type = std::conditional_t<std::is_const_v<T>, const uint8_t, uint8_t>;
+	return reinterpret_cast<T *>(reinterpret_cast<byte_type *>(inData) + size_t(inY) * inStride);
+}
+
+// Clip inSrcRect to the source bitmap and the destination position
+// to the destination bitmap.
+bool ClipBlit(const MBitmap &inDst, int32_t &ioX, int32_t &ioY, const MBitmap &inSrc, MRect &ioSrcRect)
+{
+	MRect r = ioSrcRect & MRect(0, 0, inSrc.Width(), inSrc.Height());
+
+	ioX += r.x - ioSrcRect.x;
+	ioY += r.y - ioSrcRect.y;
+
+	MRect d = MRect(ioX, ioY, r.width, r.height) & MRect(0, 0, inDst.Width(), inDst.Height());
+
+	r.x += d.x - ioX;
+	r.y += d.y - ioY;
+	r.width = d.width;
+	r.height = d.height;
+
+	ioX = d.x;
+	ioY = d.y;
+	ioSrcRect = r;
+
+	return r.width > 0 and r.height > 0;
+}
+
+} // namespace
+
+namespace MBitmapOps
+{
+
+uint32_t AlignedStride(uint32_t inWidth)
+{
+	return (inWidth * sizeof(uint32_t) + kRowAlignment - 1) & ~(kRowAlignment - 1);
+}
+
+uint32_t *AllocatePixels(uint32_t inStride, uint32_t inHeight)
+{
+	return static_cast<uint32_t *>(::operator new[](size_t(inStride) * inHeight, std::align_val_t(kRowAlignment)));
+}
+
+void FreePixels(uint32_t *inPixels)
+{
+	if (inPixels != nullptr)
+		::operator delete[](inPixels, std::align_val_t(kRowAlignment));
+}
+
+void Copy(uint32_t *outDst, uint32_t inDstStride, const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight)
+{
+	// memmove is already vectorised, the row order matters when
+	// copying inside one bitmap
+	size_t n = size_t(inWidth) * sizeof(uint32_t);
+
+	if (outDst > inSrc)
+	{
+		for (uint32_t y = inHeight; y-- > 0;)
+			std::memmove(Row(outDst, inDstStride, y), Row(inSrc, inSrcStride, y), n);
+	}
+	else
+	{
+		for (uint32_t y = 0; y < inHeight; ++y)
+			std::memmove(Row(outDst, inDstStride, y), Row(inSrc, inSrcStride, y), n);
+	}
+}
+
+void Fill(uint32_t *outDst, uint32_t inDstStride, uint32_t inWidth, uint32_t inHeight, uint32_t inPixel)
+{
+	auto fill = Kernels().mFillRow;
+	for (uint32_t y = 0; y < inHeight; ++y)
+		fill(Row(outDst, inDstStride, y), inWidth, inPixel);
+}
+
+void Premultiply(uint32_t *ioData, uint32_t inStride, uint32_t inWidth, uint32_t inHeight)
+{
+	auto premultiply = Kernels().mPremultiplyRow;
+	for (uint32_t y = 0; y < inHeight; ++y)
+		premultiply(Row(ioData, inStride, y), inWidth);
+}
+
+void Unpremultiply(uint32_t *ioData, uint32_t inStride, uint32_t inWidth, uint32_t inHeight)
+{
+	auto unpremultiply = Kernels().mUnpremultiplyRow;
+	for (uint32_t y = 0; y < inHeight; ++y)
+		unpremultiply(Row(ioData, inStride, y), inWidth);
+}
+
+void SwizzleARGBToRGBA(uint32_t *outDst, uint32_t inDstStride, const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight)
+{
+	auto swizzle = Kernels().mSwizzleRow;
+	for (uint32_t y = 0; y < inHeight; ++y)
+		swizzle(Row(outDst, inDstStride, y), Row(inSrc, inSrcStride, y), inWidth);
+}
+
+void CompositeOver(uint32_t *ioDst, uint32_t inDstStride, const uint32_t *inSrc, uint32_t inSrcStride,
+	uint32_t inWidth, uint32_t inHeight)
+{
+	auto over = Kernels().mOverRow;
+	for (uint32_t y = 0; y < inHeight; ++y)
+		over(Row(ioDst, inDstStride, y), Row(inSrc, inSrcStride, y), inWidth);
+}
+
+// --------------------------------------------------------------------
+
+void Copy(MBitmap &ioDst, int32_t inX, int32_t inY, const MBitmap &inSrc, MRect inSrcRect)
+{
+	if (ClipBlit(ioDst, inX, inY, inSrc, inSrcRect))
+	{
+		uint32_t *dst = Row(ioDst.Data(), ioDst.Stride(), inY) + inX;
+		const uint32_t *src = Row(inSrc.Data(), inSrc.Stride(), inSrcRect.y) + inSrcRect.x;
+
+		Copy(dst, ioDst.Stride(), src, inSrc.Stride(), inSrcRect.width, inSrcRect.height);
+	}
+}
+
+void Fill(MBitmap &ioDst, MRect inRect, uint32_t inPixel)
+{
+	inRect &= MRect(0, 0, ioDst.Width(), ioDst.Height());
+
+	if (inRect.width > 0 and inRect.height > 0)
+		Fill(Row(ioDst.Data(), ioDst.Stride(), inRect.y) + inRect.x, ioDst.Stride(), inRect.width, inRect.height, inPixel);
+}
+
+void CompositeOver(MBitmap &ioDst, int32_t inX, int32_t inY, const MBitmap &inSrc, MRect inSrcRect)
+{
+	if (ClipBlit(ioDst, inX, inY, inSrc, inSrcRect))
+	{
+		uint32_t *dst = Row(ioDst.Data(), ioDst.Stride(), inY) + inX;
+		const uint32_t *src = Row(inSrc.Data(), inSrc.Stride(), inSrcRect.y) + inSrcRect.x;
+
+		CompositeOver(dst, ioDst.Stride(), src, inSrc.Stride(), inSrcRect.width, inSrcRect.height);
+	}
+}
+
+} // namespace MBitmapOps
@@ -35,6 +35,11 @@ void MCanvasImpl::Invalidate()
 	mControl->MView::Invalidate();
 }
 
+void MCanvasImpl::Invalidate(MRect inRect)
+{
+	mControl->MView::Invalidate(inRect);
+}
+
 // --------------------------------------------------------------------
 
 MCanvas::MCanvas(const std::string &inID, MRect inBounds, MCanvasDropTypes inDropTypes)
@@ -45,7 +50,50 @@ MCanvas::MCanvas(const std::string &inID, MRect inBounds, MCanvasDropTypes inDro
 MCanvas::~MCanvas()
 {
 }
+
 void MCanvas::Invalidate()
 {
 	mImpl->Invalidate();
+}
+
+void MCanvas::Invalidate(MRect inRect)
+{
+	mImpl->Invalidate(inRect);
+}
+
+void MCanvas::InvalidateLayers()
+{
+	mImpl->InvalidateLayers();
+	mImpl->Invalidate();
+}
+
+void MCanvas::ScrollBits(int32_t inDeltaX, int32_t inDeltaY)
+{
+	mImpl->ScrollBits(GetBounds(), inDeltaX, inDeltaY);
+}
+
+void MCanvas::ScrollBits(MRect inRect, int32_t inDeltaX, int32_t inDeltaY)
+{
+	mImpl->ScrollBits(inRect, inDeltaX, inDeltaY);
+}
+
+void MCanvas::Draw(MRect inUpdate)
+{
+	Draw();
+}
+
+void MCanvas::SetTiled(bool inTiled, uint32_t inTileSize)
+{
+	mImpl->SetTiled(inTiled, inTileSize);
+	mImpl->Invalidate();
+}
+
+bool MCanvas::IsTiled() const
+{
+	return mImpl->IsTiled();
+}
+
+int32_t MCanvas::GetScaleFactor() const
+{
+	return mImpl->GetScaleFactor();
 }
\ No newline at end of file
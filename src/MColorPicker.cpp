@@ -25,11 +25,15 @@
  */
 
 #include "MColorPicker.hpp"
+#include "MBitmapOps.hpp"
 #include "MDevice.hpp"
 #include "MPreferences.hpp"
 #include "MUtils.hpp"
+#include "MWorkers.hpp"
 
+#include <algorithm>
 #include <regex>
+#include <utility>
 
 // --------------------------------------------------------------------
 
@@ -98,6 +102,154 @@ void MColorSwatch::OnPreviewColor(MColor inColor)
 	eColorPreview(mID, inColor);
 }
 
+// --------------------------------------------------------------------
+// Gradient kernels for the colour square and slider. The loops are
+// free of branches so the compiler can vectorise them, pixels are
+// converted the same way as MColor(float, float, float) does.
+
+namespace
+{
+
+inline uint32_t MakePixel(float inRed, float inGreen, float inBlue)
+{
+	return 0xff000000 |
+	       static_cast<uint32_t>(static_cast<uint8_t>(inRed * 255)) << 16 |
+	       static_cast<uint32_t>(static_cast<uint8_t>(inGreen * 255)) << 8 |
+	       static_cast<uint32_t>(static_cast<uint8_t>(inBlue * 255));
+}
+
+inline MColor PixelColor(uint32_t inPixel)
+{
+	return MColor(static_cast<uint8_t>(inPixel >> 16), static_cast<uint8_t>(inPixel >> 8), static_cast<uint8_t>(inPixel));
+}
+
+inline uint32_t ColorPixel(MColor inColor)
+{
+	return 0xff000000 | inColor.red << 16 | inColor.green << 8 | inColor.blue;
+}
+
+// One channel of hsv2rgb without the switch, n is 5 for red, 3 for
+// green and 1 for blue.
+inline float HSVChannel(float n, float h, float s, float v)
+{
+	float k = n + h * 6;
+	k = k >= 6 ? k - 6 : k;
+	return v - v * s * std::clamp(std::min(k, 4 - k), 0.f, 1.f);
+}
+
+// A row of pixels where each of the channels changes linearly with x,
+// either as r, g, b or as h, s, v.
+void RGBRow(uint32_t *outRow, int32_t inWidth, const float inStart[3], const float inDelta[3])
+{
+	for (int32_t x = 0; x < inWidth; ++x)
+		outRow[x] = MakePixel(inStart[0] + x * inDelta[0], inStart[1] + x * inDelta[1], inStart[2] + x * inDelta[2]);
+}
+
+void HSVRow(uint32_t *outRow, int32_t inWidth, const float inStart[3], const float inDelta[3])
+{
+	for (int32_t x = 0; x < inWidth; ++x)
+	{
+		float h = inStart[0] + x * inDelta[0];
+		float s = inStart[1] + x * inDelta[1];
+		float v = inStart[2] + x * inDelta[2];
+
+		h = h >= 1 or h < 0 ? 0 : h;
+
+		outRow[x] = MakePixel(HSVChannel(5, h, s, v), HSVChannel(3, h, s, v), HSVChannel(1, h, s, v));
+	}
+}
+
+// Call inFunc for each row, large bitmaps are split in bands that
+// are processed in parallel by the shared worker pool.
+template <typename F>
+void ForEachRow(int32_t inWidth, int32_t inHeight, F &&inFunc)
+{
+	const int32_t kMinPixelsPerBand = 64 * 1024;
+
+	auto &workers = MWorkers::Instance();
+	int32_t bands = std::min<int32_t>(workers.GetConcurrency(), inWidth * inHeight / kMinPixelsPerBand);
+
+	if (bands <= 1)
+	{
+		for (int32_t y = 0; y < inHeight; ++y)
+			inFunc(y);
+	}
+	else
+	{
+		workers.ParallelFor(bands, [bands, inHeight, &inFunc](uint32_t inBand)
+			{
+			int32_t band = static_cast<int32_t>(inBand);
+			for (int32_t y = band * inHeight / bands; y < (band + 1) * inHeight / bands; ++y)
+				inFunc(y); });
+	}
+}
+
+uint32_t *Row(MBitmap &inBitmap, int32_t inY)
+{
+	return reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(inBitmap.Data()) + inY * inBitmap.Stride());
+}
+
+const uint32_t *Row(const MBitmap &inBitmap, int32_t inY)
+{
+	return reinterpret_cast<const uint32_t *>(reinterpret_cast<const uint8_t *>(inBitmap.Data()) + inY * inBitmap.Stride());
+}
+
+} // namespace
+
+void RenderPickerGradient(MBitmap &ioBitmap, MPickerMode inMode, float inChannel)
+{
+	int32_t width = ioBitmap.Width(), height = ioBitmap.Height();
+	float dx = 1.f / width;
+
+	uint8_t *data = reinterpret_cast<uint8_t *>(ioBitmap.Data());
+	uint32_t stride = ioBitmap.Stride();
+
+	ForEachRow(width, height, [data, stride, inMode, inChannel, width, height, dx](int32_t y)
+		{
+		float fy = 1.f - float(y) / height;
+		uint32_t *row = reinterpret_cast<uint32_t *>(data + y * stride);
+
+		switch (inMode)
+		{
+			case ePickRGB:
+			{
+				float start[3] = { 0, fy, inChannel }, delta[3] = { dx, 0, 0 };
+				RGBRow(row, width, start, delta);
+				break;
+			}
+			case ePickBGR:
+			{
+				float start[3] = { inChannel, fy, 0 }, delta[3] = { 0, 0, dx };
+				RGBRow(row, width, start, delta);
+				break;
+			}
+			case ePickBRG:
+			{
+				float start[3] = { fy, inChannel, 0 }, delta[3] = { 0, 0, dx };
+				RGBRow(row, width, start, delta);
+				break;
+			}
+			case ePickSVH:
+			{
+				float start[3] = { inChannel, 0, fy }, delta[3] = { 0, dx, 0 };
+				HSVRow(row, width, start, delta);
+				break;
+			}
+			case ePickHVS:
+			{
+				float start[3] = { 0, inChannel, fy }, delta[3] = { dx, 0, 0 };
+				HSVRow(row, width, start, delta);
+				break;
+			}
+			case ePickHSV:
+			{
+				float start[3] = { 0, fy, inChannel }, delta[3] = { dx, 0, 0 };
+				HSVRow(row, width, start, delta);
+				break;
+			}
+		} });
+}
+
 // --------------------------------------------------------------------
 
 class MColorSquare : public MCanvas
@@ -124,8 +276,16 @@ class MColorSquare : public MCanvas
 	void PointerMotion(int32_t inX, int32_t inY, uint32_t inModifiers) override;
 
   private:
+	void UpdateGradient(MPickerMode inMode, float inChannel, int32_t inWidth, int32_t inHeight, int32_t inScale);
+
 	bool mMouseDown;
 	MColorPicker &mPicker;
+
+	// the gradient depends only on the mode and the channel shown
+	// in the slider, it is kept until one of those changes.
+	MBitmap mGradient;
+	MPickerMode mGradientMode = ePickSVH;
+	float mGradientChannel = -1;
 };
 
 MColorSquare::MColorSquare(const std::string &inID, MRect inBounds, MColorPicker &inPicker)
@@ -144,15 +304,9 @@ void MColorSquare::Draw()
 
 	MRect bounds = GetBounds();
 
-	dev.EraseRect(bounds);
-
-	MBitmap bitmap(bounds.width, bounds.height);
-
-	char *data = reinterpret_cast<char *>(bitmap.Data());
-
 	MPickerMode mode = mPicker.GetMode();
 
-	float r = 0, g = 0, b = 0, h = 0, s = 0, v = 0, sfx = 0, sfy = 0;
+	float r = 0, g = 0, b = 0, h = 0, s = 0, v = 0, sfx = 0, sfy = 0, channel = 0;
 
 	switch (mode)
 	{
@@ -160,87 +314,100 @@ void MColorSquare::Draw()
 			mPicker.GetRGB(r, g, b);
 			sfx = r;
 			sfy = 1.f - g;
+			channel = b;
 			break;
 		case ePickBGR:
 			mPicker.GetRGB(r, g, b);
 			sfx = b;
 			sfy = 1.f - g;
+			channel = r;
 			break;
 		case ePickBRG:
 			mPicker.GetRGB(r, g, b);
 			sfx = b;
 			sfy = 1.f - r;
+			channel = g;
 			break;
 		case ePickSVH:
 			mPicker.GetHSV(h, s, v);
 			sfx = s;
 			sfy = 1.f - v;
+			channel = h;
 			break;
 		case ePickHVS:
 			mPicker.GetHSV(h, s, v);
 			sfx = h;
 			sfy = 1.f - v;
+			channel = s;
 			break;
 		case ePickHSV:
 			mPicker.GetHSV(h, s, v);
 			sfx = h;
 			sfy = 1.f - s;
+			channel = v;
 			break;
 	}
 
+	if (bounds.width <= 0 or bounds.height <= 0)
+		return;
+
+	// the bitmaps have one pixel per device pixel
+	int32_t scale = GetScaleFactor();
+
+	UpdateGradient(mode, channel, bounds.width, bounds.height, scale);
+
+	mGradient.SetScale(scale);
+	dev.DrawBitmap(mGradient, 0, 0);
+
+	// The marker is drawn on top, in colours distinct from the gradient
+
 	int32_t sx = static_cast<int32_t>(sfx * bounds.width);
 	int32_t sy = static_cast<int32_t>(sfy * bounds.height);
 
-	for (int32_t y = 0; y < bounds.height; ++y)
-	{
-		uint8_t *row = reinterpret_cast<uint8_t *>(data + y * bitmap.Stride());
+	MBitmap marker(5 * scale, 5 * scale, true);
+	marker.SetScale(scale);
+	MBitmapOps::Fill(marker, MRect(0, 0, 5 * scale, 5 * scale), 0);
 
-		switch (mode)
+	for (int32_t d = -2; d <= 2; ++d)
+	{
+		for (auto [x, y] : { std::make_pair(sx + d, sy), std::make_pair(sx, sy + d) })
 		{
-			case ePickRGB:
-			case ePickBGR: g = 1.f - (float(y) / bounds.height); break;
-			case ePickBRG: r = 1.f - (float(y) / bounds.height); break;
-			case ePickSVH:
-			case ePickHVS: v = 1.f - (float(y) / bounds.height); break;
-			case ePickHSV: s = 1.f - (float(y) / bounds.height); break;
-		}
+			if (x < 0 or x >= bounds.width or y < 0 or y >= bounds.height)
+				continue;
 
-		for (int32_t x = 0; x < bounds.width; ++x)
-		{
-			switch (mode)
-			{
-				case ePickRGB: r = float(x) / bounds.width; break;
-				case ePickBGR:
-				case ePickBRG: b = float(x) / bounds.width; break;
-				case ePickSVH:
-					s = float(x) / bounds.width;
-					hsv2rgb(h, s, v, r, g, b);
-					break;
-				case ePickHVS:
-				case ePickHSV:
-					h = float(x) / bounds.width;
-					hsv2rgb(h, s, v, r, g, b);
-					break;
-			}
+			MColor c = PixelColor(Row(std::as_const(mGradient), y * scale)[x * scale]);
 
-			MColor c(r, g, b);
-			if ((x == sx and abs(y - sy) < 3) or
-				(y == sy and abs(x - sx) < 3))
-			{
-				if ((y - sy) & 1 or (x - sx) & 1)
-					c = kBlack.Distinct(c);
-				else
-					c = kWhite.Distinct(c);
-			}
+			if (d & 1)
+				c = kBlack.Distinct(c);
+			else
+				c = kWhite.Distinct(c);
 
-			*row++ = c.blue;
-			*row++ = c.green;
-			*row++ = c.red;
-			*row++ = 255;
+			MBitmapOps::Fill(marker, MRect((x - sx + 2) * scale, (y - sy + 2) * scale, scale, scale), ColorPixel(c));
 		}
 	}
 
-	dev.DrawBitmap(bitmap, 0, 0);
+	dev.DrawBitmap(marker, sx - 2, sy - 2);
+}
+
+void MColorSquare::UpdateGradient(MPickerMode inMode, float inChannel, int32_t inWidth, int32_t inHeight, int32_t inScale)
+{
+	// the size in pixels
+	inWidth *= inScale;
+	inHeight *= inScale;
+
+	if (mGradientMode == inMode and mGradientChannel == inChannel and
+		mGradient.Width() == static_cast<uint32_t>(inWidth) and mGradient.Height() == static_cast<uint32_t>(inHeight))
+	{
+		return;
+	}
+
+	if (mGradient.Width() != static_cast<uint32_t>(inWidth) or mGradient.Height() != static_cast<uint32_t>(inHeight))
+		mGradient = MBitmap(inWidth, inHeight);
+
+	mGradientMode = inMode;
+	mGradientChannel = inChannel;
+
+	RenderPickerGradient(mGradient, inMode, inChannel);
 }
 
 void MColorSquare::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount, uint32_t inModifiers)
@@ -313,6 +480,12 @@ class MColorSlider : public MCanvas
   private:
 	bool mMouseDown;
 	MColorPicker &mPicker;
+
+	// the gradient depends on the mode and the two channels shown
+	// in the square, it is kept until one of those changes.
+	MBitmap mGradient;
+	MPickerMode mGradientMode = ePickSVH;
+	float mGradientChannels[2] = { -1, -1 };
 };
 
 MColorSlider::MColorSlider(const std::string &inID, MRect inBounds, MColorPicker &inPicker)
@@ -331,88 +504,114 @@ void MColorSlider::Draw()
 
 	MRect bounds = GetBounds();
 
-	dev.EraseRect(bounds);
-
-	MBitmap bitmap(bounds.width, bounds.height);
-
-	uint8_t *data = reinterpret_cast<uint8_t *>(bitmap.Data());
-
 	MPickerMode mode = mPicker.GetMode();
 
 	float r = 0, g = 0, b = 0, h = 0, s = 0, v = 0;
 	int32_t sy = 0;
+	float channels[2] = {};
 
 	switch (mode)
 	{
 		case ePickRGB:
 			mPicker.GetRGB(r, g, b);
 			sy = static_cast<int32_t>((1.f - b) * bounds.height);
+			channels[0] = r;
+			channels[1] = g;
 			break;
 		case ePickBGR:
 			mPicker.GetRGB(r, g, b);
 			sy = static_cast<int32_t>((1.f - r) * bounds.height);
+			channels[0] = g;
+			channels[1] = b;
 			break;
 		case ePickBRG:
 			mPicker.GetRGB(r, g, b);
 			sy = static_cast<int32_t>((1.f - g) * bounds.height);
+			channels[0] = r;
+			channels[1] = b;
 			break;
 		case ePickSVH:
 			mPicker.GetHSV(h, s, v);
 			sy = static_cast<int32_t>(h * bounds.height);
+			channels[0] = s;
+			channels[1] = v;
 			break;
 		case ePickHVS:
 			mPicker.GetHSV(h, s, v);
 			sy = static_cast<int32_t>((1.f - s) * bounds.height);
+			channels[0] = h;
+			channels[1] = v;
 			break;
 		case ePickHSV:
 			mPicker.GetHSV(h, s, v);
 			sy = static_cast<int32_t>((1.f - v) * bounds.height);
+			channels[0] = h;
+			channels[1] = s;
 			break;
 	}
 
-	for (int32_t y = 0; y < bounds.height; ++y)
+	if (bounds.width <= 0 or bounds.height <= 0)
+		return;
+
+	// the bitmaps have one pixel per device pixel
+	int32_t scale = GetScaleFactor();
+	int32_t width = bounds.width * scale, height = bounds.height * scale;
+
+	if (mGradientMode != mode or mGradientChannels[0] != channels[0] or mGradientChannels[1] != channels[1] or
+		mGradient.Width() != static_cast<uint32_t>(width) or mGradient.Height() != static_cast<uint32_t>(height))
 	{
-		uint8_t *row = reinterpret_cast<uint8_t *>(data + y * bitmap.Stride());
+		if (mGradient.Width() != static_cast<uint32_t>(width) or mGradient.Height() != static_cast<uint32_t>(height))
+			mGradient = MBitmap(width, height);
 
-		switch (mode)
-		{
-			case ePickRGB: b = 1.f - float(y) / bounds.height; break;
-			case ePickBGR: r = 1.f - float(y) / bounds.height; break;
-			case ePickBRG: g = 1.f - float(y) / bounds.height; break;
-			case ePickSVH:
-				h = float(y) / bounds.height;
-				hsv2rgb(h, s, v, r, g, b);
-				break;
-			case ePickHVS:
-				s = 1.f - float(y) / bounds.height;
-				hsv2rgb(h, s, v, r, g, b);
-				break;
-			case ePickHSV:
-				v = 1.f - float(y) / bounds.height;
-				hsv2rgb(h, s, v, r, g, b);
-				break;
-		}
+		mGradientMode = mode;
+		mGradientChannels[0] = channels[0];
+		mGradientChannels[1] = channels[1];
 
-		for (int32_t x = 0; x < bounds.width; ++x)
-		{
-			MColor c(r, g, b);
+		// each row has one colour
 
-			if (y == sy)
+		for (int32_t y = 0; y < height; ++y)
+		{
+			switch (mode)
 			{
-				if (x & 1)
-					c = kBlack.Distinct(c);
-				else
-					c = kWhite.Distinct(c);
+				case ePickRGB: b = 1.f - float(y) / height; break;
+				case ePickBGR: r = 1.f - float(y) / height; break;
+				case ePickBRG: g = 1.f - float(y) / height; break;
+				case ePickSVH:
+					h = float(y) / height;
+					hsv2rgb(h, s, v, r, g, b);
+					break;
+				case ePickHVS:
+					s = 1.f - float(y) / height;
+					hsv2rgb(h, s, v, r, g, b);
+					break;
+				case ePickHSV:
+					v = 1.f - float(y) / height;
+					hsv2rgb(h, s, v, r, g, b);
+					break;
 			}
 
-			*row++ = c.blue;
-			*row++ = c.green;
-			*row++ = c.red;
-			*row++ = 255;
+			MBitmapOps::Fill(Row(mGradient, y), mGradient.Stride(), width, 1, MakePixel(r, g, b));
 		}
 	}
 
-	dev.DrawBitmap(bitmap, 0, 0);
+	mGradient.SetScale(scale);
+	dev.DrawBitmap(mGradient, 0, 0);
+
+	// The marker is drawn on top, in colours distinct from the gradient
+
+	if (sy >= 0 and sy < bounds.height)
+	{
+		MColor c = PixelColor(Row(std::as_const(mGradient), sy * scale)[0]);
+		uint32_t c1 = ColorPixel(kWhite.Distinct(c)), c2 = ColorPixel(kBlack.Distinct(c));
+
+		MBitmap marker(width, scale);
+		marker.SetScale(scale);
+
+		for (int32_t x = 0; x < bounds.width; ++x)
+			MBitmapOps::Fill(marker, MRect(x * scale, 0, scale, scale), x & 1 ? c2 : c1);
+
+		dev.DrawBitmap(marker, 0, sy);
+	}
 }
 
 void MColorSlider::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount, uint32_t inModifiers)
@@ -25,17 +25,24 @@
  */
 
 #include "MDevice.hpp"
+#include "MBitmapOps.hpp"
 #include "MDeviceImpl.hpp"
 #include "MError.hpp"
 #include "MUnicode.hpp"
 #include "MView.hpp"
 #include "MWindow.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
 // -------------------------------------------------------------------
 
+MGeometry::MGeometry(MGeometryFillMode inMode)
+	: mImpl(MGeometryImpl::Create(inMode))
+{
+}
+
 MGeometry::MGeometry(MDevice &inDevice, MGeometryFillMode inMode)
 	: mImpl(MGeometryImpl::Create(inDevice, inMode))
 {
@@ -87,22 +94,39 @@ MBitmap::MBitmap(MBitmap &&inBitmap)
 	inBitmap.mHeight = 0;
 	mStride = inBitmap.mStride;
 	inBitmap.mStride = 0;
+	mScale = inBitmap.mScale;
+	inBitmap.mScale = 1;
 	mUseAlpha = inBitmap.mUseAlpha;
 	inBitmap.mUseAlpha = false;
+	mDirty = inBitmap.mDirty.load();
+	mImpl = inBitmap.mImpl;
+	inBitmap.mImpl = nullptr;
 }
 
 MBitmap &MBitmap::operator=(MBitmap &&inBitmap)
 {
-	mData = inBitmap.mData;
-	inBitmap.mData = nullptr;
-	mWidth = inBitmap.mWidth;
-	inBitmap.mWidth = 0;
-	mHeight = inBitmap.mHeight;
-	inBitmap.mHeight = 0;
-	mStride = inBitmap.mStride;
-	inBitmap.mStride = 0;
-	mUseAlpha = inBitmap.mUseAlpha;
-	inBitmap.mUseAlpha = false;
+	if (this != &inBitmap)
+	{
+		delete mImpl;
+		MBitmapOps::FreePixels(mData);
+
+		mData = inBitmap.mData;
+		inBitmap.mData = nullptr;
+		mWidth = inBitmap.mWidth;
+		inBitmap.mWidth = 0;
+		mHeight = inBitmap.mHeight;
+		inBitmap.mHeight = 0;
+		mStride = inBitmap.mStride;
+		inBitmap.mStride = 0;
+		mScale = inBitmap.mScale;
+		inBitmap.mScale = 1;
+		mUseAlpha = inBitmap.mUseAlpha;
+		inBitmap.mUseAlpha = false;
+		mDirty = inBitmap.mDirty.load();
+		mImpl = inBitmap.mImpl;
+		inBitmap.mImpl = nullptr;
+	}
+
 	return *this;
 }
 
@@ -110,39 +134,70 @@ MBitmap::MBitmap(uint32_t inWidth, uint32_t inHeight, bool inUseAlpha)
 	: mData(nullptr)
 	, mWidth(inWidth)
 	, mHeight(inHeight)
-	, mStride(inWidth * sizeof(uint32_t))
+	, mStride(MBitmapOps::AlignedStride(inWidth))
 	, mUseAlpha(inUseAlpha)
 {
-	mData = new uint32_t[inWidth * inHeight];
+	mData = MBitmapOps::AllocatePixels(mStride, mHeight);
 }
 
 MBitmap::MBitmap(const MBitmap &inSource, MRect inCopyRect)
 	: mData(nullptr)
 	, mWidth(inCopyRect.width)
 	, mHeight(inCopyRect.height)
-	, mStride(mWidth * sizeof(uint32_t))
+	, mStride(MBitmapOps::AlignedStride(mWidth))
+	, mScale(inSource.mScale)
 	, mUseAlpha(inSource.mUseAlpha)
 {
-	mData = new uint32_t[mWidth * mHeight];
+	mData = MBitmapOps::AllocatePixels(mStride, mHeight);
 
-	if (inCopyRect.x + inCopyRect.width <= static_cast<int32_t>(inSource.mWidth) and
-		inCopyRect.y + inCopyRect.height <= static_cast<int32_t>(inSource.mHeight))
-	{
-		for (uint32_t y = 0; y < mHeight; ++y)
-		{
-			uint32_t sy = y + inCopyRect.y;
-			for (uint32_t x = 0; x < mWidth; ++x)
-			{
-				uint32_t sx = x + inCopyRect.x;
-				mData[y * mWidth + x] = inSource.mData[sy * inSource.mWidth + sx];
-			}
-		}
-	}
+	// the part of inCopyRect outside inSource is left transparent
+	MBitmapOps::Fill(mData, mStride, mWidth, mHeight, 0);
+	MBitmapOps::Copy(*this, 0, 0, inSource, inCopyRect);
 }
 
 MBitmap::~MBitmap()
 {
-	delete[] mData;
+	delete mImpl;
+	MBitmapOps::FreePixels(mData);
+}
+
+void MBitmap::SetScale(uint32_t inScale)
+{
+	std::unique_lock lock(mImplMutex);
+
+	mScale = std::max(inScale, 1U);
+	if (mImpl != nullptr)
+		mImpl->SetScale(mScale);
+}
+
+MBitmapImpl *MBitmap::GetImpl() const
+{
+	if (mData == nullptr)
+		return nullptr;
+
+	std::unique_lock lock(mImplMutex);
+
+	// clear the flag first, pixels written from now on mark it again
+	bool dirty = mDirty.exchange(false);
+
+	if (mImpl == nullptr)
+		mImpl = MBitmapImpl::Create(*this);
+	else if (dirty)
+		mImpl->MarkDirty();
+
+	return mImpl;
+}
+
+// -------------------------------------------------------------------
+
+MFont::MFont(const std::string &inFont)
+	: mImpl(MFontImpl::Intern(inFont))
+{
+}
+
+std::string MFont::GetDescription() const
+{
+	return mImpl != nullptr ? mImpl->mName : std::string{};
 }
 
 // -------------------------------------------------------------------
@@ -152,19 +207,21 @@ MDevice::MDevice()
 {
 }
 
-// MDevice::MDevice(
-// 	MView*		inView,
-// 	MRect		inRect,
-// 	bool		inCreateOffscreen)
-// 	: mImpl(MDeviceImpl::Create(inView, inRect, inCreateOffscreen))
-// {
-// }
-
 MDevice::MDevice(MView *inView)
 	: mImpl(MDeviceImpl::Create(inView))
 {
 }
 
+MDevice::MDevice(MView *inView, MRect inRect, bool inCreateOffscreen)
+	: mImpl(MDeviceImpl::Create(inView, inRect, inCreateOffscreen))
+{
+}
+
+MDevice::MDevice(MBitmap &inBitmap)
+	: mImpl(MDeviceImpl::Create(inBitmap))
+{
+}
+
 MDevice::~MDevice()
 {
 	delete mImpl;
@@ -199,11 +256,22 @@ MRect MDevice::GetBounds() const
 	return mImpl->GetBounds();
 }
 
+bool MDevice::IsOffscreenValid() const
+{
+	return mImpl->IsOffscreenValid();
+}
+
 void MDevice::SetFont(const std::string &inFont)
 {
 	mImpl->SetFont(inFont);
 }
 
+void MDevice::SetFont(MFont inFont)
+{
+	if (inFont)
+		mImpl->SetFont(inFont.GetImpl());
+}
+
 void MDevice::SetForeColor(MColor inColor)
 {
 	mImpl->SetForeColor(inColor);
@@ -229,11 +297,10 @@ void MDevice::ClipRect(MRect inRect)
 	mImpl->ClipRect(inRect);
 }
 
-// void MDevice::ClipRegion(
-//	MRegion		inRegion)
-//{
-//	mImpl->ClipRegion(inRegion);
-// }
+void MDevice::ClipRegion(const MRegion &inRegion)
+{
+	mImpl->ClipRegion(inRegion);
+}
 
 void MDevice::EraseRect(MRect inRect)
 {
@@ -305,6 +372,16 @@ float MDevice::GetXWidth() const
 	return mImpl->GetXWidth();
 }
 
+uint32_t MDevice::GetStringWidth(const std::string &inText) const
+{
+	return mImpl->GetStringWidth(inText);
+}
+
+float MDevice::GetStringAdvance(std::string_view inText) const
+{
+	return mImpl->GetStringAdvance(inText);
+}
+
 void MDevice::DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth, MAlignment inAlign)
 {
 	mImpl->DrawString(inText, inX, inY, inTruncateWidth, inAlign);
@@ -315,6 +392,21 @@ void MDevice::DrawString(const std::string &inText, MRect inBounds, MAlignment i
 	mImpl->DrawString(inText, inBounds, inAlign);
 }
 
+void MDevice::DrawStrings(std::span<const MStringItem> inStrings)
+{
+	mImpl->DrawStrings(inStrings);
+}
+
+void MDevice::GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns) const
+{
+	mImpl->GetGlyphRuns(inStrings, outRuns);
+}
+
+void MDevice::DrawGlyphRuns(std::span<const MGlyphRun> inRuns)
+{
+	mImpl->DrawGlyphRuns(inRuns);
+}
+
 void MDevice::SetText(const std::string &inText)
 {
 	mImpl->SetText(inText);
@@ -335,6 +427,11 @@ void MDevice::SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t
 	mImpl->SetTextStyles(inStyleCount, inStyles, inOffsets);
 }
 
+void MDevice::SetTextRuns(std::span<const MTextRun> inRuns)
+{
+	mImpl->SetTextRuns(inRuns);
+}
+
 void MDevice::RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor)
 {
 	mImpl->RenderTextBackground(inX, inY, inStart, inLength, inColor);
@@ -0,0 +1,1072 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MDisplayList.hpp"
+#include "MDeviceImpl.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stack>
+#include <type_traits>
+#include <utility>
+
+namespace
+{
+
+// --------------------------------------------------------------------
+// The commands, each starts with an MCommand header followed by its
+// arguments and optionally a variable length payload.
+
+enum class MOp : uint16_t
+{
+	Save,
+	Restore,
+	SetOrigin,
+	SetFont,
+	SetForeColor,
+	SetBackColor,
+	ClipRect,
+	ClipRegion,
+	EraseRect,
+	FillRect,
+	StrokeRect,
+	StrokeLine,
+	FillEllipse,
+	StrokeGeometry,
+	FillGeometry,
+	DrawBitmap,
+	CreateAndUsePattern,
+	DrawString,
+	DrawStringInRect,
+	DrawStrings,
+	DrawGlyphRuns,
+	SetText,
+	SetTabStops,
+	SetTextColors,
+	SetTextStyles,
+	SetTextRuns,
+	RenderTextBackground,
+	SetTextSelection,
+	SetDrawWhiteSpace,
+	SetReplaceUnknownCharacters,
+	RenderText,
+	DrawCaret,
+	SetScale,
+	MakeTransparent,
+	DrawListItemBackground
+};
+
+constexpr size_t kAlignment = 8;
+
+constexpr size_t Align(size_t inSize)
+{
+	return (inSize + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+struct MCommand
+{
+	MOp mOp;
+	bool mHasBounds;
+	uint32_t mSize; // including the payload
+	MRect mBounds;  // in the coordinates of the recording
+};
+
+// the payload of a command starts right after its arguments
+template <typename T, typename C>
+auto Payload(C *inCommand, size_t inOffset = 0)
+{
+	using B = std::conditional_t<std::is_const_v<C>, const std::byte, std::byte>;
+	using R = std::conditional_t<std::is_const_v<C>, const T, T>;
+	return reinterpret_cast<R *>(reinterpret_cast<B *>(inCommand) + Align(sizeof(C)) + inOffset);
+}
+
+struct MColorCmd : MCommand
+{
+	MColor mColor;
+};
+
+struct MFontCmd : MCommand
+{
+	const MFontImpl *mFont;
+};
+
+// ClipRect, EraseRect, FillRect, StrokeRect, FillEllipse and DrawListItemBackground
+struct MRectCmd : MCommand
+{
+	MRect mRect;
+	uint32_t mValue;
+};
+
+// followed by mCount MRects
+struct MRegionCmd : MCommand
+{
+	uint32_t mCount;
+};
+
+struct MLineCmd : MCommand
+{
+	float mFromX, mFromY, mToX, mToY;
+	uint32_t mLineWidth;
+};
+
+struct MGeometryCmd : MCommand
+{
+	MGeometryImpl *mGeometry;
+	float mLineWidth;
+};
+
+struct MBitmapCmd : MCommand
+{
+	const MBitmap *mBitmap;
+	float mX, mY;
+};
+
+struct MPatternCmd : MCommand
+{
+	MColor mColor1, mColor2;
+	uint32_t mWidth;
+	float mRotation;
+};
+
+// DrawString, DrawStringInRect and SetText, followed by mLength chars
+struct MStringCmd : MCommand
+{
+	float mX, mY;
+	uint32_t mTruncateWidth;
+	MAlignment mAlign;
+	MRect mRect;
+	uint32_t mLength;
+};
+
+// followed by mCount MItems and then the text of all items
+struct MStringsCmd : MCommand
+{
+	struct MItem
+	{
+		float mX, mY;
+		uint32_t mOffset, mLength;
+	};
+
+	uint32_t mCount;
+};
+
+// followed by mCount runs, each an MRun followed by its glyphs
+struct MGlyphRunsCmd : MCommand
+{
+	struct MRun
+	{
+		const MFontImpl *mFont;
+		MColor mColor;
+		uint32_t mGlyphCount;
+	};
+
+	uint32_t mCount;
+};
+
+// SetTextColors and SetTextStyles, followed by mCount values,
+// mCount offsets and mColorCount colours
+struct MTextRunsCmd : MCommand
+{
+	uint32_t mCount, mColorCount;
+};
+
+// followed by mCount MTextRuns
+struct MRunsCmd : MCommand
+{
+	uint32_t mCount;
+};
+
+// all the commands with only a few simple arguments
+struct MArgsCmd : MCommand
+{
+	float mF[4];
+	uint32_t mU[3];
+	MColor mColor;
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+// MRecordingDeviceImpl stores all drawing commands in an MDisplayList.
+// Text is measured by a regular device that gets the same font and
+// text layout settings.
+
+class MRecordingDeviceImpl : public MDeviceImpl
+{
+  public:
+	MRecordingDeviceImpl(MDisplayList &ioList, MRect inBounds)
+		: mList(ioList)
+		, mBounds(inBounds)
+		, mMeasure(MDeviceImpl::Create())
+	{
+		mState.push({ 0, 0, false });
+	}
+
+	virtual void Save()
+	{
+		Add<MCommand>(MOp::Save);
+		mState.push(mState.top());
+		mMeasure->Save();
+	}
+
+	virtual void Restore()
+	{
+		Add<MCommand>(MOp::Restore);
+		if (mState.size() > 1)
+			mState.pop();
+		mMeasure->Restore();
+	}
+
+	virtual MRect GetBounds() const { return mBounds; }
+
+	virtual void SetOrigin(int32_t inX, int32_t inY)
+	{
+		auto c = Add<MArgsCmd>(MOp::SetOrigin);
+		c->mU[0] = inX;
+		c->mU[1] = inY;
+
+		mState.top().mX += inX;
+		mState.top().mY += inY;
+	}
+
+	virtual void SetFont(const std::string &inFont)
+	{
+		SetFont(MFontImpl::Intern(inFont));
+	}
+
+	virtual void SetFont(const MFontImpl *inFont)
+	{
+		if (inFont == nullptr)
+			return;
+
+		Add<MFontCmd>(MOp::SetFont)->mFont = inFont;
+		mMeasure->SetFont(inFont);
+	}
+
+	virtual void SetForeColor(MColor inColor)
+	{
+		Add<MColorCmd>(MOp::SetForeColor)->mColor = inColor;
+		mForeColor = inColor;
+	}
+
+	virtual MColor GetForeColor() const { return mForeColor; }
+
+	virtual void SetBackColor(MColor inColor)
+	{
+		Add<MColorCmd>(MOp::SetBackColor)->mColor = inColor;
+		mBackColor = inColor;
+	}
+
+	virtual MColor GetBackColor() const { return mBackColor; }
+
+	virtual void ClipRect(MRect inRect)
+	{
+		AddRect(MOp::ClipRect, inRect, 0, false);
+	}
+
+	virtual void ClipRegion(const MRegion &inRegion)
+	{
+		auto rects = inRegion.GetRects();
+
+		auto c = Add<MRegionCmd>(MOp::ClipRegion, rects.size() * sizeof(MRect));
+		c->mCount = rects.size();
+		std::uninitialized_copy(rects.begin(), rects.end(), Payload<MRect>(c));
+	}
+
+	virtual void EraseRect(MRect inRect) { AddRect(MOp::EraseRect, inRect, 0, true); }
+	virtual void FillRect(MRect inRect) { AddRect(MOp::FillRect, inRect, 0, true); }
+
+	virtual void StrokeRect(MRect inRect, uint32_t inLineWidth)
+	{
+		auto c = AddRect(MOp::StrokeRect, inRect, inLineWidth, false);
+		MRect r = inRect;
+		r.InsetBy(-static_cast<int32_t>(inLineWidth), -static_cast<int32_t>(inLineWidth));
+		SetBounds(c, r);
+	}
+
+	virtual void StrokeLine(float inFromX, float inFromY, float inToX, float inToY, uint32_t inLineWidth)
+	{
+		auto c = Add<MLineCmd>(MOp::StrokeLine);
+		c->mFromX = inFromX;
+		c->mFromY = inFromY;
+		c->mToX = inToX;
+		c->mToY = inToY;
+		c->mLineWidth = inLineWidth;
+
+		SetBounds(c, inFromX, inFromY, inToX, inToY, inLineWidth);
+	}
+
+	virtual void FillEllipse(MRect inRect) { AddRect(MOp::FillEllipse, inRect, 0, true); }
+
+	virtual void StrokeGeometry(MGeometryImpl &inGeometry, float inLineWidth)
+	{
+		AddGeometry(MOp::StrokeGeometry, inGeometry, inLineWidth);
+	}
+
+	virtual void FillGeometry(MGeometryImpl &inGeometry)
+	{
+		AddGeometry(MOp::FillGeometry, inGeometry, 0);
+	}
+
+	virtual void DrawBitmap(const MBitmap &inBitmap, float inX, float inY)
+	{
+		MRect r(0, 0, inBitmap.Width(), inBitmap.Height());
+		mList.mBitmaps.emplace_back(new MBitmap(inBitmap, r));
+
+		auto c = Add<MBitmapCmd>(MOp::DrawBitmap);
+		c->mBitmap = mList.mBitmaps.back().get();
+		c->mX = inX;
+		c->mY = inY;
+
+		// the bounds are in units, not pixels
+		float scale = inBitmap.GetScale();
+		SetBounds(c, inX, inY, inX + r.width / scale, inY + r.height / scale, 1);
+	}
+
+	virtual void CreateAndUsePattern(MColor inColor1, MColor inColor2, uint32_t inWidth, float inRotation)
+	{
+		auto c = Add<MPatternCmd>(MOp::CreateAndUsePattern);
+		c->mColor1 = inColor1;
+		c->mColor2 = inColor2;
+		c->mWidth = inWidth;
+		c->mRotation = inRotation;
+	}
+
+	virtual float GetAscent() { return mMeasure->GetAscent(); }
+	virtual float GetDescent() { return mMeasure->GetDescent(); }
+	virtual float GetLeading() { return mMeasure->GetLeading(); }
+	virtual int32_t GetLineHeight() { return mMeasure->GetLineHeight(); }
+	virtual float GetXWidth() { return mMeasure->GetXWidth(); }
+
+	virtual void DrawString(const std::string &inText, float inX, float inY, uint32_t inTruncateWidth, MAlignment inAlign)
+	{
+		auto c = AddString(MOp::DrawString, inText);
+		c->mX = inX;
+		c->mY = inY;
+		c->mTruncateWidth = inTruncateWidth;
+		c->mAlign = inAlign;
+
+		SetTextBounds(c, inX, inY, inTruncateWidth != 0 ? inTruncateWidth : mMeasure->GetStringWidth(inText));
+	}
+
+	virtual void DrawString(const std::string &inText, MRect inBounds, MAlignment inAlign)
+	{
+		auto c = AddString(MOp::DrawStringInRect, inText);
+		c->mRect = inBounds;
+		c->mAlign = inAlign;
+
+		SetTextBounds(c, inBounds.x, inBounds.y, inBounds.width);
+	}
+
+	virtual uint32_t GetStringWidth(const std::string &inText) { return mMeasure->GetStringWidth(inText); }
+	virtual float GetStringAdvance(std::string_view inText) { return mMeasure->GetStringAdvance(inText); }
+
+	virtual void DrawStrings(std::span<const MStringItem> inStrings)
+	{
+		using MItem = MStringsCmd::MItem;
+
+		size_t textLength = 0;
+		for (auto &s : inStrings)
+			textLength += s.mText.length();
+
+		auto c = Add<MStringsCmd>(MOp::DrawStrings, inStrings.size() * sizeof(MItem) + textLength);
+		c->mCount = inStrings.size();
+
+		MItem *items = Payload<MItem>(c);
+		char *text = Payload<char>(c, inStrings.size() * sizeof(MItem));
+
+		float minX = 0, minY = 0, maxX = 0, maxY = 0;
+		uint32_t offset = 0;
+
+		for (size_t i = 0; i < inStrings.size(); ++i)
+		{
+			auto &s = inStrings[i];
+
+			new (items + i) MItem{ s.mX, s.mY, offset, static_cast<uint32_t>(s.mText.length()) };
+			std::memcpy(text + offset, s.mText.data(), s.mText.length());
+			offset += s.mText.length();
+
+			float width = mMeasure->GetStringWidth(std::string{ s.mText });
+
+			if (i == 0)
+			{
+				minX = s.mX;
+				minY = s.mY;
+				maxX = s.mX + width;
+				maxY = s.mY;
+			}
+			else
+			{
+				minX = std::min(minX, s.mX);
+				minY = std::min(minY, s.mY);
+				maxX = std::max(maxX, s.mX + width);
+				maxY = std::max(maxY, s.mY);
+			}
+		}
+
+		if (not inStrings.empty())
+			SetTextBounds(c, minX, minY, maxX - minX, maxY - minY);
+	}
+
+	virtual void GetGlyphRuns(std::span<const MStringItem> inStrings, std::vector<MGlyphRun> &outRuns)
+	{
+		mMeasure->GetGlyphRuns(inStrings, outRuns);
+	}
+
+	virtual void DrawGlyphRuns(std::span<const MGlyphRun> inRuns)
+	{
+		using MRun = MGlyphRunsCmd::MRun;
+
+		size_t size = 0;
+		for (auto &run : inRuns)
+			size += Align(sizeof(MRun) + run.mGlyphs.size() * sizeof(MGlyph));
+
+		auto c = Add<MGlyphRunsCmd>(MOp::DrawGlyphRuns, size);
+		c->mCount = inRuns.size();
+
+		float minX = 0, minY = 0, maxX = 0, maxY = 0;
+		bool first = true;
+
+		size_t offset = 0;
+		for (auto &run : inRuns)
+		{
+			new (Payload<MRun>(c, offset)) MRun{ run.mFont.GetImpl(), run.mColor, static_cast<uint32_t>(run.mGlyphs.size()) };
+			std::uninitialized_copy(run.mGlyphs.begin(), run.mGlyphs.end(), Payload<MGlyph>(c, offset + sizeof(MRun)));
+			offset += Align(sizeof(MRun) + run.mGlyphs.size() * sizeof(MGlyph));
+
+			for (auto &g : run.mGlyphs)
+			{
+				if (first)
+				{
+					minX = maxX = g.mX;
+					minY = maxY = g.mY;
+					first = false;
+				}
+				else
+				{
+					minX = std::min(minX, g.mX);
+					minY = std::min(minY, g.mY);
+					maxX = std::max(maxX, g.mX);
+					maxY = std::max(maxY, g.mY);
+				}
+			}
+		}
+
+		// glyph positions are on the baseline, leave room for a glyph around each
+		if (not first)
+		{
+			float margin = 2 * mMeasure->GetLineHeight();
+			SetBounds(c, minX, minY, maxX, maxY, margin);
+		}
+	}
+
+	virtual void SetText(const std::string &inText)
+	{
+		AddString(MOp::SetText, inText);
+		mMeasure->SetText(inText);
+	}
+
+	virtual void SetTabStops(float inTabWidth)
+	{
+		Add<MArgsCmd>(MOp::SetTabStops)->mF[0] = inTabWidth;
+		mMeasure->SetTabStops(inTabWidth);
+	}
+
+	virtual void SetTextColors(uint32_t inColorCount, uint32_t inColorIndices[], uint32_t inOffsets[], MColor inColors[])
+	{
+		uint32_t colorCount = 0;
+		for (uint32_t i = 0; i < inColorCount; ++i)
+			colorCount = std::max(colorCount, inColorIndices[i] + 1);
+
+		AddTextRuns(MOp::SetTextColors, inColorCount, inColorIndices, inOffsets, colorCount, inColors);
+	}
+
+	virtual void SetTextStyles(uint32_t inStyleCount, uint32_t inStyles[], uint32_t inOffsets[])
+	{
+		AddTextRuns(MOp::SetTextStyles, inStyleCount, inStyles, inOffsets, 0, nullptr);
+		mMeasure->SetTextStyles(inStyleCount, inStyles, inOffsets);
+	}
+
+	virtual void SetTextRuns(std::span<const MTextRun> inRuns)
+	{
+		auto c = Add<MRunsCmd>(MOp::SetTextRuns, inRuns.size() * sizeof(MTextRun));
+		c->mCount = inRuns.size();
+		std::uninitialized_copy(inRuns.begin(), inRuns.end(), Payload<MTextRun>(c));
+
+		mMeasure->SetTextRuns(inRuns);
+	}
+
+	virtual void RenderTextBackground(float inX, float inY, uint32_t inStart, uint32_t inLength, MColor inColor)
+	{
+		auto c = Add<MArgsCmd>(MOp::RenderTextBackground);
+		c->mF[0] = inX;
+		c->mF[1] = inY;
+		c->mU[0] = inStart;
+		c->mU[1] = inLength;
+		c->mColor = inColor;
+	}
+
+	virtual void SetTextSelection(uint32_t inStart, uint32_t inLength, MColor inSelectionColor)
+	{
+		auto c = Add<MArgsCmd>(MOp::SetTextSelection);
+		c->mU[0] = inStart;
+		c->mU[1] = inLength;
+		c->mColor = inSelectionColor;
+	}
+
+	virtual void SetDrawWhiteSpace(bool inDrawWhiteSpace, MColor inWhiteSpaceColor)
+	{
+		auto c = Add<MArgsCmd>(MOp::SetDrawWhiteSpace);
+		c->mU[0] = inDrawWhiteSpace;
+		c->mColor = inWhiteSpaceColor;
+	}
+
+	virtual void SetReplaceUnknownCharacters(bool inReplaceUnknownCharacters)
+	{
+		Add<MArgsCmd>(MOp::SetReplaceUnknownCharacters)->mU[0] = inReplaceUnknownCharacters;
+		mMeasure->SetReplaceUnknownCharacters(inReplaceUnknownCharacters);
+	}
+
+	virtual void IndexToPosition(uint32_t inIndex, bool inTrailing, int32_t &outPosition)
+	{
+		mMeasure->IndexToPosition(inIndex, inTrailing, outPosition);
+	}
+
+	virtual bool PositionToIndex(int32_t inPosition, uint32_t &outIndex)
+	{
+		return mMeasure->PositionToIndex(inPosition, outIndex);
+	}
+
+	virtual float GetTextWidth() { return mMeasure->GetTextWidth(); }
+
+	virtual void RenderText(float inX, float inY)
+	{
+		auto c = Add<MArgsCmd>(MOp::RenderText);
+		c->mF[0] = inX;
+		c->mF[1] = inY;
+	}
+
+	virtual void DrawCaret(float inX, float inY, uint32_t inOffset)
+	{
+		auto c = Add<MArgsCmd>(MOp::DrawCaret);
+		c->mF[0] = inX;
+		c->mF[1] = inY;
+		c->mU[0] = inOffset;
+	}
+
+	virtual void BreakLines(uint32_t inWidth, std::vector<uint32_t> &outBreaks)
+	{
+		mMeasure->BreakLines(inWidth, outBreaks);
+	}
+
+	virtual void SetScale(float inScaleX, float inScaleY, float inCenterX, float inCenterY)
+	{
+		auto c = Add<MArgsCmd>(MOp::SetScale);
+		c->mF[0] = inScaleX;
+		c->mF[1] = inScaleY;
+		c->mF[2] = inCenterX;
+		c->mF[3] = inCenterY;
+
+		// bounds are no longer known until the next Restore
+		mState.top().mScaled = true;
+	}
+
+	virtual void MakeTransparent(float inOpacity)
+	{
+		Add<MArgsCmd>(MOp::MakeTransparent)->mF[0] = inOpacity;
+	}
+
+	virtual void DrawListItemBackground(MRect inBounds, MListItemState inState)
+	{
+		AddRect(MOp::DrawListItemBackground, inBounds, inState, true);
+	}
+
+  private:
+	template <typename C>
+	C *Add(MOp inOp, size_t inPayload = 0)
+	{
+		size_t size = Align(sizeof(C)) + Align(inPayload);
+
+		C *result = new (mList.Allocate(size)) C;
+		result->mOp = inOp;
+		result->mHasBounds = false;
+		result->mSize = size;
+
+		++mList.mCommandCount;
+
+		return result;
+	}
+
+	MRectCmd *AddRect(MOp inOp, MRect inRect, uint32_t inValue, bool inSetBounds)
+	{
+		auto c = Add<MRectCmd>(inOp);
+		c->mRect = inRect;
+		c->mValue = inValue;
+
+		if (inSetBounds)
+			SetBounds(c, inRect);
+
+		return c;
+	}
+
+	MStringCmd *AddString(MOp inOp, const std::string &inText)
+	{
+		auto c = Add<MStringCmd>(inOp, inText.length());
+		c->mX = c->mY = 0;
+		c->mTruncateWidth = 0;
+		c->mAlign = eAlignNone;
+		c->mLength = inText.length();
+		std::memcpy(Payload<char>(c), inText.data(), inText.length());
+		return c;
+	}
+
+	void AddGeometry(MOp inOp, MGeometryImpl &inGeometry, float inLineWidth)
+	{
+		MGeometryImpl *geometry = inGeometry.Clone();
+		if (geometry == nullptr)
+			return;
+
+		mList.mGeometries.emplace_back(geometry);
+
+		auto c = Add<MGeometryCmd>(inOp);
+		c->mGeometry = geometry;
+		c->mLineWidth = inLineWidth;
+	}
+
+	void AddTextRuns(MOp inOp, uint32_t inCount, const uint32_t inValues[], const uint32_t inOffsets[],
+		uint32_t inColorCount, const MColor inColors[])
+	{
+		auto c = Add<MTextRunsCmd>(inOp, 2 * inCount * sizeof(uint32_t) + inColorCount * sizeof(MColor));
+		c->mCount = inCount;
+		c->mColorCount = inColorCount;
+
+		std::uninitialized_copy(inValues, inValues + inCount, Payload<uint32_t>(c));
+		std::uninitialized_copy(inOffsets, inOffsets + inCount, Payload<uint32_t>(c, inCount * sizeof(uint32_t)));
+		std::uninitialized_copy(inColors, inColors + inColorCount, Payload<MColor>(c, 2 * inCount * sizeof(uint32_t)));
+	}
+
+	// inRect is in the current coordinates, stored are the
+	// coordinates of the recording
+	void SetBounds(MCommand *inCommand, MRect inRect)
+	{
+		auto &state = mState.top();
+		if (state.mScaled)
+			return;
+
+		inRect.x += state.mX;
+		inRect.y += state.mY;
+
+		inCommand->mHasBounds = true;
+		inCommand->mBounds = inRect;
+
+		if (mList.mBounds.empty())
+			mList.mBounds = inRect;
+		else
+			mList.mBounds |= inRect;
+	}
+
+	void SetBounds(MCommand *inCommand, float inX1, float inY1, float inX2, float inY2, float inMargin)
+	{
+		int32_t x1 = static_cast<int32_t>(std::floor(std::min(inX1, inX2) - inMargin));
+		int32_t y1 = static_cast<int32_t>(std::floor(std::min(inY1, inY2) - inMargin));
+		int32_t x2 = static_cast<int32_t>(std::ceil(std::max(inX1, inX2) + inMargin));
+		int32_t y2 = static_cast<int32_t>(std::ceil(std::max(inY1, inY2) + inMargin));
+
+		SetBounds(inCommand, MRect(x1, y1, x2 - x1, y2 - y1));
+	}
+
+	// text drawn at inX, inY on a line of inWidth pixels. The margin
+	// is for glyphs that extend beyond their advance, like italics.
+	void SetTextBounds(MCommand *inCommand, float inX, float inY, float inWidth, float inExtraHeight = 0)
+	{
+		float lineHeight = mMeasure->GetLineHeight();
+		float margin = std::ceil(lineHeight / 4);
+
+		SetBounds(inCommand, inX - margin, inY - margin,
+			inX + inWidth + margin, inY + inExtraHeight + lineHeight + margin, 0);
+	}
+
+	struct MState
+	{
+		int32_t mX, mY;
+		bool mScaled;
+	};
+
+	MDisplayList &mList;
+	MRect mBounds;
+	std::unique_ptr<MDeviceImpl> mMeasure;
+	MColor mForeColor = kBlack, mBackColor = kWhite;
+	std::stack<MState> mState;
+};
+
+// --------------------------------------------------------------------
+
+MDevice::MDevice(MDisplayList &ioList, MRect inBounds)
+	: mImpl(new MRecordingDeviceImpl(ioList, inBounds))
+{
+}
+
+// --------------------------------------------------------------------
+
+MDisplayList::MDisplayList()
+{
+}
+
+MDisplayList::~MDisplayList()
+{
+}
+
+MDisplayList::MDisplayList(MDisplayList &&inList)
+	: mChunks(std::move(inList.mChunks))
+	, mBitmaps(std::move(inList.mBitmaps))
+	, mGeometries(std::move(inList.mGeometries))
+	, mCommandCount(std::exchange(inList.mCommandCount, 0))
+	, mBounds(std::exchange(inList.mBounds, {}))
+{
+}
+
+MDisplayList &MDisplayList::operator=(MDisplayList &&inList)
+{
+	if (this != &inList)
+	{
+		mChunks = std::move(inList.mChunks);
+		mBitmaps = std::move(inList.mBitmaps);
+		mGeometries = std::move(inList.mGeometries);
+		mCommandCount = std::exchange(inList.mCommandCount, 0);
+		mBounds = std::exchange(inList.mBounds, {});
+	}
+
+	return *this;
+}
+
+void MDisplayList::Clear()
+{
+	// keep the first chunk, it will probably be needed again
+	if (mChunks.size() > 1)
+		mChunks.erase(mChunks.begin() + 1, mChunks.end());
+	if (not mChunks.empty())
+		mChunks.front().mSize = 0;
+
+	mBitmaps.clear();
+	mGeometries.clear();
+	mCommandCount = 0;
+	mBounds = {};
+}
+
+size_t MDisplayList::GetByteSize() const
+{
+	size_t result = 0;
+	for (auto &chunk : mChunks)
+		result += chunk.mSize;
+	return result;
+}
+
+void *MDisplayList::Allocate(size_t inSize)
+{
+	if (mChunks.empty() or mChunks.back().mSize + inSize > mChunks.back().mCapacity)
+	{
+		size_t capacity = std::max(kChunkSize, inSize);
+		mChunks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[capacity]), 0, capacity });
+	}
+
+	auto &chunk = mChunks.back();
+
+	void *result = chunk.mData.get() + chunk.mSize;
+	chunk.mSize += inSize;
+	return result;
+}
+
+void MDisplayList::Replay(MDevice &inDevice) const
+{
+	Replay(inDevice, nullptr);
+}
+
+void MDisplayList::Replay(MDevice &inDevice, MRect inClip) const
+{
+	Replay(inDevice, &inClip);
+}
+
+void MDisplayList::Replay(MDevice &inDevice, const MRect *inClip) const
+{
+	MDeviceImpl *dev = inDevice.GetImpl();
+
+	for (auto &chunk : mChunks)
+	{
+		for (size_t offset = 0; offset < chunk.mSize;)
+		{
+			auto cmd = reinterpret_cast<const MCommand *>(chunk.mData.get() + offset);
+			offset += cmd->mSize;
+
+			if (inClip != nullptr and cmd->mHasBounds and not cmd->mBounds.Intersects(*inClip))
+				continue;
+
+			switch (cmd->mOp)
+			{
+				case MOp::Save:
+					dev->Save();
+					break;
+
+				case MOp::Restore:
+					dev->Restore();
+					break;
+
+				case MOp::SetOrigin:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->SetOrigin(c->mU[0], c->mU[1]);
+					break;
+				}
+
+				case MOp::SetFont:
+					dev->SetFont(static_cast<const MFontCmd *>(cmd)->mFont);
+					break;
+
+				case MOp::SetForeColor:
+					dev->SetForeColor(static_cast<const MColorCmd *>(cmd)->mColor);
+					break;
+
+				case MOp::SetBackColor:
+					dev->SetBackColor(static_cast<const MColorCmd *>(cmd)->mColor);
+					break;
+
+				case MOp::ClipRect:
+					dev->ClipRect(static_cast<const MRectCmd *>(cmd)->mRect);
+					break;
+
+				case MOp::ClipRegion:
+				{
+					auto c = static_cast<const MRegionCmd *>(cmd);
+					auto rects = Payload<MRect>(c);
+					dev->ClipRegion(MRegion(std::vector<MRect>(rects, rects + c->mCount)));
+					break;
+				}
+
+				case MOp::EraseRect:
+					dev->EraseRect(static_cast<const MRectCmd *>(cmd)->mRect);
+					break;
+
+				case MOp::FillRect:
+					dev->FillRect(static_cast<const MRectCmd *>(cmd)->mRect);
+					break;
+
+				case MOp::StrokeRect:
+				{
+					auto c = static_cast<const MRectCmd *>(cmd);
+					dev->StrokeRect(c->mRect, c->mValue);
+					break;
+				}
+
+				case MOp::StrokeLine:
+				{
+					auto c = static_cast<const MLineCmd *>(cmd);
+					dev->StrokeLine(c->mFromX, c->mFromY, c->mToX, c->mToY, c->mLineWidth);
+					break;
+				}
+
+				case MOp::FillEllipse:
+					dev->FillEllipse(static_cast<const MRectCmd *>(cmd)->mRect);
+					break;
+
+				case MOp::StrokeGeometry:
+				{
+					auto c = static_cast<const MGeometryCmd *>(cmd);
+					dev->StrokeGeometry(*c->mGeometry, c->mLineWidth);
+					break;
+				}
+
+				case MOp::FillGeometry:
+					dev->FillGeometry(*static_cast<const MGeometryCmd *>(cmd)->mGeometry);
+					break;
+
+				case MOp::DrawBitmap:
+				{
+					auto c = static_cast<const MBitmapCmd *>(cmd);
+					dev->DrawBitmap(*c->mBitmap, c->mX, c->mY);
+					break;
+				}
+
+				case MOp::CreateAndUsePattern:
+				{
+					auto c = static_cast<const MPatternCmd *>(cmd);
+					dev->CreateAndUsePattern(c->mColor1, c->mColor2, c->mWidth, c->mRotation);
+					break;
+				}
+
+				case MOp::DrawString:
+				{
+					auto c = static_cast<const MStringCmd *>(cmd);
+					dev->DrawString(std::string(Payload<char>(c), c->mLength), c->mX, c->mY, c->mTruncateWidth, c->mAlign);
+					break;
+				}
+
+				case MOp::DrawStringInRect:
+				{
+					auto c = static_cast<const MStringCmd *>(cmd);
+					dev->DrawString(std::string(Payload<char>(c), c->mLength), c->mRect, c->mAlign);
+					break;
+				}
+
+				case MOp::DrawStrings:
+				{
+					static thread_local std::vector<MStringItem> sItems;
+
+					auto c = static_cast<const MStringsCmd *>(cmd);
+					auto items = Payload<MStringsCmd::MItem>(c);
+					auto text = Payload<char>(c, c->mCount * sizeof(MStringsCmd::MItem));
+
+					sItems.clear();
+					for (uint32_t i = 0; i < c->mCount; ++i)
+						sItems.push_back({ std::string_view(text + items[i].mOffset, items[i].mLength), items[i].mX, items[i].mY });
+
+					dev->DrawStrings(sItems);
+					break;
+				}
+
+				case MOp::DrawGlyphRuns:
+				{
+					static thread_local std::vector<MGlyphRun> sRuns;
+
+					using MRun = MGlyphRunsCmd::MRun;
+
+					auto c = static_cast<const MGlyphRunsCmd *>(cmd);
+
+					sRuns.resize(c->mCount);
+
+					size_t runOffset = 0;
+					for (uint32_t i = 0; i < c->mCount; ++i)
+					{
+						auto run = Payload<MRun>(c, runOffset);
+						auto glyphs = Payload<MGlyph>(c, runOffset + sizeof(MRun));
+
+						sRuns[i].mFont = MFont(run->mFont);
+						sRuns[i].mColor = run->mColor;
+						sRuns[i].mGlyphs.assign(glyphs, glyphs + run->mGlyphCount);
+
+						runOffset += Align(sizeof(MRun) + run->mGlyphCount * sizeof(MGlyph));
+					}
+
+					dev->DrawGlyphRuns(sRuns);
+					break;
+				}
+
+				case MOp::SetText:
+				{
+					auto c = static_cast<const MStringCmd *>(cmd);
+					dev->SetText(std::string(Payload<char>(c), c->mLength));
+					break;
+				}
+
+				case MOp::SetTabStops:
+					dev->SetTabStops(static_cast<const MArgsCmd *>(cmd)->mF[0]);
+					break;
+
+				case MOp::SetTextColors:
+				case MOp::SetTextStyles:
+				{
+					auto c = static_cast<const MTextRunsCmd *>(cmd);
+
+					// the device interface takes non-const arrays, it does not write them
+					auto values = const_cast<uint32_t *>(Payload<uint32_t>(c));
+					auto offsets = const_cast<uint32_t *>(Payload<uint32_t>(c, c->mCount * sizeof(uint32_t)));
+
+					if (cmd->mOp == MOp::SetTextStyles)
+						dev->SetTextStyles(c->mCount, values, offsets);
+					else
+					{
+						auto colors = const_cast<MColor *>(Payload<MColor>(c, 2 * c->mCount * sizeof(uint32_t)));
+						dev->SetTextColors(c->mCount, values, offsets, colors);
+					}
+					break;
+				}
+
+				case MOp::SetTextRuns:
+				{
+					auto c = static_cast<const MRunsCmd *>(cmd);
+					dev->SetTextRuns({ Payload<MTextRun>(c), c->mCount });
+					break;
+				}
+
+				case MOp::RenderTextBackground:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->RenderTextBackground(c->mF[0], c->mF[1], c->mU[0], c->mU[1], c->mColor);
+					break;
+				}
+
+				case MOp::SetTextSelection:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->SetTextSelection(c->mU[0], c->mU[1], c->mColor);
+					break;
+				}
+
+				case MOp::SetDrawWhiteSpace:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->SetDrawWhiteSpace(c->mU[0] != 0, c->mColor);
+					break;
+				}
+
+				case MOp::SetReplaceUnknownCharacters:
+					dev->SetReplaceUnknownCharacters(static_cast<const MArgsCmd *>(cmd)->mU[0] != 0);
+					break;
+
+				case MOp::RenderText:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->RenderText(c->mF[0], c->mF[1]);
+					break;
+				}
+
+				case MOp::DrawCaret:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->DrawCaret(c->mF[0], c->mF[1], c->mU[0]);
+					break;
+				}
+
+				case MOp::SetScale:
+				{
+					auto c = static_cast<const MArgsCmd *>(cmd);
+					dev->SetScale(c->mF[0], c->mF[1], c->mF[2], c->mF[3]);
+					break;
+				}
+
+				case MOp::MakeTransparent:
+					dev->MakeTransparent(static_cast<const MArgsCmd *>(cmd)->mF[0]);
+					break;
+
+				case MOp::DrawListItemBackground:
+				{
+					auto c = static_cast<const MRectCmd *>(cmd);
+					dev->DrawListItemBackground(c->mRect, static_cast<MListItemState>(c->mValue));
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,221 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MFrameStats.hpp"
+
+#include <bit>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+// --------------------------------------------------------------------
+// The buckets are log-linear, values below kSubBuckets microseconds
+// have a bucket of their own, above that each power of two is split
+// in kSubBuckets buckets.
+
+uint32_t MFrameHistogram::BucketIndex(uint64_t inMicroseconds)
+{
+	constexpr uint32_t kShift = std::countr_zero(kSubBuckets);
+
+	if (inMicroseconds < kSubBuckets)
+		return inMicroseconds;
+
+	uint32_t e = std::bit_width(inMicroseconds) - 1;
+	uint32_t sub = (inMicroseconds >> (e - kShift)) & (kSubBuckets - 1);
+
+	return std::min((e - kShift + 1) * kSubBuckets + sub, kBucketCount - 1);
+}
+
+double MFrameHistogram::BucketValue(uint32_t inIndex)
+{
+	constexpr uint32_t kShift = std::countr_zero(kSubBuckets);
+
+	if (inIndex < kSubBuckets)
+		return inIndex;
+
+	uint32_t e = inIndex / kSubBuckets + kShift - 1;
+	uint32_t sub = inIndex % kSubBuckets;
+
+	// the middle of the bucket
+	uint64_t lo = (uint64_t(kSubBuckets) + sub) << (e - kShift);
+	return lo + ((uint64_t(1) << (e - kShift)) - 1) / 2.0;
+}
+
+void MFrameHistogram::Record(std::chrono::nanoseconds inTime)
+{
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(inTime).count();
+
+	mBuckets[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+	mCount.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = mMax.load(std::memory_order_relaxed);
+	while (us > max and not mMax.compare_exchange_weak(max, us, std::memory_order_relaxed))
+		;
+}
+
+void MFrameHistogram::Reset()
+{
+	for (auto &b : mBuckets)
+		b.store(0, std::memory_order_relaxed);
+	mCount.store(0, std::memory_order_relaxed);
+	mMax.store(0, std::memory_order_relaxed);
+}
+
+uint64_t MFrameHistogram::GetCount() const
+{
+	return mCount.load(std::memory_order_relaxed);
+}
+
+double MFrameHistogram::GetPercentile(double inPercentile) const
+{
+	// The buckets are read one by one while drawing may go on,
+	// use the sum of what was read rather than mCount
+	uint64_t counts[kBucketCount], total = 0;
+	for (uint32_t i = 0; i < kBucketCount; ++i)
+		total += counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+
+	if (total == 0)
+		return 0;
+
+	uint64_t rank = static_cast<uint64_t>(inPercentile * total + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < kBucketCount; ++i)
+	{
+		seen += counts[i];
+		if (seen >= rank)
+			return std::min(BucketValue(i), GetMax());
+	}
+
+	return GetMax();
+}
+
+double MFrameHistogram::GetMax() const
+{
+	return mMax.load(std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------
+
+MFrameStats &MFrameStats::Instance()
+{
+	static MFrameStats sInstance;
+	return sInstance;
+}
+
+MFrameStats::MFrameStats()
+{
+	const char *env = getenv("MGUI_FRAME_STATS");
+	if (env != nullptr)
+	{
+		mEnabled = true;
+		mDump = true;
+
+		std::string file(env);
+		if (file != "1" and file != "stderr")
+			mDumpFile = file;
+	}
+}
+
+MFrameStats::~MFrameStats()
+{
+	if (not mDump)
+		return;
+
+	if (mDumpFile.empty())
+		Dump(std::cerr);
+	else
+	{
+		std::ofstream file(mDumpFile);
+		if (file.is_open())
+			Dump(file);
+		else
+			std::cerr << "Could not write frame statistics to " << mDumpFile << '\n';
+	}
+}
+
+MFrameHistogram &MFrameStats::GetHistogram(const std::string &inID)
+{
+	std::unique_lock lock(mMutex);
+
+	auto &h = mHistograms[inID];
+	if (not h)
+		h.reset(new MFrameHistogram);
+	return *h;
+}
+
+std::vector<MFrameStats::MSummary> MFrameStats::GetSummaries() const
+{
+	std::unique_lock lock(mMutex);
+
+	std::vector<MSummary> result;
+
+	for (auto &[id, h] : mHistograms)
+	{
+		if (h->GetCount() == 0)
+			continue;
+
+		result.push_back({ id, h->GetCount(),
+			h->GetPercentile(0.50) / 1000, h->GetPercentile(0.95) / 1000,
+			h->GetPercentile(0.99) / 1000, h->GetMax() / 1000 });
+	}
+
+	return result;
+}
+
+void MFrameStats::Reset()
+{
+	std::unique_lock lock(mMutex);
+
+	for (auto &[id, h] : mHistograms)
+		h->Reset();
+}
+
+void MFrameStats::Dump(std::ostream &os) const
+{
+	auto summaries = GetSummaries();
+
+	os << std::left << std::setw(24) << "view"
+	   << std::right << std::setw(10) << "frames"
+	   << std::setw(10) << "p50 ms"
+	   << std::setw(10) << "p95 ms"
+	   << std::setw(10) << "p99 ms"
+	   << std::setw(10) << "max ms" << '\n';
+
+	for (auto &s : summaries)
+	{
+		os << std::left << std::setw(24) << (s.mID.empty() ? "<no id>" : s.mID)
+		   << std::right << std::setw(10) << s.mCount
+		   << std::fixed << std::setprecision(2)
+		   << std::setw(10) << s.mP50
+		   << std::setw(10) << s.mP95
+		   << std::setw(10) << s.mP99
+		   << std::setw(10) << s.mMax << '\n';
+	}
+}
@@ -0,0 +1,315 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MImageCache.hpp"
+#include "MApplication.hpp"
+
+#include "mrsrc.hpp"
+
+#include <algorithm>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// The default budget, enough for a few hundred icons at 2x
+const size_t kDefaultImageCacheBudget = 32 * 1024 * 1024;
+
+// Run the callbacks on the main thread
+void Notify(std::vector<std::function<void()>> &&inCallbacks)
+{
+	for (auto &cb : inCallbacks)
+	{
+		if (gApp != nullptr)
+			gApp->ExecuteAsync(std::move(cb));
+		else
+			cb();
+	}
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MImageCache &MImageCache::Instance()
+{
+	static MImageCache sInstance;
+	return sInstance;
+}
+
+MImageCache::MImageCache()
+	: mBudget(kDefaultImageCacheBudget)
+{
+}
+
+MImageCache::~MImageCache()
+{
+	{
+		std::unique_lock lock(mMutex);
+		mDone = true;
+		mCV.notify_one();
+	}
+
+	if (mThread.joinable())
+		mThread.join();
+}
+
+std::shared_ptr<const MBitmap> MImageCache::Get(const std::string &inName, uint32_t inScale)
+{
+	MKey key{ inName, inScale };
+
+	std::unique_lock lock(mMutex);
+
+	for (;;)
+	{
+		auto e = Lookup(key);
+
+		if (e->mDecoded)
+			return e->mBitmap;
+
+		// being decoded by the background thread, wait for it and look
+		// again, the entry may have been evicted in the mean time.
+		if (e->mDecoding)
+		{
+			mDecodedCV.wait(lock);
+			continue;
+		}
+
+		// perhaps queued, decode it here instead
+		if (e->mQueued)
+		{
+			mQueue.erase(std::find(mQueue.begin(), mQueue.end(), e));
+			e->mQueued = false;
+		}
+
+		e->mDecoding = true;
+
+		lock.unlock();
+		auto result = Decode(key);
+		lock.lock();
+
+		auto callbacks = Store(e, result);
+
+		lock.unlock();
+		Notify(std::move(callbacks));
+
+		return result;
+	}
+}
+
+std::shared_ptr<const MBitmap> MImageCache::Request(const std::string &inName, uint32_t inScale,
+	std::function<void()> inReady)
+{
+	std::unique_lock lock(mMutex);
+
+	auto e = Lookup({ inName, inScale });
+
+	if (e->mDecoded)
+		return e->mBitmap;
+
+	if (inReady)
+		e->mReady.emplace_back(std::move(inReady));
+
+	if (not(e->mQueued or e->mDecoding))
+	{
+		mQueue.push_back(e);
+		e->mQueued = true;
+
+		if (not mThread.joinable())
+			mThread = std::thread([this]()
+				{ Decoder(); });
+
+		mCV.notify_one();
+	}
+
+	return nullptr;
+}
+
+void MImageCache::SetBudget(size_t inBytes)
+{
+	std::unique_lock lock(mMutex);
+	mBudget = inBytes;
+	Evict();
+}
+
+size_t MImageCache::GetBudget() const
+{
+	std::unique_lock lock(mMutex);
+	return mBudget;
+}
+
+size_t MImageCache::GetBytesUsed() const
+{
+	std::unique_lock lock(mMutex);
+	return mBytesUsed;
+}
+
+void MImageCache::Clear()
+{
+	std::unique_lock lock(mMutex);
+
+	for (auto e = mLRU.begin(); e != mLRU.end();)
+	{
+		if (e->mDecoded)
+			e = Remove(e);
+		else
+			++e;
+	}
+}
+
+// --------------------------------------------------------------------
+
+MImageCache::MEntryList::iterator MImageCache::Lookup(const MKey &inKey)
+{
+	auto i = mIndex.find(inKey);
+	if (i != mIndex.end())
+	{
+		mLRU.splice(mLRU.begin(), mLRU, i->second);
+		return i->second;
+	}
+
+	mLRU.emplace_front();
+	mLRU.front().mKey = inKey;
+	mIndex.emplace(inKey, mLRU.begin());
+
+	return mLRU.begin();
+}
+
+std::vector<std::function<void()>> MImageCache::Store(MEntryList::iterator inEntry, std::shared_ptr<const MBitmap> inBitmap)
+{
+	inEntry->mBitmap = inBitmap;
+	inEntry->mDecoding = false;
+	inEntry->mDecoded = true;
+
+	if (inBitmap)
+	{
+		inEntry->mSize = size_t(inBitmap->Stride()) * inBitmap->Height();
+		mBytesUsed += inEntry->mSize;
+	}
+
+	auto result = std::move(inEntry->mReady);
+	inEntry->mReady.clear();
+
+	mDecodedCV.notify_all();
+
+	Evict();
+
+	return result;
+}
+
+MImageCache::MEntryList::iterator MImageCache::Remove(MEntryList::iterator inEntry)
+{
+	mBytesUsed -= inEntry->mSize;
+	mIndex.erase(inEntry->mKey);
+	return mLRU.erase(inEntry);
+}
+
+void MImageCache::Evict()
+{
+	auto e = mLRU.end();
+	while (mBytesUsed > mBudget and e != mLRU.begin())
+	{
+		--e;
+
+		// entries still being decoded are referenced elsewhere
+		if (e->mDecoded and e->mSize > 0)
+			e = Remove(e);
+	}
+}
+
+void MImageCache::Decoder()
+{
+	std::unique_lock lock(mMutex);
+
+	for (;;)
+	{
+		mCV.wait(lock, [this]()
+			{ return mDone or not mQueue.empty(); });
+
+		if (mDone)
+			break;
+
+		auto e = mQueue.front();
+		mQueue.pop_front();
+
+		e->mQueued = false;
+		e->mDecoding = true;
+
+		lock.unlock();
+		auto bitmap = Decode(e->mKey);
+		lock.lock();
+
+		auto callbacks = Store(e, bitmap);
+
+		lock.unlock();
+		Notify(std::move(callbacks));
+		lock.lock();
+	}
+}
+
+std::shared_ptr<const MBitmap> MImageCache::Decode(const MKey &inKey)
+{
+	const auto &[name, scale] = inKey;
+
+	mrsrc::rsrc rsrc(name);
+	uint32_t rsrcScale = 1;
+
+	if (scale > 1)
+	{
+		// Icons/open.png => Icons/open@2x.png
+		std::string scaled = name;
+		auto dot = scaled.rfind('.');
+		if (dot == std::string::npos or scaled.find('/', dot) != std::string::npos)
+			dot = scaled.length();
+		scaled.insert(dot, "@" + std::to_string(scale) + "x");
+
+		mrsrc::rsrc scaledRsrc(scaled);
+		if (scaledRsrc)
+		{
+			rsrc = scaledRsrc;
+			rsrcScale = scale;
+		}
+	}
+
+	std::shared_ptr<const MBitmap> result;
+
+	if (rsrc)
+	{
+		try
+		{
+			auto bitmap = std::make_shared<MBitmap>(rsrc.data(), static_cast<uint32_t>(rsrc.size()));
+			bitmap->SetScale(rsrcScale);
+			result = std::move(bitmap);
+		}
+		catch (const std::exception &)
+		{
+			// not a valid PNG, remember that as an empty entry
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,198 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MLineLayoutCache.hpp"
+#include "MDeviceImpl.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+
+size_t Hash(const std::string &inText, std::span<const MTextRun> inRuns)
+{
+	size_t result = std::hash<std::string>{}(inText);
+
+	for (auto &run : inRuns)
+	{
+		size_t h = run.mOffset ^
+		           (size_t(run.mColor.red) << 8 | size_t(run.mColor.green) << 16 | size_t(run.mColor.blue) << 24) ^
+		           size_t(run.mStyle) << 32;
+		result ^= h + 0x9e3779b97f4a7c15ULL + (result << 6) + (result >> 2);
+	}
+
+	return result;
+}
+
+bool Equal(std::span<const MTextRun> inA, std::span<const MTextRun> inB)
+{
+	return std::equal(inA.begin(), inA.end(), inB.begin(), inB.end(),
+		[](const MTextRun &a, const MTextRun &b)
+		{ return a.mOffset == b.mOffset and a.mColor == b.mColor and a.mStyle == b.mStyle; });
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MLineLayoutCache::MLineLayoutCache(uint32_t inMaxLayouts)
+	: mMaxLayouts(std::max(inMaxLayouts, 2U))
+{
+}
+
+MLineLayoutCache::~MLineLayoutCache()
+{
+}
+
+void MLineLayoutCache::SetText(MDevice &inDevice, uint32_t inLine, const std::string &inText,
+	std::span<const MTextRun> inRuns)
+{
+	MDeviceImpl *impl = inDevice.GetImpl();
+
+	if (inLine >= mLines.size())
+		mLines.resize(inLine + 1);
+
+	MEntry &e = mLines[inLine];
+	size_t hash = Hash(inText, inRuns);
+
+	e.mLastUsed = ++mClock;
+
+	if (e.mLayout and e.mHash == hash and e.mText == inText and Equal(e.mRuns, inRuns) and
+		impl->UseTextLayout(e.mLayout.get()))
+	{
+		++mStatistics.mHits;
+		return;
+	}
+
+	++mStatistics.mMisses;
+
+	inDevice.SetText(inText);
+	if (not inRuns.empty())
+		inDevice.SetTextRuns(inRuns);
+
+	std::unique_ptr<MTextLayoutImpl> layout(impl->SaveTextLayout());
+
+	if (e.mLayout and not layout)
+		--mLayoutCount;
+	else if (layout and not e.mLayout)
+		++mLayoutCount;
+
+	e.mLayout = std::move(layout);
+	e.mHash = hash;
+
+	if (e.mLayout)
+	{
+		e.mText = inText;
+		e.mRuns.assign(inRuns.begin(), inRuns.end());
+	}
+	else
+	{
+		e.mText.clear();
+		e.mRuns.clear();
+	}
+
+	if (mLayoutCount > mMaxLayouts)
+		Purge();
+}
+
+bool MLineLayoutCache::GetLineSize(uint32_t inLine, float &outWidth, float &outHeight) const
+{
+	bool result = false;
+
+	if (inLine < mLines.size() and mLines[inLine].mLayout)
+	{
+		outWidth = mLines[inLine].mLayout->mWidth;
+		outHeight = mLines[inLine].mLayout->mHeight;
+		result = true;
+	}
+
+	return result;
+}
+
+void MLineLayoutCache::Invalidate(uint32_t inLine)
+{
+	if (inLine < mLines.size() and mLines[inLine].mLayout)
+	{
+		mLines[inLine] = {};
+		--mLayoutCount;
+	}
+}
+
+void MLineLayoutCache::InsertLines(uint32_t inLine, uint32_t inCount)
+{
+	if (inLine < mLines.size())
+	{
+		mLines.resize(mLines.size() + inCount);
+		std::move_backward(mLines.begin() + inLine, mLines.end() - inCount, mLines.end());
+		std::for_each(mLines.begin() + inLine, mLines.begin() + inLine + inCount, [](MEntry &e)
+			{ e = {}; });
+	}
+}
+
+void MLineLayoutCache::DeleteLines(uint32_t inLine, uint32_t inCount)
+{
+	if (inLine < mLines.size())
+	{
+		auto b = mLines.begin() + inLine;
+		auto e = mLines.begin() + std::min<size_t>(inLine + inCount, mLines.size());
+
+		mLayoutCount -= std::count_if(b, e, [](const MEntry &le)
+			{ return le.mLayout != nullptr; });
+
+		mLines.erase(b, e);
+	}
+}
+
+void MLineLayoutCache::Clear()
+{
+	mLines.clear();
+	mLayoutCount = 0;
+}
+
+// Drop the layouts that were not used in the last mMaxLayouts / 2
+// calls to SetText. Doing this in one sweep keeps SetText cheap.
+void MLineLayoutCache::Purge()
+{
+	uint64_t oldest = mClock - mMaxLayouts / 2;
+
+	for (auto &e : mLines)
+	{
+		if (e.mLayout and e.mLastUsed <= oldest)
+		{
+			e = {};
+			--mLayoutCount;
+			++mStatistics.mEvictions;
+		}
+	}
+}
+
+MTextLayoutCacheStatistics MLineLayoutCache::GetStatistics() const
+{
+	MTextLayoutCacheStatistics result = mStatistics;
+	result.mEntries = mLayoutCount;
+	return result;
+}
@@ -0,0 +1,291 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MTextWrapper.hpp"
+#include "MDevice.hpp"
+#include "MUnicode.hpp"
+#include "MWorkers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+// --------------------------------------------------------------------
+
+MTextWrapper::MTextWrapper(MMeasureFunc inMeasure, float inWidth)
+	: mMeasure(std::move(inMeasure))
+	, mWidth(inWidth)
+{
+	mSpaceWidth = mMeasure(" ");
+	mTabWidth = mMeasure("\t");
+}
+
+MTextWrapper::MMeasureFunc MTextWrapper::MeasureWithFont(const std::string &inFont)
+{
+	return [inFont](std::string_view inText) -> float
+	{
+		static thread_local std::unique_ptr<MDevice> sDevice;
+		static thread_local std::string sFont;
+
+		if (not sDevice)
+			sDevice.reset(new MDevice());
+
+		if (sFont != inFont)
+		{
+			sDevice->SetFont(inFont);
+			sFont = inFont;
+		}
+
+		return sDevice->GetStringAdvance(inText);
+	};
+}
+
+void MTextWrapper::Wrap(std::string_view inText, uint32_t inThreads)
+{
+	mParagraphs = WrapParagraphs(inText, true, inThreads);
+
+	mLineCount = 0;
+	for (auto &p : mParagraphs)
+		mLineCount += p.mBreaks.size() + 1;
+}
+
+void MTextWrapper::Rewrap(std::string_view inText, size_t inOffset, size_t inOldLength, size_t inNewLength)
+{
+	if (mParagraphs.empty())
+	{
+		Wrap(inText);
+		return;
+	}
+
+	// The paragraphs touched by the edit, the one following is included
+	// when the edit ends at its start since the newline may be gone.
+
+	size_t first = 0, firstStart = 0;
+	while (first + 1 < mParagraphs.size() and firstStart + mParagraphs[first].mLength <= inOffset)
+		firstStart += mParagraphs[first++].mLength;
+
+	size_t last = first, lastEnd = firstStart + mParagraphs[first].mLength;
+	while (last + 1 < mParagraphs.size() and lastEnd <= inOffset + inOldLength)
+		lastEnd += mParagraphs[++last].mLength;
+
+	bool atEnd = last + 1 == mParagraphs.size();
+	size_t newEnd = lastEnd - inOldLength + inNewLength;
+	assert(newEnd <= inText.length());
+
+	auto wrapped = WrapParagraphs(inText.substr(firstStart, newEnd - firstStart), atEnd, 1);
+
+	for (size_t i = first; i <= last; ++i)
+		mLineCount -= mParagraphs[i].mBreaks.size() + 1;
+	for (auto &p : wrapped)
+		mLineCount += p.mBreaks.size() + 1;
+
+	auto i = mParagraphs.erase(mParagraphs.begin() + first, mParagraphs.begin() + last + 1);
+	mParagraphs.insert(i, std::make_move_iterator(wrapped.begin()), std::make_move_iterator(wrapped.end()));
+}
+
+std::vector<size_t> MTextWrapper::GetLineStarts() const
+{
+	std::vector<size_t> result;
+	result.reserve(mLineCount);
+
+	size_t offset = 0;
+	for (auto &p : mParagraphs)
+	{
+		result.push_back(offset);
+		for (auto b : p.mBreaks)
+			result.push_back(offset + b);
+		offset += p.mLength;
+	}
+
+	return result;
+}
+
+// Split inText at newlines and wrap each paragraph. If inAtEnd is true
+// inText runs up to the end of the document and the text following the
+// last newline is a paragraph as well, even when empty.
+std::vector<MTextWrapper::MParagraph> MTextWrapper::WrapParagraphs(std::string_view inText, bool inAtEnd, uint32_t inThreads) const
+{
+	const size_t kMinBytesPerThread = 256 * 1024;
+
+	std::vector<MParagraph> result;
+	std::vector<size_t> starts;
+
+	for (size_t offset = 0;;)
+	{
+		size_t nl = inText.find('\n', offset);
+		if (nl == std::string_view::npos)
+		{
+			assert(inAtEnd or offset == inText.length());
+			if (inAtEnd)
+			{
+				starts.push_back(offset);
+				result.push_back({ inText.length() - offset, {} });
+			}
+			break;
+		}
+
+		starts.push_back(offset);
+		result.push_back({ nl + 1 - offset, {} });
+		offset = nl + 1;
+	}
+
+	auto &workers = MWorkers::Instance();
+
+	if (inThreads == 0)
+		inThreads = workers.GetConcurrency();
+
+	size_t threads = std::min<size_t>({ inThreads, inText.length() / kMinBytesPerThread, result.size() });
+
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < result.size(); ++i)
+			WrapParagraph(inText.substr(starts[i], result[i].mLength), result[i]);
+	}
+	else
+	{
+		// paragraphs are handed out in small batches, they differ a lot in length
+		const size_t kBatchSize = 64;
+		std::atomic<size_t> next = 0;
+
+		workers.ParallelFor(threads, [&](uint32_t)
+			{
+				for (;;)
+				{
+					size_t b = next.fetch_add(kBatchSize);
+					if (b >= result.size())
+						break;
+
+					size_t e = std::min(b + kBatchSize, result.size());
+					for (size_t i = b; i < e; ++i)
+						WrapParagraph(inText.substr(starts[i], result[i].mLength), result[i]);
+				} });
+	}
+
+	return result;
+}
+
+// Greedy wrapping, the text between two break opportunities is measured
+// once and white space at the end of a line does not count.
+void MTextWrapper::WrapParagraph(std::string_view inText, MParagraph &ioParagraph) const
+{
+	MLineBreakIterator iter(inText);
+
+	size_t lineStart = 0, segmentStart = 0;
+	float lineWidth = 0;
+
+	while (iter.Next())
+	{
+		std::string_view segment = inText.substr(segmentStart, iter.GetOffset() - segmentStart);
+
+		size_t visible = segment.find_last_not_of(" \t\r\n");
+		visible = visible == std::string_view::npos ? 0 : visible + 1;
+
+		float width = visible > 0 ? mMeasure(segment.substr(0, visible)) : 0;
+
+		if (segmentStart > lineStart and lineWidth + width > mWidth)
+		{
+			ioParagraph.mBreaks.push_back(segmentStart);
+			lineStart = segmentStart;
+			lineWidth = 0;
+		}
+
+		// a word that does not fit on a line by itself is broken
+		// between characters
+		while (width > mWidth and visible > 0)
+		{
+			size_t fit = FitPrefix(segment.substr(0, visible));
+			if (fit >= visible)
+				break;
+
+			segment.remove_prefix(fit);
+			segmentStart += fit;
+			visible -= fit;
+
+			ioParagraph.mBreaks.push_back(segmentStart);
+			lineStart = segmentStart;
+
+			width = mMeasure(segment.substr(0, visible));
+		}
+
+		lineWidth += width;
+		for (auto ch : segment.substr(visible))
+		{
+			if (ch == ' ')
+				lineWidth += mSpaceWidth;
+			else if (ch == '\t')
+				lineWidth += mTabWidth;
+		}
+
+		segmentStart = iter.GetOffset();
+
+		// hard breaks within a paragraph, e.g. a form feed
+		if (iter.IsMandatory() and segmentStart < inText.length())
+		{
+			ioParagraph.mBreaks.push_back(segmentStart);
+			lineStart = segmentStart;
+			lineWidth = 0;
+		}
+	}
+}
+
+// The length of the longest prefix of inText that fits in mWidth, at
+// least one character. The complete text is known not to fit.
+size_t MTextWrapper::FitPrefix(std::string_view inText) const
+{
+	auto nextChar = [inText](size_t inOffset)
+	{
+		do
+			++inOffset;
+		while (inOffset < inText.length() and (inText[inOffset] & 0x0C0) == 0x080);
+		return inOffset;
+	};
+
+	auto charStart = [inText](size_t inOffset)
+	{
+		while (inOffset > 0 and (inText[inOffset] & 0x0C0) == 0x080)
+			--inOffset;
+		return inOffset;
+	};
+
+	size_t lo = nextChar(0), hi = inText.length();
+
+	for (;;)
+	{
+		size_t mid = charStart(lo + (hi - lo) / 2);
+		if (mid <= lo)
+			mid = nextChar(lo);
+		if (mid >= hi)
+			break;
+
+		if (mMeasure(inText.substr(0, mid)) <= mWidth)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
@@ -28,6 +28,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <utility>
 #include <vector>
 
 void MRect::InsetBy(int32_t inDeltaX, int32_t inDeltaY)
@@ -150,8 +151,407 @@ bool MRect::empty() const
 	return width <= 0 or height <= 0;
 }
 
-struct MRegionImpl : public std::vector<MRect>
+// --------------------------------------------------------------------
+// MRegion is implemented as a list of y-x banded boxes. The set
+// operations all use the same band walking algorithm, see RegionOp.
+
+namespace
+{
+
+struct MBox
+{
+	int32_t x1, y1, x2, y2;
+
+	MBox() = default;
+
+	MBox(int32_t inX1, int32_t inY1, int32_t inX2, int32_t inY2)
+		: x1(inX1)
+		, y1(inY1)
+		, x2(inX2)
+		, y2(inY2)
+	{
+	}
+
+	MBox(const MRect &inRect)
+		: x1(inRect.x)
+		, y1(inRect.y)
+		, x2(inRect.x + inRect.width)
+		, y2(inRect.y + inRect.height)
+	{
+	}
+
+	operator MRect() const { return MRect(x1, y1, x2 - x1, y2 - y1); }
+
+	bool empty() const { return x1 >= x2 or y1 >= y2; }
+
+	bool Contains(const MBox &inBox) const
+	{
+		return x1 <= inBox.x1 and x2 >= inBox.x2 and y1 <= inBox.y1 and y2 >= inBox.y2;
+	}
+
+	bool Intersects(const MBox &inBox) const
+	{
+		return x1 < inBox.x2 and x2 > inBox.x1 and y1 < inBox.y2 and y2 > inBox.y1;
+	}
+
+	bool operator==(const MBox &inBox) const
+	{
+		return x1 == inBox.x1 and y1 == inBox.y1 and x2 == inBox.x2 and y2 == inBox.y2;
+	}
+};
+
+typedef std::vector<MBox> MBoxList;
+typedef MBoxList::const_iterator MBoxIter;
+
+// Return the end of the band starting at inBox
+MBoxIter FindBandEnd(MBoxIter inBox, MBoxIter inEnd)
 {
+	int32_t y1 = inBox->y1;
+	while (inBox != inEnd and inBox->y1 == y1)
+		++inBox;
+	return inBox;
+}
+
+// Merge the band starting at inCurBand with the one at inPrevBand if
+// they touch and have the same horizontal extents. Returns the start
+// of the last band in ioBoxes.
+size_t Coalesce(MBoxList &ioBoxes, size_t inPrevBand, size_t inCurBand)
+{
+	size_t n = inCurBand - inPrevBand;
+
+	if (n == 0 or ioBoxes.size() - inCurBand != n or
+		ioBoxes[inPrevBand].y2 != ioBoxes[inCurBand].y1)
+		return inCurBand;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (ioBoxes[inPrevBand + i].x1 != ioBoxes[inCurBand + i].x1 or
+			ioBoxes[inPrevBand + i].x2 != ioBoxes[inCurBand + i].x2)
+			return inCurBand;
+	}
+
+	int32_t y2 = ioBoxes[inCurBand].y2;
+	for (size_t i = 0; i < n; ++i)
+		ioBoxes[inPrevBand + i].y2 = y2;
+
+	ioBoxes.resize(inCurBand);
+
+	return inPrevBand;
+}
+
+void AppendBand(MBoxList &ioBoxes, MBoxIter inBox, MBoxIter inEnd, int32_t inY1, int32_t inY2)
+{
+	for (; inBox != inEnd; ++inBox)
+		ioBoxes.emplace_back(inBox->x1, inY1, inBox->x2, inY2);
+}
+
+// The overlap functions combine two bands that share the vertical
+// range inY1 - inY2
+
+void UnionBands(MBoxList &ioBoxes, MBoxIter inB1, MBoxIter inE1, MBoxIter inB2, MBoxIter inE2, int32_t inY1, int32_t inY2)
+{
+	int32_t x1, x2;
+
+	auto merge = [&](MBoxIter &b)
+	{
+		if (b->x1 <= x2)
+		{
+			if (x2 < b->x2)
+				x2 = b->x2;
+		}
+		else
+		{
+			ioBoxes.emplace_back(x1, inY1, x2, inY2);
+			x1 = b->x1;
+			x2 = b->x2;
+		}
+		++b;
+	};
+
+	if (inB1->x1 < inB2->x1)
+	{
+		x1 = inB1->x1;
+		x2 = inB1->x2;
+		++inB1;
+	}
+	else
+	{
+		x1 = inB2->x1;
+		x2 = inB2->x2;
+		++inB2;
+	}
+
+	while (inB1 != inE1 and inB2 != inE2)
+	{
+		if (inB1->x1 < inB2->x1)
+			merge(inB1);
+		else
+			merge(inB2);
+	}
+
+	while (inB1 != inE1)
+		merge(inB1);
+
+	while (inB2 != inE2)
+		merge(inB2);
+
+	ioBoxes.emplace_back(x1, inY1, x2, inY2);
+}
+
+void IntersectBands(MBoxList &ioBoxes, MBoxIter inB1, MBoxIter inE1, MBoxIter inB2, MBoxIter inE2, int32_t inY1, int32_t inY2)
+{
+	while (inB1 != inE1 and inB2 != inE2)
+	{
+		int32_t x1 = std::max(inB1->x1, inB2->x1);
+		int32_t x2 = std::min(inB1->x2, inB2->x2);
+
+		if (x1 < x2)
+			ioBoxes.emplace_back(x1, inY1, x2, inY2);
+
+		if (inB1->x2 == x2)
+			++inB1;
+		if (inB2->x2 == x2)
+			++inB2;
+	}
+}
+
+void SubtractBands(MBoxList &ioBoxes, MBoxIter inB1, MBoxIter inE1, MBoxIter inB2, MBoxIter inE2, int32_t inY1, int32_t inY2)
+{
+	int32_t x1 = inB1->x1;
+
+	auto next = [&]()
+	{
+		if (++inB1 != inE1)
+			x1 = inB1->x1;
+	};
+
+	while (inB1 != inE1 and inB2 != inE2)
+	{
+		if (inB2->x2 <= x1) // subtrahend entirely to the left
+			++inB2;
+		else if (inB2->x1 <= x1) // subtrahend covers the left part
+		{
+			x1 = inB2->x2;
+			if (x1 >= inB1->x2)
+				next();
+			else
+				++inB2;
+		}
+		else if (inB2->x1 < inB1->x2) // subtrahend splits the minuend
+		{
+			ioBoxes.emplace_back(x1, inY1, inB2->x1, inY2);
+			x1 = inB2->x2;
+			if (x1 >= inB1->x2)
+				next();
+			else
+				++inB2;
+		}
+		else // subtrahend entirely to the right
+		{
+			if (inB1->x2 > x1)
+				ioBoxes.emplace_back(x1, inY1, inB1->x2, inY2);
+			next();
+		}
+	}
+
+	while (inB1 != inE1)
+	{
+		ioBoxes.emplace_back(x1, inY1, inB1->x2, inY2);
+		next();
+	}
+}
+
+typedef void (*MOverlapFunc)(MBoxList &, MBoxIter, MBoxIter, MBoxIter, MBoxIter, int32_t, int32_t);
+
+// Walk the bands of both regions, handing overlapping parts to inOverlap.
+// Parts that are in only one of the regions are copied when the
+// corresponding inAppendNon flag is set.
+MBoxList RegionOp(const MBoxList &inR1, const MBoxList &inR2, MOverlapFunc inOverlap, bool inAppendNon1, bool inAppendNon2)
+{
+	MBoxList result;
+	result.reserve(2 * std::max(inR1.size(), inR2.size()));
+
+	MBoxIter r1 = inR1.begin(), r1End = inR1.end();
+	MBoxIter r2 = inR2.begin(), r2End = inR2.end();
+
+	int32_t ytop, ybot = std::min(r1->y1, r2->y1);
+	size_t prevBand = 0, curBand;
+
+	do
+	{
+		MBoxIter r1BandEnd = FindBandEnd(r1, r1End);
+		MBoxIter r2BandEnd = FindBandEnd(r2, r2End);
+
+		int32_t r1y1 = r1->y1, r2y1 = r2->y1;
+
+		if (r1y1 < r2y1)
+		{
+			if (inAppendNon1)
+			{
+				int32_t top = std::max(r1y1, ybot);
+				int32_t bot = std::min(r1->y2, r2y1);
+				if (top != bot)
+				{
+					curBand = result.size();
+					AppendBand(result, r1, r1BandEnd, top, bot);
+					prevBand = Coalesce(result, prevBand, curBand);
+				}
+			}
+			ytop = r2y1;
+		}
+		else if (r2y1 < r1y1)
+		{
+			if (inAppendNon2)
+			{
+				int32_t top = std::max(r2y1, ybot);
+				int32_t bot = std::min(r2->y2, r1y1);
+				if (top != bot)
+				{
+					curBand = result.size();
+					AppendBand(result, r2, r2BandEnd, top, bot);
+					prevBand = Coalesce(result, prevBand, curBand);
+				}
+			}
+			ytop = r1y1;
+		}
+		else
+			ytop = r1y1;
+
+		ybot = std::min(r1->y2, r2->y2);
+		if (ybot > ytop)
+		{
+			curBand = result.size();
+			inOverlap(result, r1, r1BandEnd, r2, r2BandEnd, ytop, ybot);
+			prevBand = Coalesce(result, prevBand, curBand);
+		}
+
+		if (r1->y2 == ybot)
+			r1 = r1BandEnd;
+		if (r2->y2 == ybot)
+			r2 = r2BandEnd;
+	} while (r1 != r1End and r2 != r2End);
+
+	if (r1 != r1End and inAppendNon1)
+	{
+		MBoxIter r1BandEnd = FindBandEnd(r1, r1End);
+		curBand = result.size();
+		AppendBand(result, r1, r1BandEnd, std::max(r1->y1, ybot), r1->y2);
+		Coalesce(result, prevBand, curBand);
+		result.insert(result.end(), r1BandEnd, r1End);
+	}
+	else if (r2 != r2End and inAppendNon2)
+	{
+		MBoxIter r2BandEnd = FindBandEnd(r2, r2End);
+		curBand = result.size();
+		AppendBand(result, r2, r2BandEnd, std::max(r2->y1, ybot), r2->y2);
+		Coalesce(result, prevBand, curBand);
+		result.insert(result.end(), r2BandEnd, r2End);
+	}
+
+	return result;
+}
+
+} // namespace
+
+struct MRegionImpl
+{
+	MRegionImpl() = default;
+
+	MRegionImpl(const MRect &inRect)
+	{
+		if (not inRect.empty())
+		{
+			mBoxes.emplace_back(inRect);
+			mExtents = mBoxes.front();
+		}
+	}
+
+	void SetBoxes(MBoxList &&inBoxes)
+	{
+		mBoxes = std::move(inBoxes);
+
+		if (mBoxes.empty())
+			mExtents = {};
+		else
+		{
+			mExtents = { mBoxes.front().x1, mBoxes.front().y1, mBoxes.back().x2, mBoxes.back().y2 };
+			for (auto &b : mBoxes)
+			{
+				if (mExtents.x1 > b.x1)
+					mExtents.x1 = b.x1;
+				if (mExtents.x2 < b.x2)
+					mExtents.x2 = b.x2;
+			}
+		}
+	}
+
+	// true if the region is exactly one rectangle that contains inBox
+	bool CoversBox(const MBox &inBox) const
+	{
+		return mBoxes.size() == 1 and mExtents.Contains(inBox);
+	}
+
+	void Union(const MRegionImpl &inRegion)
+	{
+		if (inRegion.mBoxes.empty() or CoversBox(inRegion.mExtents))
+			return;
+
+		if (mBoxes.empty() or inRegion.CoversBox(mExtents))
+		{
+			*this = inRegion;
+			return;
+		}
+
+		// common case of adding damage below the current region
+		if (inRegion.mExtents.y1 >= mExtents.y2)
+		{
+			size_t lastBand = mBoxes.size() - 1;
+			while (lastBand > 0 and mBoxes[lastBand - 1].y1 == mBoxes.back().y1)
+				--lastBand;
+
+			MBoxList boxes(std::move(mBoxes));
+			size_t curBand = boxes.size();
+			boxes.insert(boxes.end(), inRegion.mBoxes.begin(), FindBandEnd(inRegion.mBoxes.begin(), inRegion.mBoxes.end()));
+			Coalesce(boxes, lastBand, curBand);
+			boxes.insert(boxes.end(), FindBandEnd(inRegion.mBoxes.begin(), inRegion.mBoxes.end()), inRegion.mBoxes.end());
+
+			MBox extents = mExtents;
+			mBoxes = std::move(boxes);
+			mExtents = {
+				std::min(extents.x1, inRegion.mExtents.x1), extents.y1,
+				std::max(extents.x2, inRegion.mExtents.x2), inRegion.mExtents.y2
+			};
+			return;
+		}
+
+		SetBoxes(RegionOp(mBoxes, inRegion.mBoxes, &UnionBands, true, true));
+	}
+
+	void Intersect(const MRegionImpl &inRegion)
+	{
+		if (mBoxes.empty() or inRegion.mBoxes.empty() or not mExtents.Intersects(inRegion.mExtents))
+			SetBoxes({});
+		else if (inRegion.CoversBox(mExtents))
+			;
+		else if (CoversBox(inRegion.mExtents))
+			*this = inRegion;
+		else
+			SetBoxes(RegionOp(mBoxes, inRegion.mBoxes, &IntersectBands, false, false));
+	}
+
+	void Subtract(const MRegionImpl &inRegion)
+	{
+		if (mBoxes.empty() or inRegion.mBoxes.empty() or not mExtents.Intersects(inRegion.mExtents))
+			return;
+
+		if (inRegion.CoversBox(mExtents))
+			SetBoxes({});
+		else
+			SetBoxes(RegionOp(mBoxes, inRegion.mBoxes, &SubtractBands, true, false));
+	}
+
+	MBoxList mBoxes;
+	MBox mExtents{};
 };
 
 MRegion::MRegion()
@@ -160,9 +560,8 @@ MRegion::MRegion()
 }
 
 MRegion::MRegion(const MRect &inRect)
-	: mImpl(new MRegionImpl())
+	: mImpl(new MRegionImpl(inRect))
 {
-	mImpl->push_back(inRect);
 }
 
 MRegion::MRegion(const MRegion &inRegion)
@@ -170,6 +569,35 @@ MRegion::MRegion(const MRegion &inRegion)
 {
 }
 
+MRegion::MRegion(const std::vector<MRect> &inRects)
+	: mImpl(new MRegionImpl())
+{
+	// Merge pairwise, that is a lot cheaper than adding
+	// the rectangles one by one to an ever growing region
+	std::vector<MRegionImpl> regions;
+	regions.reserve(inRects.size());
+
+	for (auto &r : inRects)
+	{
+		if (not r.empty())
+			regions.emplace_back(r);
+	}
+
+	for (size_t step = 1; step < regions.size(); step *= 2)
+	{
+		for (size_t i = 0; i + step < regions.size(); i += 2 * step)
+			regions[i].Union(regions[i + step]);
+	}
+
+	if (not regions.empty())
+		*mImpl = std::move(regions.front());
+}
+
+MRegion::MRegion(MRegion &&inRegion)
+	: mImpl(std::exchange(inRegion.mImpl, new MRegionImpl()))
+{
+}
+
 MRegion::~MRegion()
 {
 	delete mImpl;
@@ -182,84 +610,157 @@ MRegion &MRegion::operator=(const MRegion &inRegion)
 	return *this;
 }
 
-// MRegion& MRegion::operator&(const MRegion& inRegion) const
-//{
-//	assert(false);
-//	return *this;
-// }
-//
-// MRegion& MRegion::operator&(const MRect& inRect) const
-//{
-//	assert(false);
-//	return *this;
-// }
-//
-// MRegion& MRegion::operator&=(const MRegion& inRegion) const
-//{
-//	assert(false);
-//	return *this;
-// }
-//
-// MRegion& MRegion::operator&=(const MRect& inRect)
-//{
-//	assert(false);
-//	return *this;
-// }
-
-// MRegion& MRegion::operator|(const MRegion& inRegion) const
-//{
-//	assert(false);
-//	return *this;
-// }
-//
-// MRegion& MRegion::operator|(const MRect& inRect) const
-//{
-//	mImpl->push_back(inRect);
-//	return *this;
-// }
-//
-// MRegion& MRegion::operator|=(const MRegion& inRegion)
-//{
-//	assert(false);
-//	return *this;
-// }
+MRegion &MRegion::operator=(MRegion &&inRegion)
+{
+	if (this != &inRegion)
+		std::swap(mImpl, inRegion.mImpl);
+	return *this;
+}
+
+MRegion MRegion::operator&(const MRegion &inRegion) const
+{
+	MRegion result(*this);
+	result &= inRegion;
+	return result;
+}
+
+MRegion MRegion::operator&(const MRect &inRect) const
+{
+	MRegion result(*this);
+	result &= inRect;
+	return result;
+}
+
+MRegion &MRegion::operator&=(const MRegion &inRegion)
+{
+	mImpl->Intersect(*inRegion.mImpl);
+	return *this;
+}
+
+MRegion &MRegion::operator&=(const MRect &inRect)
+{
+	mImpl->Intersect(MRegionImpl(inRect));
+	return *this;
+}
+
+MRegion MRegion::operator|(const MRegion &inRegion) const
+{
+	MRegion result(*this);
+	result |= inRegion;
+	return result;
+}
+
+MRegion MRegion::operator|(const MRect &inRect) const
+{
+	MRegion result(*this);
+	result |= inRect;
+	return result;
+}
+
+MRegion &MRegion::operator|=(const MRegion &inRegion)
+{
+	mImpl->Union(*inRegion.mImpl);
+	return *this;
+}
 
 MRegion &MRegion::operator|=(const MRect &inRect)
 {
-	mImpl->push_back(inRect);
+	mImpl->Union(MRegionImpl(inRect));
 	return *this;
 }
 
-MRegion::operator bool() const
+MRegion MRegion::operator-(const MRegion &inRegion) const
 {
-	bool result = true;
-	if (not mImpl->empty())
-	{
-		result = find_if(mImpl->begin(), mImpl->end(),
-					 [](const MRect &r)
-					 { return not r; }) == mImpl->end();
-	}
+	MRegion result(*this);
+	result -= inRegion;
+	return result;
+}
 
+MRegion MRegion::operator-(const MRect &inRect) const
+{
+	MRegion result(*this);
+	result -= inRect;
 	return result;
 }
 
+MRegion &MRegion::operator-=(const MRegion &inRegion)
+{
+	mImpl->Subtract(*inRegion.mImpl);
+	return *this;
+}
+
+MRegion &MRegion::operator-=(const MRect &inRect)
+{
+	mImpl->Subtract(MRegionImpl(inRect));
+	return *this;
+}
+
+bool MRegion::operator==(const MRegion &inRegion) const
+{
+	return mImpl->mBoxes == inRegion.mImpl->mBoxes;
+}
+
+bool MRegion::empty() const
+{
+	return mImpl->mBoxes.empty();
+}
+
 void MRegion::OffsetBy(int32_t inX, int32_t inY)
 {
-	assert(false);
+	for (auto &b : mImpl->mBoxes)
+	{
+		b.x1 += inX;
+		b.x2 += inX;
+		b.y1 += inY;
+		b.y2 += inY;
+	}
+
+	if (not mImpl->mBoxes.empty())
+	{
+		mImpl->mExtents.x1 += inX;
+		mImpl->mExtents.x2 += inX;
+		mImpl->mExtents.y1 += inY;
+		mImpl->mExtents.y2 += inY;
+	}
 }
 
 bool MRegion::ContainsPoint(int32_t inX, int32_t inY) const
 {
-	return find_if(mImpl->begin(), mImpl->end(),
-			   [&inX, &inY](const MRect &r)
-			   { return r.ContainsPoint(inX, inY); }) != mImpl->end();
+	const MBoxList &boxes = mImpl->mBoxes;
+	const MBox &e = mImpl->mExtents;
+
+	if (boxes.empty() or inX < e.x1 or inX >= e.x2 or inY < e.y1 or inY >= e.y2)
+		return false;
+
+	// bands are sorted on y, find the first box whose band ends below inY
+	auto b = std::upper_bound(boxes.begin(), boxes.end(), inY,
+		[](int32_t y, const MBox &box)
+		{ return y < box.y2; });
+
+	if (b == boxes.end() or b->y1 > inY)
+		return false;
+
+	auto bandEnd = FindBandEnd(b, boxes.end());
+
+	// and the first box in that band that ends right of inX
+	b = std::upper_bound(b, bandEnd, inX,
+		[](int32_t x, const MBox &box)
+		{ return x < box.x2; });
+
+	return b != bandEnd and b->x1 <= inX;
 }
 
 MRect MRegion::GetBounds() const
 {
-	MRect bounds;
-	for_each(mImpl->begin(), mImpl->end(),
-		[&bounds](const MRect &r)
-		{ bounds &= r; });
-	return bounds;
+	return mImpl->mExtents;
+}
+
+uint32_t MRegion::GetRectCount() const
+{
+	return static_cast<uint32_t>(mImpl->mBoxes.size());
+}
+
+std::vector<MRect> MRegion::GetRects() const
+{
+	return { mImpl->mBoxes.begin(), mImpl->mBoxes.end() };
 }
@@ -33,10 +33,25 @@
 #include "MError.hpp"
 #include "MTypes.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstring>
 #include <iterator>
 #include <sstream>
 
+#if defined(__SSE2__) or defined(_M_X64)
+#define MUNICODE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define MUNICODE_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#define MUNICODE_NEON 1
+#include <arm_neon.h>
+#endif
+
 enum WordBreakClass
 {
 	eWB_CR,
@@ -287,3 +302,898 @@ void Trim(std::string &ioString)
 	if (e < ioString.end())
 		ioString.erase(e, ioString.end());
 }
+
+// --------------------------------------------------------------------
+// Scanning for runs of ASCII text. The text iterators below skip these
+// runs without decoding them, which is where most of their time goes
+// in ordinary text. The kernels use SSE2, AVX2 or NEON when available,
+// selected at first use as in MBitmapOps, and fall back to plain C++
+// that tests eight bytes at a time.
+
+namespace
+{
+
+inline bool IsASCIIAlphaNumeric(uint8_t inByte)
+{
+	return (inByte >= 'a' and inByte <= 'z') or (inByte >= 'A' and inByte <= 'Z') or (inByte >= '0' and inByte <= '9');
+}
+
+// The kernels return the number of bytes at the start of inText that
+// are ASCII, or ASCII letters and digits respectively.
+
+size_t ASCIIRunScalar(const char *inText, size_t inLength)
+{
+	const uint64_t kHighBits = 0x8080808080808080ULL;
+
+	size_t result = 0;
+
+	while (result + 8 <= inLength)
+	{
+		uint64_t bytes;
+		std::memcpy(&bytes, inText + result, sizeof(bytes));
+		if (bytes & kHighBits)
+			break;
+		result += 8;
+	}
+
+	while (result < inLength and (inText[result] & 0x080) == 0)
+		++result;
+
+	return result;
+}
+
+size_t AlphaNumericRunScalar(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	while (result < inLength and IsASCIIAlphaNumeric(inText[result]))
+		++result;
+	return result;
+}
+
+#if MUNICODE_SSE2
+
+// a mask with the bytes that are ASCII letters or digits set, using
+// signed compares on a biased value as SSE2 has no unsigned ones
+inline __m128i AlphaNumericMask(__m128i inBytes)
+{
+	__m128i lower = _mm_or_si128(inBytes, _mm_set1_epi8(0x20));
+
+	__m128i letter = _mm_cmplt_epi8(_mm_add_epi8(lower, _mm_set1_epi8(static_cast<char>(0x80 - 'a'))),
+		_mm_set1_epi8(static_cast<char>(0x80 + 26)));
+	__m128i digit = _mm_cmplt_epi8(_mm_add_epi8(inBytes, _mm_set1_epi8(static_cast<char>(0x80 - '0'))),
+		_mm_set1_epi8(static_cast<char>(0x80 + 10)));
+
+	return _mm_or_si128(letter, digit);
+}
+
+size_t ASCIIRunSSE2(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	for (; result + 16 <= inLength; result += 16)
+	{
+		uint32_t mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(inText + result)));
+		if (mask != 0)
+			return result + __builtin_ctz(mask);
+	}
+
+	return result + ASCIIRunScalar(inText + result, inLength - result);
+}
+
+size_t AlphaNumericRunSSE2(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	for (; result + 16 <= inLength; result += 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inText + result));
+		uint32_t mask = ~_mm_movemask_epi8(AlphaNumericMask(bytes)) & 0x0ffff;
+		if (mask != 0)
+			return result + __builtin_ctz(mask);
+	}
+
+	return result + AlphaNumericRunScalar(inText + result, inLength - result);
+}
+
+#endif
+
+#if MUNICODE_AVX2
+
+#define MUNICODE_AVX2_TARGET __attribute__((target("avx2")))
+
+MUNICODE_AVX2_TARGET size_t ASCIIRunAVX2(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	for (; result + 32 <= inLength; result += 32)
+	{
+		uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(inText + result)));
+		if (mask != 0)
+		{
+			_mm256_zeroupper();
+			return result + __builtin_ctz(mask);
+		}
+	}
+
+	_mm256_zeroupper();
+	return result + ASCIIRunSSE2(inText + result, inLength - result);
+}
+
+MUNICODE_AVX2_TARGET size_t AlphaNumericRunAVX2(const char *inText, size_t inLength)
+{
+	const __m256i caseBit = _mm256_set1_epi8(0x20);
+	const __m256i letterBias = _mm256_set1_epi8(static_cast<char>(0x80 - 'a'));
+	const __m256i letterLimit = _mm256_set1_epi8(static_cast<char>(0x80 + 26));
+	const __m256i digitBias = _mm256_set1_epi8(static_cast<char>(0x80 - '0'));
+	const __m256i digitLimit = _mm256_set1_epi8(static_cast<char>(0x80 + 10));
+
+	size_t result = 0;
+	for (; result + 32 <= inLength; result += 32)
+	{
+		__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inText + result));
+
+		__m256i letter = _mm256_cmpgt_epi8(letterLimit, _mm256_add_epi8(_mm256_or_si256(bytes, caseBit), letterBias));
+		__m256i digit = _mm256_cmpgt_epi8(digitLimit, _mm256_add_epi8(bytes, digitBias));
+
+		uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(letter, digit)));
+		if (mask != 0)
+		{
+			_mm256_zeroupper();
+			return result + __builtin_ctz(mask);
+		}
+	}
+
+	_mm256_zeroupper();
+	return result + AlphaNumericRunSSE2(inText + result, inLength - result);
+}
+
+#undef MUNICODE_AVX2_TARGET
+
+#endif
+
+#if MUNICODE_NEON
+
+// NEON has no movemask, the horizontal max or min tells whether a block
+// is all ASCII, the scalar code then finds the exact position.
+
+size_t ASCIIRunNEON(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	for (; result + 16 <= inLength; result += 16)
+	{
+		if (vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(inText + result))) >= 0x80)
+			break;
+	}
+
+	return result + ASCIIRunScalar(inText + result, inLength - result);
+}
+
+size_t AlphaNumericRunNEON(const char *inText, size_t inLength)
+{
+	size_t result = 0;
+	for (; result + 16 <= inLength; result += 16)
+	{
+		uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t *>(inText + result));
+
+		uint8x16_t letter = vcltq_u8(vsubq_u8(vorrq_u8(bytes, vdupq_n_u8(0x20)), vdupq_n_u8('a')), vdupq_n_u8(26));
+		uint8x16_t digit = vcltq_u8(vsubq_u8(bytes, vdupq_n_u8('0')), vdupq_n_u8(10));
+
+		if (vminvq_u8(vorrq_u8(letter, digit)) == 0)
+			break;
+	}
+
+	return result + AlphaNumericRunScalar(inText + result, inLength - result);
+}
+
+#endif
+
+struct MScanKernels
+{
+	size_t (*mASCIIRun)(const char *, size_t);
+	size_t (*mAlphaNumericRun)(const char *, size_t);
+};
+
+MScanKernels SelectScanKernels()
+{
+#if MUNICODE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return { ASCIIRunAVX2, AlphaNumericRunAVX2 };
+#endif
+
+#if MUNICODE_SSE2
+	return { ASCIIRunSSE2, AlphaNumericRunSSE2 };
+#elif MUNICODE_NEON
+	return { ASCIIRunNEON, AlphaNumericRunNEON };
+#else
+	return { ASCIIRunScalar, AlphaNumericRunScalar };
+#endif
+}
+
+const MScanKernels &ScanKernels()
+{
+	static const MScanKernels sKernels = SelectScanKernels();
+	return sKernels;
+}
+
+// The number of bytes starting at inOffset that are ASCII
+inline size_t ASCIIRunLength(std::string_view inText, size_t inOffset)
+{
+	return ScanKernels().mASCIIRun(inText.data() + inOffset, inText.length() - inOffset);
+}
+
+// The number of bytes starting at inOffset that are ASCII letters or digits
+inline size_t AlphaNumericRunLength(std::string_view inText, size_t inOffset)
+{
+	return ScanKernels().mAlphaNumericRun(inText.data() + inOffset, inText.length() - inOffset);
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+// Line breaking using the pair table from UAX #14. The classes up to
+// and including kLBC_HangulTJamo index the table, the others are
+// resolved before a pair is looked up.
+//
+//	_	direct break
+//	%	indirect break, only when there are spaces in between
+//	#	combining mark, indirect
+//	@	combining mark, prohibited
+//	^	prohibited, even with spaces in between
+
+namespace
+{
+
+constexpr uint32_t kPairTableSize = kLBC_HangulTJamo + 1;
+
+// clang-format off
+constexpr const char *kPairTable[kPairTableSize] = {
+	//  OP CL CP QU GL NS EX SY IS PR PO NU AL ID IN HY BA BB B2 ZW CM WJ H2 H3 JL JV JT
+	"^^^^^^^^^^^^^^^^^^^^@^^^^^^", // OP
+	"_^^%%^^^^%%____%%__^#^_____", // CL
+	"_^^%%^^^^%%%%__%%__^#^_____", // CP
+	"^^^%%%^^^%%%%%%%%%%^#^%%%%%", // QU
+	"%^^%%%^^^%%%%%%%%%%^#^%%%%%", // GL
+	"_^^%%%^^^______%%__^#^_____", // NS
+	"_^^%%%^^^______%%__^#^_____", // EX
+	"_^^%%%^^^__%___%%__^#^_____", // SY
+	"_^^%%%^^^__%%__%%__^#^_____", // IS
+	"%^^%%%^^^__%%%_%%__^#^%%%%%", // PR
+	"%^^%%%^^^__%%__%%__^#^_____", // PO
+	"%^^%%%^^^%%%%_%%%__^#^_____", // NU
+	"%^^%%%^^^%%%%_%%%__^#^_____", // AL
+	"_^^%%%^^^_%___%%%__^#^_____", // ID
+	"_^^%%%^^^_____%%%__^#^_____", // IN
+	"_^^%_%^^^__%___%%__^#^_____", // HY
+	"_^^%_%^^^______%%__^#^_____", // BA
+	"%^^%%%^^^%%%%%%%%%%^#^%%%%%", // BB
+	"_^^%%%^^^______%%_^^#^_____", // B2
+	"___________________^_______", // ZW
+	"%^^%%%^^^%%%%_%%%__^#^_____", // CM
+	"%^^%%%^^^%%%%%%%%%%^#^%%%%%", // WJ
+	"_^^%%%^^^_%___%%%__^#^___%%", // H2
+	"_^^%%%^^^_%___%%%__^#^____%", // H3
+	"_^^%%%^^^_%___%%%__^#^%%%%_", // JL
+	"_^^%%%^^^_%___%%%__^#^___%%", // JV
+	"_^^%%%^^^_%___%%%__^#^____%", // JT
+};
+// clang-format on
+
+constexpr bool CheckPairTable()
+{
+	for (auto row : kPairTable)
+	{
+		if (std::string_view(row).length() != kPairTableSize)
+			return false;
+	}
+	return true;
+}
+
+static_assert(CheckPairTable(), "every row in the pair table should have a column for each class");
+
+// Classes that have no column in the table are mapped to one that has,
+// complex context scripts like Thai are only broken at spaces.
+LineBreakClass ResolveClass(LineBreakClass inClass)
+{
+	switch (inClass)
+	{
+		case kLBC_Ambiguous:
+		case kLBC_Surrogate:
+		case kLBC_Unknown:
+		case kLBC_ComplexContext:
+			return kLBC_Alphabetic;
+
+		case kLBC_ContigentBreakOpportunity:
+			return kLBC_Ideographic;
+
+		case kLBC_NextLine:
+			return kLBC_MandatoryBreak;
+
+		default:
+			return inClass;
+	}
+}
+
+} // namespace
+
+MLineBreakIterator::MLineBreakIterator(std::string_view inText)
+	: mText(inText)
+{
+	mDone = mText.empty();
+
+	if (not mDone)
+	{
+		uint32_t length;
+		mClass = ReadClass(0, length);
+		mNext = length;
+
+		if (mClass == kLBC_Space)
+			mClass = kLBC_WordJoiner;
+		else if (mClass == kLBC_LineFeed)
+			mClass = kLBC_MandatoryBreak;
+	}
+}
+
+uint32_t MLineBreakIterator::ReadClass(size_t inOffset, uint32_t &outLength) const
+{
+	uint8_t ch = static_cast<uint8_t>(mText[inOffset]);
+
+	// ASCII is always on the first page, no need to decode anything
+	if (ch < 0x80)
+	{
+		outLength = 1;
+		return ResolveClass(kUnicodeInfo.data[0][ch].lbc);
+	}
+
+	unicode uc = 0x0FFFD;
+	outLength = 1;
+
+	// don't let ReadUnicode read past the end of the text
+	uint32_t expected = (ch & 0x0E0) == 0x0C0 ? 2 : (ch & 0x0F0) == 0x0E0 ? 3
+	                                            : (ch & 0x0F8) == 0x0F0   ? 4
+	                                                                      : 1;
+	if (expected > 1 and inOffset + expected <= mText.length())
+		MEncodingTraits<kEncodingUTF8>::ReadUnicode(mText.begin() + inOffset, outLength, uc);
+
+	LineBreakClass result = kLBC_Unknown;
+	if (uc < 0x110000)
+		result = kUnicodeInfo.data[kUnicodeInfo.page_index[uc >> 8]][uc & 0x0FF].lbc;
+
+	return ResolveClass(result);
+}
+
+bool MLineBreakIterator::Next()
+{
+	if (mDone)
+		return false;
+
+	while (mNext < mText.length())
+	{
+		// runs of ASCII letters and digits never contain a break
+		if ((mClass == kLBC_Alphabetic or mClass == kLBC_Numeric) and not mAfterSpace)
+		{
+			size_t n = mNext + AlphaNumericRunLength(mText, mNext);
+
+			if (n > mNext)
+			{
+				mClass = mText[n - 1] <= '9' ? kLBC_Numeric : kLBC_Alphabetic;
+				mNext = n;
+				continue;
+			}
+		}
+
+		uint32_t length;
+		uint32_t cls = ReadClass(mNext, length);
+		size_t offset = mNext;
+		mNext += length;
+
+		// hard line breaks, a CR LF pair counts as one
+		if (mClass == kLBC_MandatoryBreak or (mClass == kLBC_CarriageReturn and cls != kLBC_LineFeed))
+		{
+			mOffset = offset;
+			mMandatory = true;
+			mAfterSpace = false;
+
+			// like at the start of the text
+			if (cls == kLBC_Space)
+				mClass = kLBC_WordJoiner;
+			else if (cls == kLBC_LineFeed)
+				mClass = kLBC_MandatoryBreak;
+			else
+				mClass = cls;
+
+			return true;
+		}
+
+		if (cls == kLBC_Space)
+		{
+			mAfterSpace = true;
+			continue;
+		}
+
+		if (cls == kLBC_MandatoryBreak or cls == kLBC_LineFeed or cls == kLBC_CarriageReturn)
+		{
+			mClass = cls == kLBC_CarriageReturn ? kLBC_CarriageReturn : kLBC_MandatoryBreak;
+			mAfterSpace = false;
+			continue;
+		}
+
+		bool afterSpace = mAfterSpace;
+		bool result = false;
+
+		mAfterSpace = false;
+
+		switch (kPairTable[mClass][cls])
+		{
+			case '_':
+				result = true;
+				break;
+
+			case '%':
+				result = afterSpace;
+				break;
+
+			case '#':
+				// a combining mark takes the class of the character it follows,
+				// after a space it acts as a letter
+				if (not afterSpace)
+					continue;
+				result = true;
+				cls = kLBC_Alphabetic;
+				break;
+
+			case '@':
+				if (not afterSpace)
+					continue;
+				cls = kLBC_Alphabetic;
+				break;
+
+			default:
+				break;
+		}
+
+		mClass = cls;
+
+		if (result)
+		{
+			mOffset = offset;
+			mMandatory = false;
+			return true;
+		}
+	}
+
+	// the end of the text
+	mOffset = mText.length();
+	mMandatory = true;
+	mDone = true;
+
+	return true;
+}
+
+// --------------------------------------------------------------------
+// Grapheme and word boundaries, UAX #29
+
+namespace
+{
+
+const unicode kZeroWidthJoiner = 0x0200D;
+
+// Decode the character at inOffset, the text does not have to be
+// terminated.
+unicode ReadChar(std::string_view inText, size_t inOffset, uint32_t &outLength)
+{
+	uint8_t ch = static_cast<uint8_t>(inText[inOffset]);
+
+	outLength = 1;
+	if (ch < 0x80)
+		return ch;
+
+	unicode result = 0x0FFFD;
+
+	uint32_t expected = (ch & 0x0E0) == 0x0C0 ? 2 : (ch & 0x0F0) == 0x0E0 ? 3
+	                                            : (ch & 0x0F8) == 0x0F0   ? 4
+	                                                                      : 1;
+	if (expected > 1 and inOffset + expected <= inText.length())
+		MEncodingTraits<kEncodingUTF8>::ReadUnicode(inText.begin() + inOffset, outLength, result);
+
+	return result;
+}
+
+size_t PrevCharStart(std::string_view inText, size_t inOffset)
+{
+	size_t result = inOffset - 1;
+	while (result > 0 and inOffset - result < 4 and (inText[result] & 0x0C0) == 0x080)
+		--result;
+	return result;
+}
+
+const MUnicodeInfoAtom &GetInfo(unicode inUnicode)
+{
+	if (inUnicode >= 0x110000)
+		inUnicode = 0x0FFFD;
+	return kUnicodeInfo.data[kUnicodeInfo.page_index[inUnicode >> 8]][inUnicode & 0x0FF];
+}
+
+inline bool IsRegionalIndicator(unicode inUnicode)
+{
+	return inUnicode >= 0x1F1E6 and inUnicode <= 0x1F1FF;
+}
+
+bool IsGraphemeBoundary(unicode inBefore, unicode inAfter)
+{
+	CharBreakClass a = GetInfo(inBefore).cbc, b = GetInfo(inAfter).cbc;
+
+	if (a == kCBC_CR and b == kCBC_LF)
+		return false;
+
+	if (a == kCBC_CR or a == kCBC_LF or a == kCBC_Control or b == kCBC_CR or b == kCBC_LF or b == kCBC_Control)
+		return true;
+
+	switch (a)
+	{
+		case kCBC_L:
+			if (b == kCBC_L or b == kCBC_V or b == kCBC_LV or b == kCBC_LVT)
+				return false;
+			break;
+
+		case kCBC_LV:
+		case kCBC_V:
+			if (b == kCBC_V or b == kCBC_T)
+				return false;
+			break;
+
+		case kCBC_LVT:
+		case kCBC_T:
+			if (b == kCBC_T)
+				return false;
+			break;
+
+		case kCBC_Prepend:
+			return false;
+
+		default:
+			break;
+	}
+
+	return not(b == kCBC_Extend or b == kCBC_SpacingMark or inAfter == kZeroWidthJoiner or inBefore == kZeroWidthJoiner);
+}
+
+} // namespace
+
+bool MGraphemeIterator::IsBoundary(std::string_view inText, size_t inOffset)
+{
+	if (inOffset == 0 or inOffset >= inText.length())
+		return true;
+
+	uint8_t before = inText[inOffset - 1], after = inText[inOffset];
+
+	// two ASCII characters are only joined when they are CR LF
+	if (before < 0x80 and after < 0x80)
+		return before != '\r' or after != '\n';
+
+	// inOffset should not be in the middle of a character
+	if ((after & 0x0C0) == 0x080)
+		return false;
+
+	uint32_t length;
+	unicode a = ReadChar(inText, PrevCharStart(inText, inOffset), length);
+	unicode b = ReadChar(inText, inOffset, length);
+
+	if (IsRegionalIndicator(a) and IsRegionalIndicator(b))
+	{
+		// flags are pairs of regional indicators, count the ones before
+		uint32_t count = 0;
+		for (size_t o = inOffset; o > 0 and IsRegionalIndicator(ReadChar(inText, PrevCharStart(inText, o), length)); o = PrevCharStart(inText, o))
+			++count;
+		return count % 2 == 0;
+	}
+
+	return IsGraphemeBoundary(a, b);
+}
+
+bool MGraphemeIterator::Next()
+{
+	if (mOffset >= mText.length())
+		return false;
+
+	do
+	{
+		uint32_t length;
+		ReadChar(mText, mOffset, length);
+		mOffset += length;
+	} while (not IsBoundary(mText, mOffset));
+
+	return true;
+}
+
+bool MGraphemeIterator::Prev()
+{
+	if (mOffset == 0)
+		return false;
+
+	do
+		mOffset = PrevCharStart(mText, mOffset);
+	while (not IsBoundary(mText, mOffset));
+
+	return true;
+}
+
+size_t MGraphemeIterator::Count(std::string_view inText)
+{
+	size_t result = 0;
+
+	for (size_t offset = 0; offset < inText.length();)
+	{
+		// each ASCII character is a cluster of its own, except for
+		// the LF in CR LF pairs and the last one if a mark follows
+		size_t n = ASCIIRunLength(inText, offset);
+		if (n > 1)
+		{
+			size_t pairs = 0;
+			for (size_t i = offset + 1; i < offset + n; ++i)
+			{
+				if (inText[i] == '\n' and inText[i - 1] == '\r')
+					++pairs;
+			}
+
+			result += n - 1 - pairs;
+			offset += n - 1;
+		}
+
+		MGraphemeIterator iter(inText, offset);
+		iter.Next();
+		offset = iter.GetOffset();
+		++result;
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+WordBreakClass GetWordBreakClass(unicode inUnicode)
+{
+	switch (inUnicode)
+	{
+		case '\r': return eWB_CR;
+		case '\n': return eWB_LF;
+		case '\t': return eWB_Tab;
+		case '_': return eWB_Let;
+		default: break;
+	}
+
+	WordBreakClass result = eWB_Other;
+
+	switch (GetInfo(inUnicode).prop)
+	{
+		case kLETTER:
+		case kNUMBER:
+			if (inUnicode >= 0x03040 and inUnicode <= 0x0309F)
+				result = eWB_Hira;
+			else if (inUnicode >= 0x030A0 and inUnicode <= 0x030FF)
+				result = eWB_Kata;
+			else if ((inUnicode >= 0x04E00 and inUnicode <= 0x09FFF) or (inUnicode >= 0x03400 and inUnicode <= 0x04DBF) or
+					 (inUnicode >= 0x0F900 and inUnicode <= 0x0FAFF) or (inUnicode >= 0x20000 and inUnicode <= 0x2FFFF))
+				result = eWB_Han;
+			else
+				result = eWB_Let;
+			break;
+
+		case kCOMBININGMARK:
+			result = eWB_Com;
+			break;
+
+		case kSEPARATOR:
+			result = eWB_Sep;
+			break;
+
+		default:
+			break;
+	}
+
+	return result;
+}
+
+// characters that do not break a word when between letters or digits
+inline bool IsMidLetter(unicode inUnicode)
+{
+	return inUnicode == '\'' or inUnicode == '.' or inUnicode == 0x02019;
+}
+
+// and those that only do so between digits
+inline bool IsMidNumber(unicode inUnicode)
+{
+	return inUnicode == ',' or inUnicode == ';';
+}
+
+// The first character of the grapheme cluster before inOffset
+unicode CharBefore(std::string_view inText, size_t inOffset, size_t &outStart)
+{
+	MGraphemeIterator iter(inText, inOffset);
+	iter.Prev();
+	outStart = iter.GetOffset();
+
+	uint32_t length;
+	return ReadChar(inText, outStart, length);
+}
+
+// The first character of the grapheme cluster at inOffset
+unicode CharAt(std::string_view inText, size_t inOffset, size_t &outEnd)
+{
+	MGraphemeIterator iter(inText, inOffset);
+	iter.Next();
+	outEnd = iter.GetOffset();
+
+	uint32_t length;
+	return ReadChar(inText, inOffset, length);
+}
+
+bool IsNumber(unicode inUnicode)
+{
+	return GetInfo(inUnicode).prop == kNUMBER;
+}
+
+// Are a and b, with a before b, part of the same word or run?
+bool JoinWords(WordBreakClass a, WordBreakClass b)
+{
+	switch (a)
+	{
+		case eWB_CR: return b == eWB_LF;
+		case eWB_Sep:
+		case eWB_Tab: return b == eWB_Sep or b == eWB_Tab;
+		case eWB_Let: return b == eWB_Let or b == eWB_Com;
+		case eWB_Han: return b == eWB_Han or b == eWB_Hira;
+		case eWB_Hira: return b == eWB_Hira;
+		case eWB_Kata: return b == eWB_Kata;
+		case eWB_Other: return false;
+		default: return false;
+	}
+}
+
+} // namespace
+
+bool MWordIterator::IsBoundary(std::string_view inText, size_t inOffset)
+{
+	if (inOffset == 0 or inOffset >= inText.length())
+		return true;
+
+	uint8_t before = inText[inOffset - 1], after = inText[inOffset];
+
+	// the common case, inside a word of ASCII letters and digits
+	if (before < 0x80 and after < 0x80 and std::isalnum(before) and std::isalnum(after))
+		return false;
+
+	if (not MGraphemeIterator::IsBoundary(inText, inOffset))
+		return false;
+
+	size_t start, end;
+	unicode a = CharBefore(inText, inOffset, start);
+	unicode b = CharAt(inText, inOffset, end);
+
+	WordBreakClass ca = GetWordBreakClass(a), cb = GetWordBreakClass(b);
+
+	if (JoinWords(ca, cb))
+		return false;
+
+	// letter . letter, digit , digit
+	if (ca == eWB_Let and (IsMidLetter(b) or (IsMidNumber(b) and IsNumber(a))) and end < inText.length())
+	{
+		size_t next;
+		unicode c = CharAt(inText, end, next);
+		if (GetWordBreakClass(c) == eWB_Let and (IsMidLetter(b) or IsNumber(c)))
+			return false;
+	}
+
+	if (cb == eWB_Let and (IsMidLetter(a) or (IsMidNumber(a) and IsNumber(b))) and start > 0)
+	{
+		size_t prev;
+		unicode c = CharBefore(inText, start, prev);
+		if (GetWordBreakClass(c) == eWB_Let and (IsMidLetter(a) or IsNumber(c)))
+			return false;
+	}
+
+	return true;
+}
+
+bool MWordIterator::Next()
+{
+	if (mOffset >= mText.length())
+		return false;
+
+	mOther = mOffset;
+
+	size_t offset = mOffset;
+	for (;;)
+	{
+		// there are no boundaries between ASCII letters and digits
+		size_t n = AlphaNumericRunLength(mText, offset);
+		if (n > 1)
+			offset += n - 1;
+
+		MGraphemeIterator iter(mText, offset);
+		iter.Next();
+		offset = iter.GetOffset();
+
+		if (IsBoundary(mText, offset))
+			break;
+	}
+
+	mOffset = offset;
+	return true;
+}
+
+bool MWordIterator::Prev()
+{
+	if (mOffset == 0)
+		return false;
+
+	mOther = mOffset;
+
+	MGraphemeIterator iter(mText, mOffset);
+	do
+		iter.Prev();
+	while (not IsBoundary(mText, iter.GetOffset()));
+
+	mOffset = iter.GetOffset();
+	return true;
+}
+
+bool MWordIterator::IsWord() const
+{
+	size_t start = std::min(mOffset, mOther), end = std::max(mOffset, mOther);
+
+	bool result = false;
+	if (start < end)
+	{
+		uint32_t length;
+		switch (GetWordBreakClass(ReadChar(mText, start, length)))
+		{
+			case eWB_Let:
+			case eWB_Han:
+			case eWB_Hira:
+			case eWB_Kata:
+				result = true;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return result;
+}
+
+std::pair<size_t, size_t> MWordIterator::FindWord(std::string_view inText, size_t inOffset)
+{
+	inOffset = std::min(inOffset, inText.length());
+
+	// move to the start of the character containing inOffset
+	while (inOffset > 0 and inOffset < inText.length() and (inText[inOffset] & 0x0C0) == 0x080)
+		--inOffset;
+
+	MWordIterator iter(inText, inOffset);
+
+	// at the end of the text, take the last word
+	if (inOffset == inText.length() or not IsBoundary(inText, inOffset))
+		iter.Prev();
+	size_t start = iter.GetOffset();
+
+	iter = MWordIterator(inText, start);
+	iter.Next();
+	size_t end = iter.GetOffset();
+
+	return { start, end };
+}
+
+size_t MWordIterator::CountWords(std::string_view inText)
+{
+	size_t result = 0;
+
+	MWordIterator iter(inText);
+	while (iter.Next())
+	{
+		if (iter.IsWord())
+			++result;
+	}
+
+	return result;
+}
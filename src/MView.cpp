@@ -226,6 +226,11 @@ void MView::Invalidate()
 {
 }
 
+void MView::Invalidate(MRect inRect)
+{
+	Invalidate();
+}
+
 void MView::UpdateNow()
 {
 	if (mParent != nullptr)
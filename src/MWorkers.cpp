@@ -0,0 +1,144 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MWorkers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+// --------------------------------------------------------------------
+
+MWorkers &MWorkers::Instance()
+{
+	static MWorkers sInstance;
+	return sInstance;
+}
+
+MWorkers::MWorkers()
+{
+	uint32_t n = std::max(std::thread::hardware_concurrency(), 2U) - 1;
+	for (uint32_t i = 0; i < n; ++i)
+		mThreads.emplace_back(&MWorkers::Run, this);
+}
+
+MWorkers::~MWorkers()
+{
+	{
+		std::unique_lock lock(mMutex);
+		mDone = true;
+		mCV.notify_all();
+	}
+
+	for (auto &t : mThreads)
+		t.join();
+}
+
+void MWorkers::Enqueue(std::function<void()> &&inJob)
+{
+	std::unique_lock lock(mMutex);
+	mJobs.push_back(std::move(inJob));
+	mCV.notify_one();
+}
+
+void MWorkers::Run()
+{
+	for (;;)
+	{
+		std::unique_lock lock(mMutex);
+		mCV.wait(lock, [this]
+			{ return mDone or not mJobs.empty(); });
+
+		if (mDone)
+			break;
+
+		auto job = std::move(mJobs.back());
+		mJobs.pop_back();
+
+		lock.unlock();
+
+		job();
+	}
+}
+
+void MWorkers::ParallelFor(uint32_t inCount, const std::function<void(uint32_t)> &inFunc)
+{
+	// The indices are handed out one at a time from mNext. A helper job
+	// may start only after all indices were taken, it then finds nothing
+	// left to do. It must not touch inFunc in that case, as the caller
+	// may have returned already, hence the shared state.
+	struct MState
+	{
+		const std::function<void(uint32_t)> *mFunc;
+		uint32_t mCount;
+		std::atomic<uint32_t> mNext = 0;
+		std::mutex mMutex;
+		std::condition_variable mCV;
+		uint32_t mFinished = 0;
+
+		void Work()
+		{
+			uint32_t finished = 0;
+			for (uint32_t i = mNext++; i < mCount; i = mNext++)
+			{
+				(*mFunc)(i);
+				++finished;
+			}
+
+			if (finished > 0)
+			{
+				std::unique_lock lock(mMutex);
+				mFinished += finished;
+				if (mFinished == mCount)
+					mCV.notify_one();
+			}
+		}
+	};
+
+	if (inCount == 0)
+		return;
+
+	auto state = std::make_shared<MState>();
+	state->mFunc = &inFunc;
+	state->mCount = inCount;
+
+	uint32_t helpers = std::min<uint32_t>(inCount - 1, static_cast<uint32_t>(mThreads.size()));
+
+	if (helpers > 0)
+	{
+		std::unique_lock lock(mMutex);
+		for (uint32_t i = 0; i < helpers; ++i)
+			mJobs.push_back([state]
+				{ state->Work(); });
+		mCV.notify_all();
+	}
+
+	state->Work();
+
+	std::unique_lock lock(state->mMutex);
+	state->mCV.wait(lock, [&state]
+		{ return state->mFinished == state->mCount; });
+}